@@ -0,0 +1,223 @@
+// Batched multiply for many independent small matrices
+// SmallMatrixBatch<T, N> holds count N x N matrices interleaved across the
+// batch (AoSoA): matrices are taken in groups of one cache line's worth of
+// lanes (8 doubles or 16 ints), and within a group element (i, j) of every
+// matrix is stored contiguously, one lane per matrix. batchMultiply then
+// computes C[b] = A[b] * B[b] for every b with each multiply-add working on
+// a whole lane vector, so SIMD runs across the batch instead of inside one
+// tiny matrix, with no per-matrix allocation or loop overhead.
+//
+// N is a template parameter, so every loop bound is a compile-time constant
+// and the compiler unrolls the k loop and keeps a row tile of C in
+// registers. The group kernel is compiled once per SIMD level (scalar, AVX2,
+// AVX-512) and picked at runtime like the kernels in SimdKernels.h.
+// Results accumulate over k in order, as in the Matrix<T> multiply; double
+// results can differ in the last bits from it where FMA is used.
+
+#ifndef BATCHED_GEMM_H
+#define BATCHED_GEMM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+
+#include "Matrix.h"
+#include "MatrixStorage.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+
+// Multiply-adds per task when a batched multiply runs on the thread pool
+const long BATCH_PARALLEL_WORK = 1L << 20;
+
+// Matrices per interleaved group: one cache line of lanes
+template <typename T>
+struct BatchLanes {
+    static const int value = static_cast<int>(MATRIX_CACHE_LINE / sizeof(T));
+};
+
+template <typename T, int N>
+class SmallMatrixBatch {
+    static_assert(N >= 1 && N <= 64, "SmallMatrixBatch is meant for small matrices");
+
+public:
+    static const int LANES = BatchLanes<T>::value;
+    static const int GROUP_ELEMENTS = N * N * LANES;  // elements per interleaved group
+
+private:
+    AlignedBuffer<T> buffer;
+    std::size_t count;
+
+    std::size_t offset(std::size_t b, int i, int j) const {
+        return (b / LANES) * GROUP_ELEMENTS + (static_cast<std::size_t>(i) * N + j) * LANES + b % LANES;
+    }
+
+public:
+    // Batch of n zero matrices
+    explicit SmallMatrixBatch(std::size_t n = 0)
+        : buffer((n + LANES - 1) / LANES * GROUP_ELEMENTS), count(n) {}
+
+    std::size_t size() const {
+        return count;
+    }
+
+    std::size_t groups() const {
+        return (count + LANES - 1) / LANES;
+    }
+
+    // Element (i, j) of matrix b
+    T& operator()(std::size_t b, int i, int j) {
+        return buffer.data()[offset(b, i, j)];
+    }
+
+    const T& operator()(std::size_t b, int i, int j) const {
+        return buffer.data()[offset(b, i, j)];
+    }
+
+    // Start of an interleaved group
+    const T* group(std::size_t g) const {
+        return buffer.data() + g * GROUP_ELEMENTS;
+    }
+
+    T* group(std::size_t g) {
+        return buffer.data() + g * GROUP_ELEMENTS;
+    }
+
+    // Copy an N x N matrix in as matrix b
+    void set(std::size_t b, const Matrix<T>& matrix) {
+        if (matrix.getRows() != N || matrix.getCols() != N) {
+            throw std::invalid_argument("Matrix dimensions do not match the batch");
+        }
+        for (int i = 0; i < N; i++) {
+            const T* row = matrix.rowPtr(i);
+            for (int j = 0; j < N; j++) {
+                (*this)(b, i, j) = row[j];
+            }
+        }
+    }
+
+    // Copy matrix b out
+    Matrix<T> get(std::size_t b) const {
+        Matrix<T> matrix(N);
+        for (int i = 0; i < N; i++) {
+            T* row = matrix.rowPtr(i);
+            for (int j = 0; j < N; j++) {
+                row[j] = (*this)(b, i, j);
+            }
+        }
+        return matrix;
+    }
+};
+
+#if defined(__GNUC__)
+#define BATCH_ALWAYS_INLINE __attribute__((always_inline)) inline
+#else
+#define BATCH_ALWAYS_INLINE inline
+#endif
+
+// C = A * B for one interleaved group. Each row of C is built JB columns at
+// a time, with JB lane vectors of accumulators held across the k loop.
+template <typename T, int N>
+BATCH_ALWAYS_INLINE void batchGemmGroup(const T* a, const T* b, T* c) {
+    const int G = BatchLanes<T>::value;
+    const int JB = N % 4 == 0 ? 4 : N % 2 == 0 ? 2 : 1;
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j += JB) {
+            T acc[JB][G];
+            for (int jj = 0; jj < JB; jj++) {
+                for (int l = 0; l < G; l++) {
+                    acc[jj][l] = T();
+                }
+            }
+            for (int k = 0; k < N; k++) {
+                const T* aik = a + (i * N + k) * G;
+                const T* bkj = b + (k * N + j) * G;
+                for (int jj = 0; jj < JB; jj++) {
+                    for (int l = 0; l < G; l++) {
+                        acc[jj][l] += aik[l] * bkj[jj * G + l];
+                    }
+                }
+            }
+            for (int jj = 0; jj < JB; jj++) {
+                T* cij = c + (i * N + j + jj) * G;
+                for (int l = 0; l < G; l++) {
+                    cij[l] = acc[jj][l];
+                }
+            }
+        }
+    }
+}
+
+// Groups [begin, end), one build per SIMD level
+template <typename T, int N>
+void batchGemmScalar(const T* a, const T* b, T* c, std::size_t begin, std::size_t end) {
+    const std::size_t step = static_cast<std::size_t>(N) * N * BatchLanes<T>::value;
+    for (std::size_t g = begin; g < end; g++) {
+        batchGemmGroup<T, N>(a + g * step, b + g * step, c + g * step);
+    }
+}
+
+#if MATRIX_SIMD_X86
+
+template <typename T, int N>
+MATRIX_TARGET("avx2,fma")
+void batchGemmAvx2(const T* a, const T* b, T* c, std::size_t begin, std::size_t end) {
+    const std::size_t step = static_cast<std::size_t>(N) * N * BatchLanes<T>::value;
+    for (std::size_t g = begin; g < end; g++) {
+        batchGemmGroup<T, N>(a + g * step, b + g * step, c + g * step);
+    }
+}
+
+template <typename T, int N>
+MATRIX_TARGET("avx512f")
+void batchGemmAvx512(const T* a, const T* b, T* c, std::size_t begin, std::size_t end) {
+    const std::size_t step = static_cast<std::size_t>(N) * N * BatchLanes<T>::value;
+    for (std::size_t g = begin; g < end; g++) {
+        batchGemmGroup<T, N>(a + g * step, b + g * step, c + g * step);
+    }
+}
+
+#endif // MATRIX_SIMD_X86
+
+// Group kernel for the active SIMD level
+template <typename T, int N>
+void (*batchGemmKernel())(const T*, const T*, T*, std::size_t, std::size_t) {
+#if MATRIX_SIMD_X86
+    SimdLevel level = activeSimdLevel();
+    if (level >= SIMD_AVX512) {
+        return batchGemmAvx512<T, N>;
+    }
+    if (level >= SIMD_AVX2) {
+        return batchGemmAvx2<T, N>;
+    }
+#endif
+    return batchGemmScalar<T, N>;
+}
+
+// c[b] = a[b] * b[b] for every matrix in the batch. c is resized to match.
+template <typename T, int N>
+void batchMultiply(const SmallMatrixBatch<T, N>& a, const SmallMatrixBatch<T, N>& b, SmallMatrixBatch<T, N>& c) {
+    if (a.size() != b.size()) {
+        throw std::invalid_argument("Batch sizes do not match for multiplication");
+    }
+    if (c.size() != a.size()) {
+        c = SmallMatrixBatch<T, N>(a.size());
+    }
+    static void (*const kernel)(const T*, const T*, T*, std::size_t, std::size_t) = batchGemmKernel<T, N>();
+
+    const std::size_t groups = a.groups();
+    if (groups == 0) {
+        return;
+    }
+    const T* pa = a.group(0);
+    const T* pb = b.group(0);
+    T* pc = c.group(0);
+    const long workPerGroup = static_cast<long>(N) * N * N * BatchLanes<T>::value;
+    const std::size_t groupsPerTask = static_cast<std::size_t>(std::max(1L, BATCH_PARALLEL_WORK / workPerGroup));
+    const int tasks = static_cast<int>((groups + groupsPerTask - 1) / groupsPerTask);
+    ThreadPool::instance().parallelFor(tasks, [&](int task) {
+        std::size_t begin = task * groupsPerTask;
+        kernel(pa, pb, pc, begin, std::min(groups, begin + groupsPerTask));
+    });
+}
+
+#endif // BATCHED_GEMM_H
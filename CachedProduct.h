@@ -0,0 +1,199 @@
+// Product kept current through changes to its operands
+// CachedProduct<T> owns A and B and keeps C = A * B. Edits go through it, so
+// C is corrected instead of multiplied again:
+//
+//     A(i, k) = v             row i of C += (v - A(i, k)) * row k of B     O(n)
+//     B(k, j) = v             column j of C += (v - B(k, j)) * column k of A
+//     swap rows of A          swap rows of C                               O(1)
+//     swap columns of B       swap columns of C                            O(n)
+//     swap columns k1, k2 of A, or rows k1, k2 of B: the two inner terms
+//     pair up differently, a rank-1 update
+//         C += (A(:, k1) - A(:, k2)) * (B(k2, :) - B(k1, :))               O(n^2)
+//
+// Corrections of double products round differently from a fresh multiply
+// and the difference can build up over many edits; refresh() recomputes C.
+// An infinity or NaN cannot be subtracted back out of C, so while A or B
+// holds one, edits recompute C instead (the count of them is kept in O(1)).
+
+#ifndef CACHED_PRODUCT_H
+#define CACHED_PRODUCT_H
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "Matrix.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+
+template <typename T>
+class CachedProduct {
+private:
+    Matrix<T> a;
+    Matrix<T> b;
+    Matrix<T> c;
+    long nonFinite;  // infinities and NaNs in A and B
+
+    // False for infinities and NaN (v - v is NaN for those)
+    static bool finite(T value) {
+        return value - value == T();
+    }
+
+    static long countNonFinite(const Matrix<T>& m) {
+        long count = 0;
+        for (int i = 0; i < m.getRows(); i++) {
+            const T* row = m.rowPtr(i);
+            for (int j = 0; j < m.getCols(); j++) {
+                count += !finite(row[j]);
+            }
+        }
+        return count;
+    }
+
+    // Rank-1 correction for exchanging inner indices k1 and k2, applied
+    // before A or B changes
+    void exchangeInner(int k1, int k2) {
+        const Matrix<T>& left = a;
+        const Matrix<T>& right = b;
+        const int n = c.getCols();
+        std::vector<T> rowDelta(n);
+        const T* b1 = right.rowPtr(k1);
+        const T* b2 = right.rowPtr(k2);
+        for (int j = 0; j < n; j++) {
+            rowDelta[j] = b2[j] - b1[j];
+        }
+        std::vector<T> columnDelta(c.getRows());
+        for (int i = 0; i < c.getRows(); i++) {
+            columnDelta[i] = left(i, k1) - left(i, k2);
+        }
+
+        MatrixBlock<T> out = c.block();
+        const int rowsPerTask = static_cast<int>(std::max(1L, MATRIX_PARALLEL_ELEMENTS / std::max(n, 1)));
+        const int tasks = (out.rows + rowsPerTask - 1) / rowsPerTask;
+        ThreadPool::instance().parallelFor(tasks, [&](int task) {
+            const int end = std::min(out.rows, (task + 1) * rowsPerTask);
+            for (int i = task * rowsPerTask; i < end; i++) {
+                if (columnDelta[i] != T()) {
+                    simdKernels<T>().axpy(out.rowPtr(i), columnDelta[i], rowDelta.data(), n);
+                }
+            }
+        });
+    }
+
+public:
+    // Take A and B and compute C = A * B
+    CachedProduct(Matrix<T> left, Matrix<T> right)
+        : a(std::move(left)), b(std::move(right)) {
+        if (a.getCols() != b.getRows()) {
+            throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+        }
+        nonFinite = countNonFinite(a) + countNonFinite(b);
+        c = Matrix<T>(a.getRows(), b.getCols());
+        refresh();
+    }
+
+    const Matrix<T>& left() const {
+        return a;
+    }
+
+    const Matrix<T>& right() const {
+        return b;
+    }
+
+    // C = A * B
+    const Matrix<T>& product() const {
+        return c;
+    }
+
+    // Recompute C from scratch
+    void refresh() {
+        multiplyInto(c, a, b);
+    }
+
+    // A(row, col) = value
+    bool updateLeft(int row, int col, T value) {
+        if (row < 0 || row >= a.getRows() || col < 0 || col >= a.getCols()) {
+            return false;
+        }
+        const Matrix<T>& left = a;
+        const Matrix<T>& right = b;
+        const T old = left(row, col);
+        a.updateElement(row, col, value);
+        const bool exact = nonFinite == 0;
+        nonFinite += !finite(value) - !finite(old);
+        if (!exact || nonFinite != 0) {
+            refresh();
+        } else if (value != old) {
+            simdKernels<T>().axpy(c.rowPtr(row), value - old, right.rowPtr(col), c.getCols());
+        }
+        return true;
+    }
+
+    // B(row, col) = value
+    bool updateRight(int row, int col, T value) {
+        if (row < 0 || row >= b.getRows() || col < 0 || col >= b.getCols()) {
+            return false;
+        }
+        const Matrix<T>& left = a;
+        const Matrix<T>& right = b;
+        const T old = right(row, col);
+        b.updateElement(row, col, value);
+        const bool exact = nonFinite == 0;
+        nonFinite += !finite(value) - !finite(old);
+        if (!exact || nonFinite != 0) {
+            refresh();
+        } else if (value != old) {
+            const T delta = value - old;
+            MatrixBlock<T> out = c.block();
+            for (int i = 0; i < out.rows; i++) {
+                out.rowPtr(i)[col] += delta * left(i, row);
+            }
+        }
+        return true;
+    }
+
+    bool swapLeftRows(int row1, int row2) {
+        return a.swapRows(row1, row2) && c.swapRows(row1, row2);
+    }
+
+    bool swapRightColumns(int col1, int col2) {
+        return b.swapColumns(col1, col2) && c.swapColumns(col1, col2);
+    }
+
+    bool swapLeftColumns(int col1, int col2) {
+        if (col1 < 0 || col1 >= a.getCols() || col2 < 0 || col2 >= a.getCols()) {
+            return false;
+        }
+        if (col1 != col2) {
+            const bool exact = nonFinite == 0;
+            if (exact) {
+                exchangeInner(col1, col2);
+            }
+            a.swapColumns(col1, col2);
+            if (!exact) {
+                refresh();
+            }
+        }
+        return true;
+    }
+
+    bool swapRightRows(int row1, int row2) {
+        if (row1 < 0 || row1 >= b.getRows() || row2 < 0 || row2 >= b.getRows()) {
+            return false;
+        }
+        if (row1 != row2) {
+            const bool exact = nonFinite == 0;
+            if (exact) {
+                exchangeInner(row1, row2);
+            }
+            b.swapRows(row1, row2);
+            if (!exact) {
+                refresh();
+            }
+        }
+        return true;
+    }
+};
+
+#endif // CACHED_PRODUCT_H
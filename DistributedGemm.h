@@ -0,0 +1,674 @@
+// Distributed multiply across worker processes (SUMMA)
+// Workers run `matrix_operations --worker ADDRESS` (runMatrixWorker) on any
+// machines reachable over TCP, or on one machine over Unix-domain sockets
+// (MatrixCluster::spawnLocal starts them). A MatrixCluster coordinator holds
+// A and B, as read from the usual input format, and forms C = A * B on the
+// workers:
+//
+// - The P workers form a gridRows x gridCols grid (as square as P allows)
+//   and worker (i, j) owns block (i, j) of A, B and C: rows of A and C and
+//   columns of B and C split by grid rows and columns, the inner dimension
+//   split by grid columns for A and by grid rows for B. Each worker holds
+//   about 1/P of each matrix.
+// - SUMMA: the inner dimension is walked in panels. For each panel the
+//   worker of grid row i that owns those columns of A sends them to the
+//   rest of row i, the worker of grid column j that owns those rows of B
+//   sends them down column j, and every worker adds its panel product into
+//   its block of C with the blocked engine. The next panel is exchanged
+//   while the current one is multiplied.
+// - The coordinator gathers the blocks of C.
+//
+// Workers talk to each other directly: a worker connects to the higher
+// ranked workers of its grid row and column, so every worker must be able to
+// reach the others at the addresses the coordinator was given. Workers serve
+// one product after another until told to shut down. Operands travel in
+// native byte order; all machines must share it.
+
+#ifndef DISTRIBUTED_GEMM_H
+#define DISTRIBUTED_GEMM_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Gemm.h"
+#include "Matrix.h"
+#include "MatrixBinary.h"
+#include "MatrixSocket.h"
+#include "MatrixTypes.h"
+
+const std::uint32_t CLUSTER_MAGIC = 0x4c43584d;  // "MXCL"
+
+// Widest panel of the inner dimension exchanged in one SUMMA step
+const int SUMMA_PANEL = 256;
+
+// Milliseconds to keep retrying a connection to a worker that is starting up
+const int CLUSTER_CONNECT_TIMEOUT_MS = 10000;
+
+enum ClusterHelloKind {
+    CLUSTER_JOB = 1,       // a coordinator with a product to compute
+    CLUSTER_PEER = 2,      // another worker of the same product
+    CLUSTER_SHUTDOWN = 3   // stop serving
+};
+
+// First message on every connection to a worker
+struct ClusterHello {
+    std::uint32_t magic;
+    std::uint32_t endianTag;
+    std::uint32_t kind;
+    std::uint32_t rank;  // sender's rank, for CLUSTER_PEER
+    std::uint64_t job;
+
+    static ClusterHello make(ClusterHelloKind kind, std::uint64_t job, int rank) {
+        ClusterHello hello;
+        hello.magic = CLUSTER_MAGIC;
+        hello.endianTag = MATRIX_BINARY_ENDIAN_TAG;
+        hello.kind = kind;
+        hello.rank = static_cast<std::uint32_t>(rank);
+        hello.job = job;
+        return hello;
+    }
+};
+
+// What a worker is asked to compute; followed by the worker addresses and
+// the worker's blocks of A and B
+struct SummaJobHeader {
+    std::uint32_t gridRows;
+    std::uint32_t gridCols;
+    std::uint32_t rank;
+    std::uint32_t dtype;  // MatrixTypeCode of A and B
+    std::uint32_t wide;   // C in MatrixAccumulator of the dtype instead of the dtype
+    std::uint32_t panel;  // widest SUMMA panel
+    std::uint64_t m;
+    std::uint64_t k;
+    std::uint64_t n;
+};
+
+// Start of part p when n is split into parts near-equal parts
+inline int summaSplit(int n, int parts, int p) {
+    return static_cast<int>(static_cast<long long>(n) * p / parts);
+}
+
+// Grid of workers for a product of an m x n result
+struct SummaGrid {
+    int rows;
+    int cols;
+
+    // As square as count allows, shrunk so that no block of C is empty
+    static SummaGrid choose(int count, int m, int n) {
+        SummaGrid grid;
+        grid.rows = 1;
+        for (int r = 1; r * r <= count; r++) {
+            if (count % r == 0) {
+                grid.rows = r;
+            }
+        }
+        grid.cols = count / grid.rows;
+        if (m < n) {
+            std::swap(grid.rows, grid.cols);
+        }
+        grid.rows = std::max(1, std::min(grid.rows, m));
+        grid.cols = std::max(1, std::min(grid.cols, n));
+        return grid;
+    }
+
+    int size() const {
+        return rows * cols;
+    }
+};
+
+// One SUMMA step: inner indices [k0, k1), whose columns of A live in grid
+// column ownerCol and whose rows of B live in grid row ownerRow
+struct SummaPanel {
+    int k0;
+    int k1;
+    int ownerCol;
+    int ownerRow;
+};
+
+inline std::vector<SummaPanel> summaPanels(int k, const SummaGrid& grid, int maxWidth) {
+    std::vector<int> cuts;
+    for (int p = 0; p <= grid.cols; p++) {
+        cuts.push_back(summaSplit(k, grid.cols, p));
+    }
+    for (int p = 0; p <= grid.rows; p++) {
+        cuts.push_back(summaSplit(k, grid.rows, p));
+    }
+    std::sort(cuts.begin(), cuts.end());
+    cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+    std::vector<SummaPanel> panels;
+    int ownerCol = 0;
+    int ownerRow = 0;
+    for (std::size_t c = 0; c + 1 < cuts.size(); c++) {
+        while (summaSplit(k, grid.cols, ownerCol + 1) <= cuts[c]) {
+            ownerCol++;
+        }
+        while (summaSplit(k, grid.rows, ownerRow + 1) <= cuts[c]) {
+            ownerRow++;
+        }
+        for (int k0 = cuts[c]; k0 < cuts[c + 1]; k0 += maxWidth) {
+            SummaPanel panel = {k0, std::min(cuts[c + 1], k0 + maxWidth), ownerCol, ownerRow};
+            panels.push_back(panel);
+        }
+    }
+    return panels;
+}
+
+// A worker's part of one product
+template <typename T, typename R>
+class SummaWorkerJob {
+private:
+    const SummaJobHeader& job;
+    const SummaGrid grid;
+    const int row;  // grid position
+    const int col;
+    const int m, k, n;
+    std::vector<MatrixSocket>& rowLinks;  // by grid column; rowLinks[col] unused
+    std::vector<MatrixSocket>& colLinks;  // by grid row
+    AlignedBuffer<T> aBuffers[2];         // panels received, alternating between steps
+    AlignedBuffer<T> bBuffers[2];
+
+    struct PanelViews {
+        MatrixBlock<const T> a;
+        MatrixBlock<const T> b;
+    };
+
+    // Unblock every link, so that a failed step does not leave its sender waiting
+    void interruptLinks() {
+        for (std::size_t p = 0; p < rowLinks.size(); p++) {
+            rowLinks[p].interrupt();
+        }
+        for (std::size_t p = 0; p < colLinks.size(); p++) {
+            colLinks[p].interrupt();
+        }
+    }
+
+public:
+    const int rows;   // of this worker's block of C
+    const int cols;
+    const int aDepth;  // columns of A held here, from aStart
+    const int aStart;
+    const int bDepth;  // rows of B held here, from bStart
+    const int bStart;
+    AlignedBuffer<T> a;
+    AlignedBuffer<T> b;
+
+    SummaWorkerJob(const SummaJobHeader& header, std::vector<MatrixSocket>& rowPeers,
+                   std::vector<MatrixSocket>& colPeers)
+        : job(header), grid(SummaGrid{static_cast<int>(header.gridRows), static_cast<int>(header.gridCols)}),
+          row(static_cast<int>(header.rank) / grid.cols), col(static_cast<int>(header.rank) % grid.cols),
+          m(static_cast<int>(header.m)), k(static_cast<int>(header.k)), n(static_cast<int>(header.n)),
+          rowLinks(rowPeers), colLinks(colPeers),
+          rows(summaSplit(m, grid.rows, row + 1) - summaSplit(m, grid.rows, row)),
+          cols(summaSplit(n, grid.cols, col + 1) - summaSplit(n, grid.cols, col)),
+          aDepth(summaSplit(k, grid.cols, col + 1) - summaSplit(k, grid.cols, col)),
+          aStart(summaSplit(k, grid.cols, col)),
+          bDepth(summaSplit(k, grid.rows, row + 1) - summaSplit(k, grid.rows, row)),
+          bStart(summaSplit(k, grid.rows, row)),
+          a(static_cast<std::size_t>(rows) * aDepth), b(static_cast<std::size_t>(bDepth) * cols) {
+        const int width = static_cast<int>(std::min<std::uint64_t>(header.panel, header.k));
+        for (int slot = 0; slot < 2; slot++) {
+            aBuffers[slot] = AlignedBuffer<T>(static_cast<std::size_t>(rows) * width);
+            bBuffers[slot] = AlignedBuffer<T>(static_cast<std::size_t>(width) * cols);
+        }
+    }
+
+    MatrixBlock<T> aBlock() {
+        return MatrixBlock<T>(a.data(), nullptr, aDepth, rows, aDepth);
+    }
+
+    MatrixBlock<T> bBlock() {
+        return MatrixBlock<T>(b.data(), nullptr, cols, bDepth, cols);
+    }
+
+    // Send the parts of a panel owned here to the rest of the grid row and
+    // column and receive the others into buffer slot
+    PanelViews exchange(const SummaPanel& panel, int slot) {
+        const int width = panel.k1 - panel.k0;
+        const bool ownsA = col == panel.ownerCol;
+        const bool ownsB = row == panel.ownerRow;
+        MatrixBlock<T> aPanel = ownsA ? aBlock().sub(0, panel.k0 - aStart, rows, width)
+                                      : MatrixBlock<T>(aBuffers[slot].data(), nullptr, width, rows, width);
+        MatrixBlock<T> bPanel = ownsB ? bBlock().sub(panel.k0 - bStart, 0, width, cols)
+                                      : MatrixBlock<T>(bBuffers[slot].data(), nullptr, cols, width, cols);
+
+        std::exception_ptr sendError;
+        std::thread sender([&]() {
+            try {
+                for (int p = 0; ownsA && p < grid.cols; p++) {
+                    if (p != col) {
+                        rowLinks[p].sendBlock(MatrixBlock<const T>(aPanel));
+                    }
+                }
+                for (int p = 0; ownsB && p < grid.rows; p++) {
+                    if (p != row) {
+                        colLinks[p].sendBlock(MatrixBlock<const T>(bPanel));
+                    }
+                }
+            } catch (...) {
+                sendError = std::current_exception();
+            }
+        });
+        try {
+            if (!ownsA) {
+                rowLinks[panel.ownerCol].receiveBlock(aPanel);
+            }
+            if (!ownsB) {
+                colLinks[panel.ownerRow].receiveBlock(bPanel);
+            }
+        } catch (...) {
+            interruptLinks();
+            sender.join();
+            throw;
+        }
+        sender.join();
+        if (sendError) {
+            std::rethrow_exception(sendError);
+        }
+        PanelViews views = {aPanel, bPanel};
+        return views;
+    }
+
+    // C = sum over panels of A(:, panel) * B(panel, :), exchanging the next
+    // panel while multiplying the current one
+    AlignedBuffer<R> multiply() {
+        AlignedBuffer<R> c(static_cast<std::size_t>(rows) * cols);
+        const MatrixBlock<R> out(c.data(), nullptr, cols, rows, cols);
+        const std::vector<SummaPanel> panels = summaPanels(k, grid, static_cast<int>(job.panel));
+        if (panels.empty()) {
+            return c;
+        }
+        std::future<PanelViews> next =
+            std::async(std::launch::async, &SummaWorkerJob::exchange, this, panels[0], 0);
+        for (std::size_t t = 0; t < panels.size(); t++) {
+            PanelViews views = next.get();
+            if (t + 1 < panels.size()) {
+                next = std::async(std::launch::async, &SummaWorkerJob::exchange, this, panels[t + 1],
+                                  static_cast<int>((t + 1) % 2));
+            }
+            gemmAccumulate(GemmOperand<T>(views.a), GemmOperand<T>(views.b), out, R(1));
+        }
+        return c;
+    }
+};
+
+// A worker process: accepts products from coordinators until shut down
+class MatrixWorker {
+private:
+    struct Connection {
+        ClusterHello hello;
+        MatrixSocket socket;
+    };
+
+    std::string address;
+    MatrixListener listener;
+    std::vector<Connection> waiting;  // accepted, not yet wanted
+
+    // Accept a connection and read its hello; connections that are not
+    // from this protocol are dropped
+    Connection acceptHello() {
+        for (;;) {
+            Connection connection;
+            connection.socket = listener.accept();
+            try {
+                if (!connection.socket.receiveAll(&connection.hello, sizeof(connection.hello))) {
+                    continue;
+                }
+            } catch (const MatrixSocketError&) {
+                continue;
+            }
+            if (connection.hello.magic != CLUSTER_MAGIC) {
+                continue;
+            }
+            if (connection.hello.endianTag != MATRIX_BINARY_ENDIAN_TAG) {
+                std::cerr << "Error: worker " << address << ": peer has a different byte order" << std::endl;
+                continue;
+            }
+            return connection;
+        }
+    }
+
+    // The next coordinator connection, or shutdown
+    Connection nextRequest() {
+        for (std::size_t w = 0; w < waiting.size(); w++) {
+            if (waiting[w].hello.kind != CLUSTER_PEER) {
+                Connection found = std::move(waiting[w]);
+                waiting.erase(waiting.begin() + w);
+                return found;
+            }
+        }
+        for (;;) {
+            Connection connection = acceptHello();
+            if (connection.hello.kind != CLUSTER_PEER) {
+                return connection;
+            }
+            waiting.push_back(std::move(connection));
+        }
+    }
+
+    // The connection from worker rank of job, waiting for it if needed
+    MatrixSocket peer(std::uint64_t job, int rank) {
+        for (std::size_t w = 0; w < waiting.size(); w++) {
+            if (waiting[w].hello.kind == CLUSTER_PEER && waiting[w].hello.job == job &&
+                static_cast<int>(waiting[w].hello.rank) == rank) {
+                MatrixSocket found = std::move(waiting[w].socket);
+                waiting.erase(waiting.begin() + w);
+                return found;
+            }
+        }
+        for (;;) {
+            Connection connection = acceptHello();
+            if (connection.hello.kind == CLUSTER_PEER && connection.hello.job == job &&
+                static_cast<int>(connection.hello.rank) == rank) {
+                return std::move(connection.socket);
+            }
+            waiting.push_back(std::move(connection));
+        }
+    }
+
+    // Drop peers left over from a job that is over
+    void forgetJob(std::uint64_t job) {
+        for (std::size_t w = waiting.size(); w-- > 0;) {
+            if (waiting[w].hello.kind == CLUSTER_PEER && waiting[w].hello.job == job) {
+                waiting.erase(waiting.begin() + w);
+            }
+        }
+    }
+
+    template <typename T, typename R>
+    void compute(MatrixSocket& coordinator, std::uint64_t jobId, const SummaJobHeader& header,
+                 const std::vector<std::string>& addresses) {
+        const int gridRows = static_cast<int>(header.gridRows);
+        const int gridCols = static_cast<int>(header.gridCols);
+        const int rank = static_cast<int>(header.rank);
+        std::vector<MatrixSocket> rowLinks(gridCols);
+        std::vector<MatrixSocket> colLinks(gridRows);
+        SummaWorkerJob<T, R> work(header, rowLinks, colLinks);
+        coordinator.receiveBlock(work.aBlock());
+        coordinator.receiveBlock(work.bBlock());
+
+        // Connect up the grid row and column: to higher ranks, then from lower ones
+        const int row = rank / gridCols;
+        const int col = rank % gridCols;
+        for (int pass = 0; pass < 2; pass++) {
+            for (int p = 0; p < gridCols + gridRows; p++) {
+                const bool inRow = p < gridCols;
+                const int other = inRow ? row * gridCols + p : (p - gridCols) * gridCols + col;
+                MatrixSocket& link = inRow ? rowLinks[p] : colLinks[p - gridCols];
+                if (other == rank || (pass == 0) != (other > rank)) {
+                    continue;
+                }
+                if (pass == 0) {
+                    link = MatrixSocket::connect(addresses[other], CLUSTER_CONNECT_TIMEOUT_MS);
+                    link.send(ClusterHello::make(CLUSTER_PEER, jobId, rank));
+                } else {
+                    link = peer(jobId, other);
+                }
+            }
+        }
+
+        AlignedBuffer<R> c = work.multiply();
+        coordinator.sendBlock(MatrixBlock<const R>(c.data(), nullptr, work.cols, work.rows, work.cols));
+    }
+
+    // Runs compute with the element type of a job
+    struct JobRunner {
+        MatrixWorker& worker;
+        MatrixSocket& coordinator;
+        std::uint64_t job;
+        const SummaJobHeader& header;
+        const std::vector<std::string>& addresses;
+
+        template <typename T>
+        void apply() {
+            if (header.wide) {
+                worker.compute<T, typename MatrixAccumulator<T>::type>(coordinator, job, header, addresses);
+            } else {
+                worker.compute<T, T>(coordinator, job, header, addresses);
+            }
+        }
+    };
+
+    void serve(Connection& request) {
+        const SummaJobHeader header = request.socket.receive<SummaJobHeader>();
+        std::vector<std::string> addresses(request.socket.receive<std::uint32_t>());
+        for (std::size_t w = 0; w < addresses.size(); w++) {
+            addresses[w] = request.socket.receiveString();
+        }
+        if (header.gridRows == 0 || header.gridCols == 0 || header.rank >= header.gridRows * header.gridCols ||
+            addresses.size() < header.gridRows * header.gridCols) {
+            throw std::runtime_error("malformed job");
+        }
+        JobRunner runner = {*this, request.socket, request.hello.job, header, addresses};
+        if (!visitMatrixType(static_cast<int>(header.dtype), runner)) {
+            throw std::runtime_error("unsupported element type");
+        }
+    }
+
+public:
+    explicit MatrixWorker(const std::string& listenAddress) : address(listenAddress), listener(listenAddress) {}
+
+    // Serve products until a shutdown request. A failed product is reported
+    // on stderr and closes its connections, which the coordinator sees.
+    void run() {
+        for (;;) {
+            Connection request = nextRequest();
+            if (request.hello.kind == CLUSTER_SHUTDOWN) {
+                return;
+            }
+            if (request.hello.kind != CLUSTER_JOB) {
+                continue;
+            }
+            try {
+                serve(request);
+            } catch (const std::exception& e) {
+                std::cerr << "Error: worker " << address << ": " << e.what() << std::endl;
+            }
+            forgetJob(request.hello.job);
+        }
+    }
+};
+
+// Run a worker on address until it is shut down; 1 if it cannot listen
+inline int runMatrixWorker(const std::string& address) {
+    try {
+        MatrixWorker worker(address);
+        worker.run();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: worker " << address << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Coordinator: multiplies on a set of workers
+class MatrixCluster {
+private:
+    std::vector<std::string> addresses;
+    std::vector<pid_t> children;  // workers started by spawnLocal
+    std::string socketDirectory;
+    std::uint64_t jobCount;
+
+    template <typename T, typename R>
+    void run(const Matrix<T>& a, const Matrix<T>& b, Matrix<R>& c, bool wide) {
+        if (a.getCols() != b.getRows()) {
+            throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+        }
+        const int m = a.getRows();
+        const int k = a.getCols();
+        const int n = b.getCols();
+        c = Matrix<R>(m, n);
+        const SummaGrid grid = SummaGrid::choose(static_cast<int>(addresses.size()), m, n);
+        const std::uint64_t job = (static_cast<std::uint64_t>(::getpid()) << 32) | ++jobCount;
+
+        std::vector<MatrixSocket> links(grid.size());
+        for (int rank = 0; rank < grid.size(); rank++) {
+            const int row = rank / grid.cols;
+            const int col = rank % grid.cols;
+            const int r0 = summaSplit(m, grid.rows, row);
+            const int c0 = summaSplit(n, grid.cols, col);
+            const int aStart = summaSplit(k, grid.cols, col);
+            const int bStart = summaSplit(k, grid.rows, row);
+            try {
+                links[rank] = MatrixSocket::connect(addresses[rank], CLUSTER_CONNECT_TIMEOUT_MS);
+                links[rank].send(ClusterHello::make(CLUSTER_JOB, job, 0));
+                SummaJobHeader header;
+                header.gridRows = static_cast<std::uint32_t>(grid.rows);
+                header.gridCols = static_cast<std::uint32_t>(grid.cols);
+                header.rank = static_cast<std::uint32_t>(rank);
+                header.dtype = MatrixDtype<T>::code;
+                header.wide = wide ? 1 : 0;
+                header.panel = SUMMA_PANEL;
+                header.m = static_cast<std::uint64_t>(m);
+                header.k = static_cast<std::uint64_t>(k);
+                header.n = static_cast<std::uint64_t>(n);
+                links[rank].send(header);
+                links[rank].send(static_cast<std::uint32_t>(grid.size()));
+                for (int w = 0; w < grid.size(); w++) {
+                    links[rank].sendString(addresses[w]);
+                }
+                links[rank].sendBlock(a.block().sub(r0, aStart, summaSplit(m, grid.rows, row + 1) - r0,
+                                                    summaSplit(k, grid.cols, col + 1) - aStart));
+                links[rank].sendBlock(b.block().sub(bStart, c0, summaSplit(k, grid.rows, row + 1) - bStart,
+                                                    summaSplit(n, grid.cols, col + 1) - c0));
+            } catch (const MatrixSocketError& e) {
+                throw std::runtime_error("worker " + addresses[rank] + ": " + e.what());
+            }
+        }
+        for (int rank = 0; rank < grid.size(); rank++) {
+            const int row = rank / grid.cols;
+            const int col = rank % grid.cols;
+            const int r0 = summaSplit(m, grid.rows, row);
+            const int c0 = summaSplit(n, grid.cols, col);
+            try {
+                links[rank].receiveBlock(c.block().sub(r0, c0, summaSplit(m, grid.rows, row + 1) - r0,
+                                                       summaSplit(n, grid.cols, col + 1) - c0));
+            } catch (const MatrixSocketError& e) {
+                throw std::runtime_error("worker " + addresses[rank] + " failed: " + e.what());
+            }
+        }
+    }
+
+    template <typename T>
+    Matrix<T> multiply(const Matrix<T>& a, const Matrix<T>& b, std::false_type) {
+        Matrix<T> c;
+        run(a, b, c, false);
+        return c;
+    }
+
+    // Types accumulated wider than they are stored: C is gathered wide and
+    // rounded once, as the local engine does
+    template <typename T>
+    Matrix<T> multiply(const Matrix<T>& a, const Matrix<T>& b, std::true_type) {
+        const Matrix<typename MatrixAccumulator<T>::type> wide = multiplyWide(a, b);
+        Matrix<T> c(wide.getRows(), wide.getCols());
+        for (int i = 0; i < c.getRows(); i++) {
+            std::copy(wide.rowPtr(i), wide.rowPtr(i) + c.getCols(), c.rowPtr(i));
+        }
+        return c;
+    }
+
+public:
+    // Use the workers listening at workerAddresses
+    explicit MatrixCluster(const std::vector<std::string>& workerAddresses)
+        : addresses(workerAddresses), jobCount(0) {
+        if (addresses.empty()) {
+            throw std::invalid_argument("A cluster needs at least one worker");
+        }
+    }
+
+    MatrixCluster(const MatrixCluster&) = delete;
+    MatrixCluster& operator=(const MatrixCluster&) = delete;
+
+    // Shut down the workers started by spawnLocal
+    ~MatrixCluster() {
+        for (std::size_t w = 0; w < children.size(); w++) {
+            try {
+                MatrixSocket link = MatrixSocket::connect(addresses[w], CLUSTER_CONNECT_TIMEOUT_MS);
+                link.send(ClusterHello::make(CLUSTER_SHUTDOWN, 0, 0));
+            } catch (const std::exception&) {
+                ::kill(children[w], SIGTERM);
+            }
+        }
+        for (std::size_t w = 0; w < children.size(); w++) {
+            int status;
+            ::waitpid(children[w], &status, 0);
+        }
+        if (!socketDirectory.empty()) {
+            ::rmdir(socketDirectory.c_str());
+        }
+    }
+
+    // Start count workers on this machine, listening on Unix-domain sockets
+    // in a private directory: each runs `program --worker unix:PATH
+    // --threads N`, with the hardware threads shared out between them. The
+    // workers exit with the process that started them.
+    static std::unique_ptr<MatrixCluster> spawnLocal(int count, const std::string& program = "/proc/self/exe") {
+        if (count < 1) {
+            throw std::invalid_argument("A cluster needs at least one worker");
+        }
+        char directory[] = "/tmp/matrix-cluster-XXXXXX";
+        if (!::mkdtemp(directory)) {
+            matrixSocketFail("Could not create a socket directory");
+        }
+        std::vector<std::string> workerAddresses;
+        for (int w = 0; w < count; w++) {
+            workerAddresses.push_back("unix:" + std::string(directory) + "/worker-" + std::to_string(w) + ".sock");
+        }
+        std::unique_ptr<MatrixCluster> cluster(new MatrixCluster(workerAddresses));
+        cluster->socketDirectory = directory;
+
+        const unsigned hardware = std::max(1u, std::thread::hardware_concurrency());
+        const std::string threads = std::to_string(std::max(1u, hardware / static_cast<unsigned>(count)));
+        for (int w = 0; w < count; w++) {
+            const std::string address = workerAddresses[w];
+            pid_t pid = ::fork();
+            if (pid < 0) {
+                matrixSocketFail("Could not start a worker");
+            }
+            if (pid == 0) {
+                ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+                ::execl(program.c_str(), program.c_str(), "--threads", threads.c_str(), "--worker",
+                        address.c_str(), static_cast<char*>(nullptr));
+                _exit(127);
+            }
+            cluster->children.push_back(pid);
+        }
+        return cluster;
+    }
+
+    int workerCount() const {
+        return static_cast<int>(addresses.size());
+    }
+
+    // a * b, computed on the workers
+    template <typename T>
+    Matrix<T> multiply(const Matrix<T>& a, const Matrix<T>& b) {
+        return multiply(a, b, GemmWidens<T>());
+    }
+
+    // a * b in the accumulator type of T (see multiplyWide in Matrix.h)
+    template <typename T>
+    Matrix<typename MatrixAccumulator<T>::type> multiplyWide(const Matrix<T>& a, const Matrix<T>& b) {
+        Matrix<typename MatrixAccumulator<T>::type> c;
+        run(a, b, c, true);
+        return c;
+    }
+};
+
+#endif // DISTRIBUTED_GEMM_H
@@ -0,0 +1,453 @@
+// Cache-blocked, register-tiled matrix multiply engine (C += alpha * A * B)
+// Operands are packed into contiguous panels sized for the L1/L2 caches and
+// the product is formed by a small MR x NR microkernel that keeps its tile of
+// C in registers. Either operand may be a transposed view of stored data
+// (GemmOperand); packing reads it in transposed order, so it is never copied
+// out first. Packing can also widen: operands of a narrow type S are
+// converted as they are packed, so C of a wider type T accumulates at the
+// speed of T's kernel (gemmAccumulate with GemmOperand<S> and MatrixBlock<T>).
+
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+#include "MatrixStorage.h"
+#include "MatrixTypes.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+
+// Blocking parameters for the multiply engine.
+// MR x NR is the register tile, KC the depth of a packed panel (A and B
+// micro-panels stay in L1), MC the rows of packed A kept in L2 and NC the
+// columns of packed B kept in L3. Products with fewer than NARROW columns
+// skip the engine and use dot products (see gemmNarrow).
+template <typename T>
+struct GemmTraits {
+    static const int MR = 4;
+    static const int NR = 4;
+    static const int KC = 256;
+    static const int MC = 64;
+    static const int NC = 1024;
+    static const int NARROW = 4;
+};
+
+template <>
+struct GemmTraits<double> {
+    static const int MR = 4;
+    static const int NR = 8;
+    static const int KC = 256;
+    static const int MC = 96;
+    static const int NC = 2048;
+    static const int NARROW = 8;
+};
+
+template <>
+struct GemmTraits<float> {
+    static const int MR = 4;
+    static const int NR = 16;
+    static const int KC = 256;
+    static const int MC = 96;
+    static const int NC = 2048;
+    static const int NARROW = 16;
+};
+
+template <>
+struct GemmTraits<int> {
+    static const int MR = 4;
+    static const int NR = 8;
+    static const int KC = 384;
+    static const int MC = 128;
+    static const int NC = 2048;
+    static const int NARROW = 32;  // the int microkernel is bound by 32-bit multiplies
+};
+
+// The SIMD microkernels in SimdKernels.h compute 4 x 8 tiles (4 x 16 for float)
+static_assert(GemmTraits<double>::MR == 4 && GemmTraits<double>::NR == 8,
+              "double tile must match the SIMD microkernels");
+static_assert(GemmTraits<float>::MR == 4 && GemmTraits<float>::NR == 16,
+              "float tile must match the SIMD microkernels");
+static_assert(GemmTraits<int>::MR == 4 && GemmTraits<int>::NR == 8,
+              "int tile must match the SIMD microkernels");
+
+// Operand of a product: a stored block, used as it is or transposed.
+// rows() and cols() are the dimensions as the product sees them.
+template <typename T>
+struct GemmOperand {
+    MatrixBlock<const T> block;
+    bool transposed;
+
+    GemmOperand(const MatrixBlock<const T>& stored, bool isTransposed = false)
+        : block(stored), transposed(isTransposed) {}
+
+    int rows() const { return transposed ? block.cols : block.rows; }
+    int cols() const { return transposed ? block.rows : block.cols; }
+
+    // Sub-operand starting at (r0, c0), in product coordinates
+    GemmOperand sub(int r0, int c0, int nRows, int nCols) const {
+        if (transposed) {
+            return GemmOperand(block.sub(c0, r0, nCols, nRows), true);
+        }
+        return GemmOperand(block.sub(r0, c0, nRows, nCols), false);
+    }
+
+    // Row i as a contiguous array: the stored row, or a copy of the stored
+    // column gathered into scratch (cols() elements)
+    const T* row(int i, T* scratch) const {
+        if (!transposed) {
+            return block.rowPtr(i);
+        }
+        for (int p = 0; p < block.rows; p++) {
+            scratch[p] = block.rowPtr(p)[i];
+        }
+        return scratch;
+    }
+};
+
+// Below this many multiply-adds the packing overhead is not worth it
+const long GEMM_SMALL_WORK = 32L * 32L * 32L;
+
+// Products this shallow (k) do too little work per packed panel to repay
+// packing, so they run as row updates instead
+const int GEMM_SHALLOW_DEPTH = 16;
+
+// Below this many multiply-adds the product runs on the calling thread only
+const long GEMM_PARALLEL_WORK = 128L * 128L * 128L;
+
+// Pack an mc x kc block of alpha * A into MR-row micro-panels,
+// column-interleaved: panel[p * MR + i] = alpha * A(i, p), converted from S
+// to T. Rows past mc are zero-filled.
+template <typename T, int MR, typename S>
+void gemmPackA(const GemmOperand<S>& a, T alpha, T* packed) {
+    const int mc = a.rows();
+    const int kc = a.cols();
+    for (int ir = 0; ir < mc; ir += MR) {
+        int mr = std::min(MR, mc - ir);
+        T* panel = packed + static_cast<std::size_t>(ir) * kc;
+        if (a.transposed) {
+            for (int p = 0; p < kc; p++) {
+                const S* column = a.block.rowPtr(p) + ir;
+                for (int i = 0; i < mr; i++) {
+                    panel[p * MR + i] = alpha * static_cast<T>(column[i]);
+                }
+            }
+        } else {
+            for (int i = 0; i < mr; i++) {
+                const S* row = a.block.rowPtr(ir + i);
+                for (int p = 0; p < kc; p++) {
+                    panel[p * MR + i] = alpha * static_cast<T>(row[p]);
+                }
+            }
+        }
+        for (int i = mr; i < MR; i++) {
+            for (int p = 0; p < kc; p++) {
+                panel[p * MR + i] = T();
+            }
+        }
+    }
+}
+
+// Pack a kc x nc block of B into NR-column micro-panels, row-interleaved:
+// panel[p * NR + j] = B(p, j), converted from S to T. Columns past nc are
+// zero-filled.
+template <typename T, int NR, typename S>
+void gemmPackB(const GemmOperand<S>& b, T* packed) {
+    const int kc = b.rows();
+    const int nc = b.cols();
+    for (int jr = 0; jr < nc; jr += NR) {
+        int nr = std::min(NR, nc - jr);
+        T* panel = packed + static_cast<std::size_t>(jr) * kc;
+        if (b.transposed) {
+            for (int j = 0; j < nr; j++) {
+                const S* column = b.block.rowPtr(jr + j);
+                for (int p = 0; p < kc; p++) {
+                    panel[p * NR + j] = static_cast<T>(column[p]);
+                }
+            }
+        } else {
+            for (int p = 0; p < kc; p++) {
+                const S* row = b.block.rowPtr(p) + jr;
+                T* dst = panel + p * NR;
+                for (int j = 0; j < nr; j++) {
+                    dst[j] = static_cast<T>(row[j]);
+                }
+            }
+        }
+        for (int p = 0; p < kc; p++) {
+            for (int j = nr; j < NR; j++) {
+                panel[p * NR + j] = T();
+            }
+        }
+    }
+}
+
+// Register-tiled microkernel: acc = sum over p of a(:, p) * b(p, :)
+template <typename T, int MR, int NR>
+inline void gemmMicroKernel(int kc, const T* a, const T* b, T* acc) {
+    T c[MR][NR];
+    for (int i = 0; i < MR; i++) {
+        for (int j = 0; j < NR; j++) {
+            c[i][j] = T();
+        }
+    }
+    for (int p = 0; p < kc; p++) {
+        T bp[NR];
+        for (int j = 0; j < NR; j++) {
+            bp[j] = b[j];
+        }
+        for (int i = 0; i < MR; i++) {
+            T ai = a[i];
+            for (int j = 0; j < NR; j++) {
+                c[i][j] += ai * bp[j];
+            }
+        }
+        a += MR;
+        b += NR;
+    }
+    for (int i = 0; i < MR; i++) {
+        for (int j = 0; j < NR; j++) {
+            acc[i * NR + j] = c[i][j];
+        }
+    }
+}
+
+// Multiply packed A (mc x kc) by packed B (kc x nc) into C (mc x nc)
+template <typename T>
+void gemmMacroKernel(int mc, int nc, int kc, const T* packedA, const T* packedB,
+                     const MatrixBlock<T>& c) {
+    const int MR = GemmTraits<T>::MR;
+    const int NR = GemmTraits<T>::NR;
+    T acc[MR * NR];
+    void (*microKernel)(int, const T*, const T*, T*) = simdKernels<T>().microKernel;
+    if (!microKernel) {
+        microKernel = gemmMicroKernel<T, MR, NR>;
+    }
+
+    for (int jr = 0; jr < nc; jr += NR) {
+        int nr = std::min(NR, nc - jr);
+        const T* bPanel = packedB + static_cast<std::size_t>(jr) * kc;
+        for (int ir = 0; ir < mc; ir += MR) {
+            int mr = std::min(MR, mc - ir);
+            microKernel(kc, packedA + static_cast<std::size_t>(ir) * kc, bPanel, acc);
+            for (int i = 0; i < mr; i++) {
+                T* cRow = c.rowPtr(ir + i) + jr;
+                for (int j = 0; j < nr; j++) {
+                    cRow[j] += acc[i * NR + j];
+                }
+            }
+        }
+    }
+}
+
+// Straightforward i-k-j loop for products too small to amortize packing.
+// B must not be transposed (gemmNarrow handles that case).
+template <typename T>
+void gemmSmall(const GemmOperand<T>& a, const GemmOperand<T>& b, const MatrixBlock<T>& c, T alpha) {
+    void (*axpy)(T*, T, const T*, std::size_t) = simdKernels<T>().axpy;
+    const int k = a.cols();
+    for (int i = 0; i < c.rows; i++) {
+        T* cRow = c.rowPtr(i);
+        for (int p = 0; p < k; p++) {
+            const T aip = a.transposed ? a.block.rowPtr(p)[i] : a.block.rowPtr(i)[p];
+            axpy(cRow, alpha * aip, b.block.rowPtr(p), b.cols());
+        }
+    }
+}
+
+// C += alpha * A * B as one contiguous dot product per element of C, for
+// narrow B (matrix-vector and tall-skinny products) and transposed B. The
+// columns of B are its stored rows when B is transposed; otherwise B is
+// transposed once up front.
+template <typename T>
+void gemmNarrow(const GemmOperand<T>& a, const GemmOperand<T>& b, const MatrixBlock<T>& c, T alpha) {
+    const int k = a.cols();
+    const int n = b.cols();
+    AlignedBuffer<T> columns(b.transposed ? 0 : static_cast<std::size_t>(n) * k);
+    if (!b.transposed) {
+        for (int p = 0; p < k; p++) {
+            const T* bRow = b.block.rowPtr(p);
+            for (int j = 0; j < n; j++) {
+                columns.data()[static_cast<std::size_t>(j) * k + p] = bRow[j];
+            }
+        }
+    }
+    AlignedBuffer<T> scratch(a.transposed ? k : 0);
+
+    T (*dot)(const T*, const T*, std::size_t) = simdKernels<T>().dot;
+    for (int i = 0; i < c.rows; i++) {
+        const T* aRow = a.row(i, scratch.data());
+        T* cRow = c.rowPtr(i);
+        for (int j = 0; j < n; j++) {
+            const T* column = b.transposed ? b.block.rowPtr(j) : columns.data() + static_cast<std::size_t>(j) * k;
+            cRow[j] += alpha * dot(aRow, column, k);
+        }
+    }
+}
+
+// Blocked C += alpha * A * B on the calling thread, with A and B converted
+// from S as they are packed. The k loop runs in the same order for every
+// element of C however C is tiled, which keeps tiled and untiled results
+// bit-identical.
+template <typename T, typename S = T>
+void gemmBlocked(const GemmOperand<S>& a, const GemmOperand<S>& b, const MatrixBlock<T>& c, T alpha) {
+    const int MR = GemmTraits<T>::MR;
+    const int NR = GemmTraits<T>::NR;
+    const int KC = GemmTraits<T>::KC;
+    const int MC = GemmTraits<T>::MC;
+    const int NC = GemmTraits<T>::NC;
+
+    const int m = c.rows;
+    const int n = c.cols;
+    const int k = a.cols();
+    const int kcMax = std::min(KC, k);
+    const int mcMax = (std::min(MC, m) + MR - 1) / MR * MR;
+    const int ncMax = (std::min(NC, n) + NR - 1) / NR * NR;
+    AlignedBuffer<T> packedA(static_cast<std::size_t>(mcMax) * kcMax);
+    AlignedBuffer<T> packedB(static_cast<std::size_t>(ncMax) * kcMax);
+
+    for (int jc = 0; jc < n; jc += NC) {
+        int nc = std::min(NC, n - jc);
+        for (int pc = 0; pc < k; pc += KC) {
+            int kc = std::min(KC, k - pc);
+            gemmPackB<T, NR>(b.sub(pc, jc, kc, nc), packedB.data());
+            for (int ic = 0; ic < m; ic += MC) {
+                int mc = std::min(MC, m - ic);
+                gemmPackA<T, MR>(a.sub(ic, pc, mc, kc), alpha, packedA.data());
+                gemmMacroKernel(mc, nc, kc, packedA.data(), packedB.data(),
+                                c.sub(ic, jc, mc, nc));
+            }
+        }
+    }
+}
+
+// Run kernel over C (m x n, with k the inner dimension); large products are
+// split into tiles of C that run on the thread pool
+template <typename T, typename S>
+void gemmTiled(void (*kernel)(const GemmOperand<S>&, const GemmOperand<S>&, const MatrixBlock<T>&, T),
+               const GemmOperand<S>& a, const GemmOperand<S>& b, const MatrixBlock<T>& c, T alpha) {
+    const int m = c.rows;
+    const int n = c.cols;
+    const int k = a.cols();
+    const int MR = GemmTraits<T>::MR;
+    const int NR = GemmTraits<T>::NR;
+    const long work = static_cast<long>(m) * n * k;
+    ThreadPool& pool = ThreadPool::instance();
+    if (work < GEMM_PARALLEL_WORK || pool.threadCount() == 1) {
+        kernel(a, b, c, alpha);
+        return;
+    }
+
+    // Aim for a few tiles per thread; split rows first (each row tile
+    // reuses its packed A), then columns if there are too few row tiles.
+    const int MC = GemmTraits<T>::MC;
+    const int targetTiles = pool.threadCount() * 4;
+    int tileRows = (m + targetTiles - 1) / targetTiles;
+    tileRows = std::min(MC, std::max(MR, (tileRows + MR - 1) / MR * MR));
+    const int rowTiles = (m + tileRows - 1) / tileRows;
+    const int colSplit = std::max(1, targetTiles / rowTiles);
+    int tileCols = (n + colSplit - 1) / colSplit;
+    tileCols = std::max(NR, (tileCols + NR - 1) / NR * NR);
+    const int colTiles = (n + tileCols - 1) / tileCols;
+
+    pool.parallelFor(rowTiles * colTiles, [&](int tile) {
+        int i0 = (tile / colTiles) * tileRows;
+        int j0 = (tile % colTiles) * tileCols;
+        int rows = std::min(tileRows, m - i0);
+        int cols = std::min(tileCols, n - j0);
+        kernel(a.sub(i0, 0, rows, k), b.sub(0, j0, k, cols), c.sub(i0, j0, rows, cols), alpha);
+    });
+}
+
+// Element types whose products are accumulated in MatrixAccumulator<T> and
+// rounded once (bfloat16). Integer types wrap the same way whatever they
+// accumulate in, so their products stay in T; multiplyWide (Matrix.h) gives
+// the wide result.
+template <typename T>
+struct GemmWidens
+    : std::integral_constant<bool, !std::is_integral<T>::value &&
+                                       !std::is_same<typename MatrixAccumulator<T>::type, T>::value> {};
+
+// C += alpha * A * B, where A is m x k, B is k x n and C is m x n.
+// The kernel is chosen from the shape alone: narrow products and those
+// with a transposed B too small for the blocked engine use dot products,
+// shallow ones and those with fewer rows than the register tile use row
+// updates, and the rest the blocked engine. Large products are split into
+// tiles of C that run on the thread pool.
+template <typename T>
+void gemmAccumulate(const GemmOperand<T>& a, const GemmOperand<T>& b, const MatrixBlock<T>& c, T alpha) {
+    if (a.cols() != b.rows() || a.rows() != c.rows || b.cols() != c.cols) {
+        throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+    }
+    if (c.rows == 0 || c.cols == 0 || a.cols() == 0) {
+        return;
+    }
+    gemmAccumulate(a, b, c, alpha, GemmWidens<T>());
+}
+
+template <typename T>
+void gemmAccumulate(const GemmOperand<T>& a, const GemmOperand<T>& b, const MatrixBlock<T>& c, T alpha,
+                    std::false_type) {
+    const int m = c.rows;
+    const int n = c.cols;
+    const int k = a.cols();
+    const long work = static_cast<long>(m) * n * k;
+    if (work <= GEMM_SMALL_WORK) {
+        if (b.transposed) {
+            gemmNarrow(a, b, c, alpha);
+        } else {
+            gemmSmall(a, b, c, alpha);
+        }
+        return;
+    }
+
+    void (*kernel)(const GemmOperand<T>&, const GemmOperand<T>&, const MatrixBlock<T>&, T) = gemmBlocked<T>;
+    if (n < GemmTraits<T>::NARROW) {
+        kernel = gemmNarrow<T>;
+    } else if (k <= GEMM_SHALLOW_DEPTH || m < GemmTraits<T>::MR) {
+        kernel = b.transposed ? gemmNarrow<T> : gemmSmall<T>;
+    }
+    gemmTiled(kernel, a, b, c, alpha);
+}
+
+// Narrow floating-point T: accumulate into a wide scratch C, then round
+// each element into C once
+template <typename T>
+void gemmAccumulate(const GemmOperand<T>& a, const GemmOperand<T>& b, const MatrixBlock<T>& c, T alpha,
+                    std::true_type) {
+    typedef typename MatrixAccumulator<T>::type Wide;
+    AlignedBuffer<Wide> scratch(static_cast<std::size_t>(c.rows) * c.cols);
+    MatrixBlock<Wide> wide(scratch.data(), nullptr, c.cols, c.rows, c.cols);
+    gemmAccumulate(a, b, wide, static_cast<Wide>(alpha));
+    for (int i = 0; i < c.rows; i++) {
+        T* out = c.rowPtr(i);
+        const Wide* in = wide.rowPtr(i);
+        for (int j = 0; j < c.cols; j++) {
+            out[j] = static_cast<T>(static_cast<Wide>(out[j]) + in[j]);
+        }
+    }
+}
+
+// C += alpha * A * B with A and B of a narrower type S, widened to T as they
+// are packed (e.g. int8 operands into an int C, int into int64). Always the
+// blocked engine: it is the only kernel that converts while packing.
+template <typename T, typename S>
+void gemmAccumulate(const GemmOperand<S>& a, const GemmOperand<S>& b, const MatrixBlock<T>& c, T alpha) {
+    if (a.cols() != b.rows() || a.rows() != c.rows || b.cols() != c.cols) {
+        throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+    }
+    if (c.rows == 0 || c.cols == 0 || a.cols() == 0) {
+        return;
+    }
+    gemmTiled(gemmBlocked<T, S>, a, b, c, alpha);
+}
+
+// C += A * B on stored (untransposed) blocks
+template <typename T>
+void gemmAccumulate(const MatrixBlock<const T>& a, const MatrixBlock<const T>& b, const MatrixBlock<T>& c) {
+    gemmAccumulate(GemmOperand<T>(a), GemmOperand<T>(b), c, T(1));
+}
+
+#endif // GEMM_H
@@ -0,0 +1,150 @@
+// Benchmark for the multiply engine behind Matrix<T>::operator*
+// Compares GFLOP/s of the blocked engine against the original naive i-j-k loop
+// over nested vectors for N = 64 to 4096, and against Strassen-Winograd for
+// N at or above its threshold (GFLOP/s counted as 2 N^3 for both).
+//
+// Usage: gemm_bench [--min N] [--max N] [--naive-max N] [--type int|double|both] [--threads N]
+//                   [--strassen-threshold N]
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Matrix.h"
+
+// The original Matrix<T>::operator* loop, kept here as the baseline
+template <typename T>
+void naiveMultiply(const std::vector<std::vector<T>>& a, const std::vector<std::vector<T>>& b,
+                   std::vector<std::vector<T>>& c) {
+    int size = a.size();
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            c[i][j] = 0;
+            for (int k = 0; k < size; k++) {
+                c[i][j] += a[i][k] * b[k][j];
+            }
+        }
+    }
+}
+
+// Run fn repeatedly for at least minSeconds and return the best time per call
+template <typename Fn>
+double bestSeconds(Fn fn, double minSeconds) {
+    typedef std::chrono::steady_clock Clock;
+    double best = 1e30;
+    double total = 0.0;
+    int runs = 0;
+    while (total < minSeconds || runs < 2) {
+        Clock::time_point start = Clock::now();
+        fn();
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        best = std::min(best, elapsed);
+        total += elapsed;
+        runs++;
+    }
+    return best;
+}
+
+template <typename T>
+void benchType(const char* name, int minN, int maxN, int naiveMax) {
+    std::cout << "\n" << name << " multiply (GFLOP/s)" << std::endl;
+    std::cout << std::setw(6) << "N" << std::setw(12) << "naive" << std::setw(12) << "blocked"
+              << std::setw(10) << "speedup" << std::setw(12) << "strassen" << std::endl;
+
+    for (int n = minN; n <= maxN; n *= 2) {
+        Matrix<T> a(n), b(n);
+        for (int i = 0; i < n; i++) {
+            for (int j = 0; j < n; j++) {
+                a(i, j) = static_cast<T>((i * 7 + j * 3) % 11 - 5);
+                b(i, j) = static_cast<T>((i * 5 + j * 11) % 13 - 6);
+            }
+        }
+        double flops = 2.0 * n * n * n;
+        double minSeconds = 0.2;
+
+        volatile T sink = T();
+        setMultiplyAlgorithm(MULTIPLY_BLOCKED);
+        double blocked = bestSeconds([&]() {
+            Matrix<T> c = a * b;
+            sink = c(n - 1, n - 1);
+        }, minSeconds);
+
+        std::cout << std::setw(6) << n;
+        if (n <= naiveMax) {
+            std::vector<std::vector<T>> va = a.getData();
+            std::vector<std::vector<T>> vb = b.getData();
+            std::vector<std::vector<T>> vc(n, std::vector<T>(n));
+            double naive = bestSeconds([&]() {
+                naiveMultiply(va, vb, vc);
+                sink = vc[n - 1][n - 1];
+            }, minSeconds);
+            std::cout << std::fixed << std::setprecision(2)
+                      << std::setw(12) << flops / naive * 1e-9
+                      << std::setw(12) << flops / blocked * 1e-9
+                      << std::setw(9) << naive / blocked << "x";
+        } else {
+            std::cout << std::setw(12) << "-"
+                      << std::fixed << std::setprecision(2)
+                      << std::setw(12) << flops / blocked * 1e-9 << std::setw(10) << "-";
+        }
+        if (n >= strassenThreshold()) {
+            setMultiplyAlgorithm(MULTIPLY_STRASSEN);
+            double strassen = bestSeconds([&]() {
+                Matrix<T> c = a * b;
+                sink = c(n - 1, n - 1);
+            }, minSeconds);
+            setMultiplyAlgorithm(MULTIPLY_BLOCKED);
+            std::cout << std::setw(12) << flops / strassen * 1e-9;
+        } else {
+            std::cout << std::setw(12) << "-";
+        }
+        std::cout << std::endl;
+        (void)sink;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int minN = 64;
+    int maxN = 4096;
+    int naiveMax = 1024;  // the naive loop takes minutes beyond this
+    std::string type = "both";
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--min" && i + 1 < argc) {
+            minN = std::atoi(argv[++i]);
+        } else if (arg == "--max" && i + 1 < argc) {
+            maxN = std::atoi(argv[++i]);
+        } else if (arg == "--naive-max" && i + 1 < argc) {
+            naiveMax = std::atoi(argv[++i]);
+        } else if (arg == "--type" && i + 1 < argc) {
+            type = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            ThreadPool::setThreadCount(std::atoi(argv[++i]));
+        } else if (arg == "--strassen-threshold" && i + 1 < argc) {
+            setStrassenThreshold(std::atoi(argv[++i]));
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--min N] [--max N] [--naive-max N] [--type int|double|both] [--threads N]"
+                      << " [--strassen-threshold N]" << std::endl;
+            return 1;
+        }
+    }
+    if (minN < 1) {
+        minN = 1;
+    }
+
+    std::cout << "threads: " << ThreadPool::instance().threadCount()
+              << ", simd: " << simdLevelName(activeSimdLevel()) << std::endl;
+    if (type == "double" || type == "both") {
+        benchType<double>("double", minN, maxN, naiveMax);
+    }
+    if (type == "int" || type == "both") {
+        benchType<int>("int", minN, maxN, naiveMax);
+    }
+    return 0;
+}
@@ -0,0 +1,662 @@
+// Matrix class template and stream operators
+// Storage is one contiguous, cache-line-aligned buffer with a padded row stride
+// (see MatrixStorage.h). Rows are reached through a row-permutation index so
+// that swapping rows is O(1). operator+ and operator* build lazy expressions
+// (see MatrixExpr.h) that are evaluated when assigned to a Matrix. Diagonal,
+// row and column sums can be cached and kept current through element updates
+// and swaps (see MatrixAggregates.h).
+
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Gemm.h"
+#include "MatrixAggregates.h"
+#include "MatrixExpr.h"
+#include "MatrixProfile.h"
+#include "MatrixStorage.h"
+#include "MatrixWriter.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+
+// Elements handled per task when an elementwise expression runs on the thread pool
+const long MATRIX_PARALLEL_ELEMENTS = 1L << 16;
+
+// Rows per partial sum in sumDiagonals; partial sums are combined in order,
+// so the result does not depend on the thread count
+const int MATRIX_DIAGONAL_CHUNK = 4096;
+
+template <typename T>
+class Matrix {
+public:
+    // Type sums of elements are returned in (wider than T for narrow types)
+    typedef typename MatrixAccumulator<T>::type Accumulator;
+
+private:
+    AlignedBuffer<T> buffer;
+    std::vector<int> rowIndex;  // logical row -> physical row; empty until rows are first swapped
+    int rows;
+    int cols;
+    int stride;                 // elements between physical rows, padded to a cache line
+    MatrixAggregateCache<T> aggregates;  // cached sums, when enabled
+
+    // Row pointer for writes that keep the aggregates up to date themselves
+    T* rowData(int row) {
+        return buffer.data() + static_cast<std::size_t>(rowIndex.empty() ? row : rowIndex[row]) * stride;
+    }
+
+    // Mark the aggregates stale after a write they cannot follow
+    void touch() {
+        if (MatrixAggregates<T>* agg = aggregates.get()) {
+            agg->stale = true;
+        }
+    }
+
+    // False for infinities and NaN, which cannot be subtracted back out of a sum
+    static bool subtractable(T value) {
+        return value - value == T();
+    }
+
+    // Diagonal elements (main, secondary) in a row or column, zero where the
+    // row or column does not cross that diagonal
+    std::pair<T, T> rowDiagonals(int r) const {
+        if (r >= std::min(rows, cols)) {
+            return std::make_pair(T(), T());
+        }
+        return std::make_pair((*this)(r, r), (*this)(r, cols - 1 - r));
+    }
+
+    std::pair<T, T> columnDiagonals(int c) const {
+        const int length = std::min(rows, cols);
+        const int secondaryRow = cols - 1 - c;
+        return std::make_pair(c < length ? (*this)(c, c) : T(),
+                              secondaryRow < length ? (*this)(secondaryRow, c) : T());
+    }
+
+    // Correct the cached diagonal sums for a swap: before are the diagonal
+    // elements of the two swapped rows or columns beforehand, after the same
+    // afterwards. Returns false if the sums must be recomputed instead.
+    static bool correctDiagonals(MatrixAggregates<T>& agg, const std::pair<T, T> (&before)[2],
+                                 const std::pair<T, T> (&after)[2]) {
+        for (int k = 0; k < 2; k++) {
+            if (!subtractable(before[k].first) || !subtractable(before[k].second)) {
+                return false;
+            }
+        }
+        for (int k = 0; k < 2; k++) {
+            agg.mainDiagonal += Accumulator(after[k].first) - Accumulator(before[k].first);
+            agg.secondaryDiagonal += Accumulator(after[k].second) - Accumulator(before[k].second);
+        }
+        return true;
+    }
+
+    // The aggregates, recomputed in one pass if they are stale
+    const MatrixAggregates<T>& currentAggregates() const {
+        MatrixAggregates<T>& agg = *aggregates.get();
+        if (agg.stale) {
+            agg.rowSums.assign(rows, Accumulator());
+            agg.columnSums.assign(cols, Accumulator());
+            for (int i = 0; i < rows; i++) {
+                const T* r = rowPtr(i);
+                Accumulator sum = Accumulator();
+                for (int j = 0; j < cols; j++) {
+                    sum += r[j];
+                    agg.columnSums[j] += r[j];
+                }
+                agg.rowSums[i] = sum;
+            }
+            const std::pair<Accumulator, Accumulator> sums = diagonalSums();
+            agg.mainDiagonal = sums.first;
+            agg.secondaryDiagonal = sums.second;
+            agg.stale = false;
+        }
+        return agg;
+    }
+
+    // Sum the diagonals, in parallel chunks for large matrices
+    std::pair<Accumulator, Accumulator> diagonalSums() const {
+        const int length = std::min(rows, cols);
+        const int chunks = (length + MATRIX_DIAGONAL_CHUNK - 1) / MATRIX_DIAGONAL_CHUNK;
+        if (chunks <= 1) {
+            return sumDiagonals(0, length);
+        }
+
+        std::vector<std::pair<Accumulator, Accumulator>> partial(chunks);
+        ThreadPool::instance().parallelFor(chunks, [&](int chunk) {
+            int begin = chunk * MATRIX_DIAGONAL_CHUNK;
+            partial[chunk] = sumDiagonals(begin, std::min(length, begin + MATRIX_DIAGONAL_CHUNK));
+        });
+
+        Accumulator mainDiagonal = Accumulator();
+        Accumulator secondaryDiagonal = Accumulator();
+        for (int c = 0; c < chunks; c++) {
+            mainDiagonal += partial[c].first;
+            secondaryDiagonal += partial[c].second;
+        }
+        return std::make_pair(mainDiagonal, secondaryDiagonal);
+    }
+
+    // Run fn(row, col, len, out) over every row in chunks of up to
+    // MATRIX_EXPR_CHUNK elements, on the thread pool for large matrices
+    template <typename Fn>
+    void forEachChunk(Fn fn) {
+        const int rowsPerTask = static_cast<int>(std::max(1L, MATRIX_PARALLEL_ELEMENTS / std::max(cols, 1)));
+        const int tasks = (rows + rowsPerTask - 1) / rowsPerTask;
+        ThreadPool::instance().parallelFor(tasks, [&](int task) {
+            int end = std::min(rows, (task + 1) * rowsPerTask);
+            for (int i = task * rowsPerTask; i < end; i++) {
+                T* out = rowData(i);
+                for (int j = 0; j < cols; j += MATRIX_EXPR_CHUNK) {
+                    fn(i, j, std::min(MATRIX_EXPR_CHUNK, cols - j), out + j);
+                }
+            }
+        });
+    }
+
+    // Write expr into this (zero-filled) matrix: the elementwise terms in one
+    // pass, then each product term through the GEMM accumulate
+    template <typename E>
+    void evaluate(const E& expr) {
+        if (E::hasElementwise) {
+            forEachChunk([&](int i, int j, int len, T* out) { expr.evalChunk(i, j, len, out); });
+        }
+        expr.accumulateProducts(block());
+    }
+
+    // Profiled operation for evaluating an expression of type E
+    template <typename E>
+    static MatrixProfileOp expressionOp() {
+        return std::is_same<E, MatrixTransposed<T>>::value ? PROFILE_TRANSPOSE
+               : !E::hasProduct ? PROFILE_ADD
+               : E::hasElementwise ? PROFILE_EXPRESSION : PROFILE_MULTIPLY;
+    }
+
+    // Evaluate expr; the profile scope lives until construction finishes, so
+    // it covers the result allocation as well
+    template <typename E>
+    Matrix(const E& expr, const MatrixProfileScope&) : Matrix(expr.getRows(), expr.getCols()) {
+        evaluate(expr);
+    }
+
+public:
+    // Constructor (square)
+    Matrix(int n) : Matrix(n, n) {}
+
+    // Constructor (rectangular)
+    Matrix(int numRows, int numCols) : Matrix(numRows, numCols, MatrixAllocator::current()) {}
+
+    // Constructor with storage from the given allocator (see MatrixAllocator.h)
+    Matrix(int numRows, int numCols, MatrixAllocator& allocator)
+        : buffer(static_cast<std::size_t>(std::max(numRows, 0)) * matrixRowStride<T>(std::max(numCols, 0)),
+                 allocator),
+          rows(numRows), cols(numCols), stride(matrixRowStride<T>(std::max(numCols, 0))) {
+        if (numRows < 0 || numCols < 0) {
+            throw std::invalid_argument("Matrix dimensions must not be negative");
+        }
+    }
+
+    // Default constructor
+    Matrix() : rows(0), cols(0), stride(0) {}
+
+    // Adopt existing storage of numRows x numCols, rowStride elements apart
+    Matrix(AlignedBuffer<T>&& storage, int numRows, int numCols, int rowStride)
+        : buffer(std::move(storage)), rows(numRows), cols(numCols), stride(rowStride) {
+        if (numRows < 0 || numCols < 0 || rowStride < numCols ||
+            buffer.size() < static_cast<std::size_t>(numRows) * rowStride) {
+            throw std::invalid_argument("Matrix storage is too small for its dimensions");
+        }
+    }
+
+    // Evaluate a lazy expression such as a + b + c or a * b + c
+    template <typename E, typename = typename std::enable_if<isMatrixExpression<E>::value>::type>
+    Matrix(const E& expr)
+        : Matrix(expr, MatrixProfileScope(expressionOp<E>(),
+                                          expr.bytesRead() + static_cast<std::uint64_t>(expr.getRows()) *
+                                                             expr.getCols() * sizeof(T))) {}
+
+    // Get size (the row count; equal to the column count for square matrices)
+    int getSize() const {
+        return rows;
+    }
+
+    // Get dimensions
+    int getRows() const {
+        return rows;
+    }
+
+    int getCols() const {
+        return cols;
+    }
+
+    bool isSquare() const {
+        return rows == cols;
+    }
+
+    // Distance in elements between consecutive physical rows
+    int getStride() const {
+        return stride;
+    }
+
+    // Row-permutation index for the kernels, or null while rows are in order
+    const int* rowOrder() const {
+        return rowIndex.empty() ? nullptr : rowIndex.data();
+    }
+
+    // Pointer to the first element of a row
+    const T* rowPtr(int row) const {
+        return buffer.data() + static_cast<std::size_t>(rowIndex.empty() ? row : rowIndex[row]) * stride;
+    }
+
+    // Writable row; marks the aggregates stale
+    T* rowPtr(int row) {
+        touch();
+        return rowData(row);
+    }
+
+    // Access element (for reading)
+    const T& operator()(int row, int col) const {
+        return rowPtr(row)[col];
+    }
+
+    // Access element (for writing; marks the aggregates stale, so read
+    // through a const reference to keep them)
+    T& operator()(int row, int col) {
+        touch();
+        return rowData(row)[col];
+    }
+
+    // Row and column views (not valid across swapRows or resizing)
+    MatrixRowView<const T> row(int r) const {
+        return MatrixRowView<const T>(rowPtr(r), cols);
+    }
+
+    MatrixRowView<T> row(int r) {
+        touch();
+        return MatrixRowView<T>(rowData(r), cols);
+    }
+
+    MatrixColumnView<const T> column(int c) const {
+        return MatrixColumnView<const T>(buffer.data(), rowOrder(), stride, c, rows);
+    }
+
+    MatrixColumnView<T> column(int c) {
+        touch();
+        return MatrixColumnView<T>(buffer.data(), rowOrder(), stride, c, rows);
+    }
+
+    // Strided view of the whole matrix for the compute kernels
+    MatrixBlock<const T> block() const {
+        return MatrixBlock<const T>(buffer.data(), rowOrder(), stride, rows, cols);
+    }
+
+    MatrixBlock<T> block() {
+        touch();
+        return MatrixBlock<T>(buffer.data(), rowOrder(), stride, rows, cols);
+    }
+
+    // Set data from vector (every row must have the same length)
+    void setData(const std::vector<std::vector<T>>& newData) {
+        int n = static_cast<int>(newData.size());
+        int m = n > 0 ? static_cast<int>(newData[0].size()) : 0;
+        for (int i = 0; i < n; i++) {
+            if (static_cast<int>(newData[i].size()) != m) {
+                throw std::invalid_argument("Matrix rows must all have the same length");
+            }
+        }
+        if (n != rows || m != cols) {
+            const bool tracked = aggregatesEnabled();
+            *this = Matrix<T>(n, m);
+            if (tracked) {
+                enableAggregates();
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            std::copy(newData[i].begin(), newData[i].end(), rowPtr(i));
+        }
+    }
+
+    // Get a copy of the data as nested vectors
+    std::vector<std::vector<T>> getData() const {
+        std::vector<std::vector<T>> result(rows);
+        for (int i = 0; i < rows; i++) {
+            result[i].assign(rowPtr(i), rowPtr(i) + cols);
+        }
+        return result;
+    }
+
+    // Lazy transposed view (see MatrixExpr.h); valid while this matrix is
+    MatrixTransposed<T> transposed() const {
+        return MatrixTransposed<T>(*this);
+    }
+
+    // Transpose this matrix. Square matrices are transposed in place with the
+    // cache-oblivious kernel; others are rebuilt with the new shape.
+    void transposeInPlace() {
+        MATRIX_PROFILE_SCOPE(PROFILE_TRANSPOSE, 2ULL * rows * cols * sizeof(T));
+        MatrixAggregates<T>* agg = aggregates.get();
+        if (rows == cols) {
+            const bool current = agg && !agg->stale;
+            ::transposeInPlace(block());
+            if (current) {
+                // Rows and columns trade places; both diagonals map onto themselves
+                agg->rowSums.swap(agg->columnSums);
+                agg->stale = false;
+            }
+        } else {
+            *this = Matrix<T>(transposed());
+            if (agg) {
+                enableAggregates();
+            }
+        }
+    }
+
+    // Add a matrix or expression in place: elementwise terms in one pass,
+    // products accumulated straight into this matrix (c += a * b allocates
+    // nothing). A term that reads this matrix out of order (a product or
+    // transposed view of it) is evaluated aside first.
+    template <typename E, typename = typename std::enable_if<isMatrixOperand<E>::value>::type>
+    Matrix& operator+=(const E& expr) {
+        typedef typename MatrixExprNode<E>::Type Node;
+        const Node node(expr);
+        if (node.getRows() != rows || node.getCols() != cols) {
+            throw std::invalid_argument("Matrix dimensions do not match for addition");
+        }
+        if (node.conflictsWith(*this)) {
+            return *this += Matrix<T>(expr);
+        }
+        touch();
+        MATRIX_PROFILE_SCOPE(expressionOp<Node>(),
+                             node.bytesRead() + 2ULL * static_cast<std::uint64_t>(rows) * cols * sizeof(T));
+        if (Node::hasElementwise) {
+            forEachChunk([&](int i, int j, int len, T* out) { node.addChunk(i, j, len, out); });
+        }
+        node.accumulateProducts(block());
+        return *this;
+    }
+
+    // Scale every element in place
+    Matrix& operator*=(T alpha) {
+        MATRIX_PROFILE_SCOPE(PROFILE_SCALE, 2ULL * rows * cols * sizeof(T));
+        forEachChunk([&](int, int, int len, T* out) {
+            for (int j = 0; j < len; j++) {
+                out[j] *= alpha;
+            }
+        });
+        MatrixAggregates<T>* agg = aggregates.get();
+        if (agg && !std::is_same<Accumulator, T>::value) {
+            // Scaled elements wrap or round in T, so the wide sums cannot
+            // simply be scaled with them
+            agg->stale = true;
+        } else if (agg && !agg->stale) {
+            for (std::size_t i = 0; i < agg->rowSums.size(); i++) {
+                agg->rowSums[i] *= alpha;
+            }
+            for (std::size_t j = 0; j < agg->columnSums.size(); j++) {
+                agg->columnSums[j] *= alpha;
+            }
+            agg->mainDiagonal *= alpha;
+            agg->secondaryDiagonal *= alpha;
+        }
+        return *this;
+    }
+
+    // Calculate sum of diagonals over rows [begin, end). The main diagonal is
+    // (i, i) and the secondary one (i, cols - 1 - i), for i < min(rows, cols).
+    std::pair<Accumulator, Accumulator> sumDiagonals(int begin, int end) const {
+        Accumulator mainDiagonal = Accumulator();
+        Accumulator secondaryDiagonal = Accumulator();
+        simdKernels<T>().diagonalSums(buffer.data(), rowOrder(), stride, cols, begin, end,
+                                      &mainDiagonal, &secondaryDiagonal);
+        return std::make_pair(mainDiagonal, secondaryDiagonal);
+    }
+
+    // Calculate sum of diagonals (O(1) from the aggregates when enabled)
+    std::pair<Accumulator, Accumulator> sumDiagonals() const {
+        const MatrixAggregates<T>* agg = aggregates.get();
+        MATRIX_PROFILE_SCOPE(PROFILE_SUM_DIAGONALS, agg && !agg->stale ? 0 : 2ULL * std::min(rows, cols) * sizeof(T));
+        if (agg) {
+            const MatrixAggregates<T>& current = currentAggregates();
+            return std::make_pair(current.mainDiagonal, current.secondaryDiagonal);
+        }
+        return diagonalSums();
+    }
+
+    // Sum of one row or column (O(1) from the aggregates when enabled)
+    Accumulator rowSum(int row) const {
+        if (aggregates.get()) {
+            return currentAggregates().rowSums[row];
+        }
+        const T* r = rowPtr(row);
+        Accumulator sum = Accumulator();
+        for (int j = 0; j < cols; j++) {
+            sum += r[j];
+        }
+        return sum;
+    }
+
+    Accumulator columnSum(int col) const {
+        if (aggregates.get()) {
+            return currentAggregates().columnSums[col];
+        }
+        Accumulator sum = Accumulator();
+        for (int i = 0; i < rows; i++) {
+            sum += rowPtr(i)[col];
+        }
+        return sum;
+    }
+
+    // Cache the diagonal, row and column sums and keep them current through
+    // updateElement, swapRows, swapColumns and *= (see MatrixAggregates.h).
+    // They are computed on the first query; calling this again recomputes them.
+    void enableAggregates() {
+        aggregates.enable();
+    }
+
+    void disableAggregates() {
+        aggregates.disable();
+    }
+
+    bool aggregatesEnabled() const {
+        return aggregates.get() != nullptr;
+    }
+
+    // Swap rows (O(1): only the row index changes; the first swap builds it)
+    bool swapRows(int row1, int row2) {
+        MATRIX_PROFILE_SCOPE(PROFILE_SWAP_ROWS, 2 * sizeof(int));
+        if (row1 < 0 || row1 >= rows || row2 < 0 || row2 >= rows) {
+            return false;
+        }
+
+        if (rowIndex.empty()) {
+            rowIndex.resize(rows);
+            for (int i = 0; i < rows; i++) {
+                rowIndex[i] = i;
+            }
+        }
+        MatrixAggregates<T>* agg = aggregates.get();
+        if (agg && !agg->stale) {
+            const std::pair<T, T> before[2] = {rowDiagonals(row1), rowDiagonals(row2)};
+            std::swap(rowIndex[row1], rowIndex[row2]);
+            const std::pair<T, T> after[2] = {rowDiagonals(row1), rowDiagonals(row2)};
+            std::swap(agg->rowSums[row1], agg->rowSums[row2]);
+            agg->stale = !correctDiagonals(*agg, before, after);
+        } else {
+            std::swap(rowIndex[row1], rowIndex[row2]);
+        }
+        return true;
+    }
+
+    // Swap columns
+    bool swapColumns(int col1, int col2) {
+        MATRIX_PROFILE_SCOPE(PROFILE_SWAP_COLUMNS, 4ULL * rows * sizeof(T));
+        if (col1 < 0 || col1 >= cols || col2 < 0 || col2 >= cols) {
+            return false;
+        }
+
+        MatrixAggregates<T>* agg = aggregates.get();
+        const bool current = agg && !agg->stale;
+        std::pair<T, T> before[2];
+        if (current) {
+            before[0] = columnDiagonals(col1);
+            before[1] = columnDiagonals(col2);
+        }
+        for (int i = 0; i < rows; i++) {
+            T* r = rowData(i);
+            std::swap(r[col1], r[col2]);
+        }
+        if (current) {
+            const std::pair<T, T> after[2] = {columnDiagonals(col1), columnDiagonals(col2)};
+            std::swap(agg->columnSums[col1], agg->columnSums[col2]);
+            agg->stale = !correctDiagonals(*agg, before, after);
+        }
+        return true;
+    }
+
+    // Update element
+    bool updateElement(int row, int col, T value) {
+        MATRIX_PROFILE_SCOPE(PROFILE_UPDATE_ELEMENT, sizeof(T));
+        if (row < 0 || row >= rows || col < 0 || col >= cols) {
+            return false;
+        }
+
+        T& element = rowData(row)[col];
+        MatrixAggregates<T>* agg = aggregates.get();
+        if (agg && !agg->stale) {
+            if (subtractable(element)) {
+                // One element changes, so each sum through it moves by the difference
+                const Accumulator delta = Accumulator(value) - Accumulator(element);
+                agg->rowSums[row] += delta;
+                agg->columnSums[col] += delta;
+                if (row < std::min(rows, cols)) {
+                    if (col == row) {
+                        agg->mainDiagonal += delta;
+                    }
+                    if (col == cols - 1 - row) {
+                        agg->secondaryDiagonal += delta;
+                    }
+                }
+            } else {
+                agg->stale = true;
+            }
+        }
+        element = value;
+        return true;
+    }
+
+    // Display the matrix
+    void display() const {
+        std::cout << *this;
+    }
+};
+
+// c = alpha * a * b + beta * c into an existing c, where a and b are
+// matrices, transposed views (m.transposed()) or other expressions. c must
+// already have the dimensions of the product; its storage is reused. With
+// beta == 0 the old contents of c are ignored, even NaNs.
+template <typename T, typename L, typename R>
+void multiplyInto(Matrix<T>& c, const L& a, const R& b, typename std::common_type<T>::type alpha,
+                  typename std::common_type<T>::type beta) {
+    const MatrixProduct<T> product = a * b;
+    if (product.getRows() != c.getRows() || product.getCols() != c.getCols()) {
+        throw std::invalid_argument("Destination dimensions do not match the product");
+    }
+    // A product that reads c is formed aside, since c is overwritten first
+    const bool aliased = product.conflictsWith(c);
+    const Matrix<T> value = aliased ? Matrix<T>(product) : Matrix<T>();
+    MATRIX_PROFILE_SCOPE(PROFILE_MULTIPLY,
+                         product.bytesRead() + 2ULL * static_cast<std::uint64_t>(c.getRows()) * c.getCols() * sizeof(T));
+    for (int i = 0; i < c.getRows(); i++) {
+        T* row = c.rowPtr(i);
+        if (beta == T()) {
+            std::fill_n(row, c.getCols(), T());
+        } else if (beta != T(1)) {
+            for (int j = 0; j < c.getCols(); j++) {
+                row[j] *= beta;
+            }
+        }
+        if (aliased) {
+            simdKernels<T>().axpy(row, alpha, value.rowPtr(i), c.getCols());
+        }
+    }
+    if (!aliased) {
+        product.accumulate(c.block(), alpha);
+    }
+}
+
+// c = a * b into an existing c
+template <typename T, typename L, typename R>
+void multiplyInto(Matrix<T>& c, const L& a, const R& b) {
+    multiplyInto(c, a, b, T(1), T());
+}
+
+// a * b in the accumulator type of T, so integer products do not wrap (an
+// int product comes back as int64) and bfloat16 products are rounded once.
+// For types that accumulate in themselves this is a * b.
+template <typename T>
+Matrix<typename MatrixAccumulator<T>::type> multiplyWide(const Matrix<T>& a, const Matrix<T>& b) {
+    typedef typename MatrixAccumulator<T>::type Wide;
+    Matrix<Wide> c(a.getRows(), b.getCols());
+    MATRIX_PROFILE_SCOPE(PROFILE_MULTIPLY,
+                         static_cast<std::uint64_t>(a.getRows()) * a.getCols() * sizeof(T) +
+                             static_cast<std::uint64_t>(b.getRows()) * b.getCols() * sizeof(T) +
+                             static_cast<std::uint64_t>(c.getRows()) * c.getCols() * sizeof(Wide));
+    gemmAccumulate(GemmOperand<T>(a.block()), GemmOperand<T>(b.block()), c.block(), Wide(1));
+    return c;
+}
+
+// Input stream operator for Matrix. Values are read straight into a new
+// buffer that is then moved into matrix.
+template <typename T>
+std::istream& operator>>(std::istream& in, Matrix<T>& matrix) {
+    int n = matrix.getRows();
+    int m = matrix.getCols();
+    MATRIX_PROFILE_SCOPE(PROFILE_STREAM_IN, static_cast<std::uint64_t>(n) * m * sizeof(T));
+    Matrix<T> values(n, m);
+
+    for (int i = 0; i < n; i++) {
+        T* row = values.rowPtr(i);
+        for (int j = 0; j < m; j++) {
+            typename MatrixTextType<T>::type value;
+            if (in >> value) {
+                row[j] = static_cast<T>(value);
+            }
+        }
+    }
+
+    const bool tracked = matrix.aggregatesEnabled();
+    matrix = std::move(values);
+    if (tracked) {
+        matrix.enableAggregates();
+    }
+    return in;
+}
+
+// Output stream operator for Matrix. The text is built in a MatrixWriter
+// buffer and written in large blocks, then the stream is flushed once.
+template <typename T>
+std::ostream& operator<<(std::ostream& out, const Matrix<T>& matrix) {
+    MATRIX_PROFILE_SCOPE(PROFILE_STREAM_OUT,
+                         static_cast<std::uint64_t>(matrix.getRows()) * matrix.getCols() * sizeof(T));
+    {
+        MatrixWriter writer(out);
+        writer.writeMatrix(matrix);
+        writer.flush();
+    }
+    // Leave the stream in the fixed, 2-decimal mode that per-element
+    // formatting used to leave behind, so later output is unchanged
+    if (!std::is_integral<T>::value && matrix.getRows() > 0 && matrix.getCols() > 0) {
+        out << std::fixed << std::setprecision(2);
+    }
+    return out;
+}
+
+#endif // MATRIX_H
@@ -0,0 +1,73 @@
+// Cached aggregates of a Matrix<T>
+// Once enabled with Matrix::enableAggregates(), a matrix keeps its diagonal
+// sums, row sums and column sums and corrects them on every updateElement,
+// swapRows and swapColumns: O(1) for an element update, O(1) for the
+// diagonal sums and a swap of two cached sums for a swap. sumDiagonals(),
+// rowSum() and columnSum() then answer in O(1).
+//
+// Writes the matrix cannot see (non-const operator(), rowPtr(), row(),
+// column() or block(), setData, +=) mark the aggregates stale; the next query
+// recomputes them in one pass. Read through a const reference to keep them
+// current. Corrected double sums can drift from a fresh sum in the last
+// bits; enableAggregates() again recomputes them. Queries update the cache,
+// so concurrent queries of one matrix need external locking.
+
+#ifndef MATRIX_AGGREGATES_H
+#define MATRIX_AGGREGATES_H
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "MatrixTypes.h"
+
+// Sums are kept in the accumulator type of T (MatrixTypes.h)
+template <typename T>
+struct MatrixAggregates {
+    typedef typename MatrixAccumulator<T>::type Sum;
+
+    bool stale;                // recompute before the next query
+    Sum mainDiagonal;
+    Sum secondaryDiagonal;
+    std::vector<Sum> rowSums;  // by logical row
+    std::vector<Sum> columnSums;
+
+    MatrixAggregates() : stale(true), mainDiagonal(), secondaryDiagonal() {}
+};
+
+// Optional MatrixAggregates owned by a matrix; copies are deep, so a copied
+// matrix carries its own aggregates
+template <typename T>
+class MatrixAggregateCache {
+private:
+    std::unique_ptr<MatrixAggregates<T>> state;
+
+public:
+    MatrixAggregateCache() {}
+
+    MatrixAggregateCache(const MatrixAggregateCache& other)
+        : state(other.state ? new MatrixAggregates<T>(*other.state) : nullptr) {}
+
+    MatrixAggregateCache(MatrixAggregateCache&& other) noexcept : state(std::move(other.state)) {}
+
+    MatrixAggregateCache& operator=(MatrixAggregateCache other) noexcept {
+        state.swap(other.state);
+        return *this;
+    }
+
+    // The aggregates, or null when they are not enabled. They are a cache,
+    // so const matrices update them too.
+    MatrixAggregates<T>* get() const {
+        return state.get();
+    }
+
+    void enable() {
+        state.reset(new MatrixAggregates<T>());
+    }
+
+    void disable() {
+        state.reset();
+    }
+};
+
+#endif // MATRIX_AGGREGATES_H
@@ -0,0 +1,259 @@
+// Allocators for matrix buffers
+// Every AlignedBuffer gets its memory from a MatrixAllocator. The default is
+// a process-wide size-class pool, so repeated operations of the same shape
+// (a result per loop iteration, GEMM packing buffers) reuse freed blocks
+// instead of going back to malloc. A MatrixArena hands out memory from large
+// chunks and releases it all at once; MatrixAllocatorScope makes an
+// allocator the default for matrices created on the calling thread.
+//
+// Set MATRIX_ALLOCATOR=system to bypass the pool.
+
+#ifndef MATRIX_ALLOCATOR_H
+#define MATRIX_ALLOCATOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+#include <vector>
+
+#include "MatrixProfile.h"
+
+// Alignment of matrix buffers and of the start of every row
+const std::size_t MATRIX_CACHE_LINE = 64;
+
+// Bytes of free blocks the pool keeps for reuse; blocks freed beyond this go
+// back to the system
+const std::size_t MATRIX_POOL_MAX_CACHED = std::size_t(512) << 20;
+
+// Default chunk size of a MatrixArena
+const std::size_t MATRIX_ARENA_CHUNK = std::size_t(4) << 20;
+
+// Source of cache-line-aligned memory. deallocate is given the same byte
+// count that was passed to allocate.
+class MatrixAllocator {
+public:
+    virtual ~MatrixAllocator() {}
+
+    virtual void* allocate(std::size_t bytes) = 0;
+    virtual void deallocate(void* p, std::size_t bytes) = 0;
+
+    // posix_memalign and free
+    static MatrixAllocator& system();
+
+    // Process-wide size-class pool over system()
+    static MatrixAllocator& pool();
+
+    // Allocator for new buffers on the calling thread: the innermost
+    // MatrixAllocatorScope, else the pool (or system() if MATRIX_ALLOCATOR=system)
+    static MatrixAllocator& current() {
+        MatrixAllocator* scoped = threadDefault();
+        return scoped ? *scoped : processDefault();
+    }
+
+    static MatrixAllocator*& threadDefault() {
+        static thread_local MatrixAllocator* allocator = nullptr;
+        return allocator;
+    }
+
+private:
+    static MatrixAllocator& processDefault() {
+        static MatrixAllocator& allocator = chooseDefault();
+        return allocator;
+    }
+
+    static MatrixAllocator& chooseDefault() {
+        const char* env = std::getenv("MATRIX_ALLOCATOR");
+        return env && std::strcmp(env, "system") == 0 ? system() : pool();
+    }
+};
+
+class MatrixSystemAllocator : public MatrixAllocator {
+public:
+    void* allocate(std::size_t bytes) {
+        void* p = nullptr;
+        if (posix_memalign(&p, MATRIX_CACHE_LINE, bytes) != 0) {
+            throw std::bad_alloc();
+        }
+        matrixProfileAllocation(bytes);
+        return p;
+    }
+
+    void deallocate(void* p, std::size_t) {
+        free(p);
+    }
+};
+
+// Keeps freed blocks in lists keyed by size class and hands them out again.
+// Sizes are rounded up to a quarter of their power of two (at least a cache
+// line), which bounds the waste at 25% while letting nearby shapes share
+// blocks.
+class MatrixPoolAllocator : public MatrixAllocator {
+private:
+    MatrixAllocator& upstream;
+    std::mutex lock;
+    std::map<std::size_t, std::vector<void*>> freeLists;
+    std::size_t cachedBytes;
+
+public:
+    explicit MatrixPoolAllocator(MatrixAllocator& source) : upstream(source), cachedBytes(0) {}
+
+    ~MatrixPoolAllocator() {
+        release();
+    }
+
+    static std::size_t sizeClass(std::size_t bytes) {
+        if (bytes <= MATRIX_CACHE_LINE) {
+            return MATRIX_CACHE_LINE;
+        }
+        std::size_t power = MATRIX_CACHE_LINE;
+        while (power * 2 < bytes) {
+            power *= 2;
+        }
+        const std::size_t step = power / 4;
+        return (bytes + step - 1) / step * step;
+    }
+
+    void* allocate(std::size_t bytes) {
+        const std::size_t size = sizeClass(bytes);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            std::map<std::size_t, std::vector<void*>>::iterator it = freeLists.find(size);
+            if (it != freeLists.end() && !it->second.empty()) {
+                void* p = it->second.back();
+                it->second.pop_back();
+                cachedBytes -= size;
+                return p;
+            }
+        }
+        return upstream.allocate(size);
+    }
+
+    void deallocate(void* p, std::size_t bytes) {
+        const std::size_t size = sizeClass(bytes);
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (cachedBytes + size <= MATRIX_POOL_MAX_CACHED) {
+                freeLists[size].push_back(p);
+                cachedBytes += size;
+                return;
+            }
+        }
+        upstream.deallocate(p, size);
+    }
+
+    // Return every cached block to the upstream allocator
+    void release() {
+        std::lock_guard<std::mutex> guard(lock);
+        for (std::map<std::size_t, std::vector<void*>>::iterator it = freeLists.begin();
+             it != freeLists.end(); ++it) {
+            for (std::size_t i = 0; i < it->second.size(); i++) {
+                upstream.deallocate(it->second[i], it->first);
+            }
+        }
+        freeLists.clear();
+        cachedBytes = 0;
+    }
+
+    std::size_t cached() {
+        std::lock_guard<std::mutex> guard(lock);
+        return cachedBytes;
+    }
+};
+
+// Never destroyed, so buffers freed during static destruction still find them
+inline MatrixAllocator& MatrixAllocator::system() {
+    static MatrixAllocator* allocator = new MatrixSystemAllocator();
+    return *allocator;
+}
+
+inline MatrixAllocator& MatrixAllocator::pool() {
+    static MatrixAllocator* allocator = new MatrixPoolAllocator(system());
+    return *allocator;
+}
+
+// Bump allocator over large chunks. deallocate does nothing; reset() makes
+// all the memory available again. Every buffer allocated from the arena must
+// be destroyed before reset() or before the arena itself.
+class MatrixArena : public MatrixAllocator {
+private:
+    struct Chunk {
+        char* data;
+        std::size_t size;
+    };
+
+    MatrixAllocator& upstream;
+    std::size_t chunkSize;
+    std::mutex lock;
+    std::vector<Chunk> chunks;
+    std::size_t current;  // chunk being carved
+    std::size_t offset;   // bytes used in it
+
+public:
+    explicit MatrixArena(std::size_t defaultChunk = MATRIX_ARENA_CHUNK,
+                         MatrixAllocator& source = MatrixAllocator::system())
+        : upstream(source), chunkSize(defaultChunk), current(0), offset(0) {}
+
+    ~MatrixArena() {
+        for (std::size_t i = 0; i < chunks.size(); i++) {
+            upstream.deallocate(chunks[i].data, chunks[i].size);
+        }
+    }
+
+    MatrixArena(const MatrixArena&) = delete;
+    MatrixArena& operator=(const MatrixArena&) = delete;
+
+    void* allocate(std::size_t bytes) {
+        bytes = (bytes + MATRIX_CACHE_LINE - 1) / MATRIX_CACHE_LINE * MATRIX_CACHE_LINE;
+        std::lock_guard<std::mutex> guard(lock);
+        while (current < chunks.size() && offset + bytes > chunks[current].size) {
+            current++;
+            offset = 0;
+        }
+        if (current == chunks.size()) {
+            Chunk chunk;
+            chunk.size = std::max(chunkSize, bytes);
+            chunk.data = static_cast<char*>(upstream.allocate(chunk.size));
+            chunks.push_back(chunk);
+            offset = 0;
+        }
+        void* p = chunks[current].data + offset;
+        offset += bytes;
+        return p;
+    }
+
+    void deallocate(void*, std::size_t) {}
+
+    // Reuse all chunks from the start; earlier allocations become invalid
+    void reset() {
+        std::lock_guard<std::mutex> guard(lock);
+        current = 0;
+        offset = 0;
+    }
+};
+
+// Makes allocator the default for buffers created on this thread until the
+// scope ends. Work the thread pool runs on other threads (such as GEMM
+// packing buffers) still uses the process default.
+class MatrixAllocatorScope {
+private:
+    MatrixAllocator* previous;
+
+public:
+    explicit MatrixAllocatorScope(MatrixAllocator& allocator) : previous(MatrixAllocator::threadDefault()) {
+        MatrixAllocator::threadDefault() = &allocator;
+    }
+
+    ~MatrixAllocatorScope() {
+        MatrixAllocator::threadDefault() = previous;
+    }
+
+    MatrixAllocatorScope(const MatrixAllocatorScope&) = delete;
+    MatrixAllocatorScope& operator=(const MatrixAllocatorScope&) = delete;
+};
+
+#endif // MATRIX_ALLOCATOR_H
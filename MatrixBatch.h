@@ -0,0 +1,667 @@
+// Batch mode for matrix_operations
+// A script is a list of commands, one per line or separated by ';', with '#'
+// starting a comment. Commands run back to back on named matrices without
+// prompts; only diag and print write to the output stream. With a cluster
+// (useCluster, the --workers and --spawn-workers flags in main), multiply runs
+// on its worker processes (see DistributedGemm.h). The server mode
+// (MatrixServer.h) runs the same commands sent by clients over a socket.
+//
+//     load PATH NAME [NAME...]   text file (input.txt format) or .mtxb file, or
+//                                one matrix in coordinate form (input_sparse.txt
+//                                format, see SparseMatrix.h), stored dense
+//     save NAME PATH             .mtxb -> binary format, anything else -> text
+//     add DEST A B               DEST = A + B
+//     multiply DEST A B          DEST = A * B (integer products widen, see multiply)
+//     swap NAME rows|cols I J
+//     update NAME ROW COL VALUE
+//     diag NAME                  prints "NAME main secondary"
+//     print NAME [PATH]          to the output stream, or streamed to a file or pipe
+//     stream multiply|add OUT A B [MB]
+//                                OUT = A * B or A + B on .mtxb files, tile by tile
+//                                within MB megabytes, in the element type of A and B
+//                                (see OutOfCore.h)
+//
+// add and multiply take operands of one element type, except that integer
+// operands of different widths (such as an int matrix and an int64 product)
+// are combined in the wider type.
+
+#ifndef MATRIX_BATCH_H
+#define MATRIX_BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "DistributedGemm.h"
+#include "Matrix.h"
+#include "MatrixBinary.h"
+#include "MatrixWriter.h"
+#include "MatrixLoader.h"
+#include "MatrixTypes.h"
+#include "OutOfCore.h"
+#include "SparseMatrix.h"
+
+// Error in a batch script, with the 1-based line of the failing command
+class BatchError : public std::runtime_error {
+private:
+    int lineNumber;
+    std::string detail;
+
+public:
+    BatchError(const std::string& message, int line)
+        : std::runtime_error("line " + std::to_string(line) + ": " + message), lineNumber(line),
+          detail(message) {}
+
+    int line() const { return lineNumber; }
+
+    // The error without its line
+    const std::string& message() const { return detail; }
+};
+
+// One command of a script: its name, arguments and line
+struct BatchCommand {
+    std::string name;
+    std::vector<std::string> args;
+    int line;
+};
+
+// Split script text into commands
+inline std::vector<BatchCommand> parseBatchScript(const std::string& text) {
+    std::vector<BatchCommand> commands;
+    BatchCommand current;
+    current.line = 1;
+    std::string word;
+    int line = 1;
+
+    auto endWord = [&]() {
+        if (word.empty()) {
+            return;
+        }
+        if (current.name.empty()) {
+            current.name = word;
+            current.line = line;
+        } else {
+            current.args.push_back(word);
+        }
+        word.clear();
+    };
+    auto endCommand = [&]() {
+        endWord();
+        if (!current.name.empty()) {
+            commands.push_back(current);
+        }
+        current = BatchCommand();
+    };
+
+    bool comment = false;
+    for (std::size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '\n') {
+            endCommand();
+            comment = false;
+            line++;
+        } else if (comment) {
+            continue;
+        } else if (c == '#') {
+            comment = true;
+        } else if (c == ';') {
+            endCommand();
+        } else if (c == ' ' || c == '\t' || c == '\r') {
+            endWord();
+        } else {
+            word += c;
+        }
+    }
+    endCommand();
+    return commands;
+}
+
+// A named matrix of any element type; dataType is its MatrixTypeCode, as
+// in the text format header, and selects the member that holds it
+struct BatchMatrix {
+    int dataType;
+    Matrix<int> ints;
+    Matrix<double> doubles;
+    Matrix<float> floats;
+    Matrix<std::int64_t> int64s;
+    Matrix<std::int8_t> int8s;
+    Matrix<std::int16_t> int16s;
+    Matrix<BFloat16> bfloat16s;
+
+    BatchMatrix() : dataType(MATRIX_TYPE_INT) {}
+};
+
+template <typename T>
+Matrix<T>& batchMatrixData(BatchMatrix& m);
+
+template <>
+inline Matrix<int>& batchMatrixData<int>(BatchMatrix& m) {
+    return m.ints;
+}
+
+template <>
+inline Matrix<double>& batchMatrixData<double>(BatchMatrix& m) {
+    return m.doubles;
+}
+
+template <>
+inline Matrix<float>& batchMatrixData<float>(BatchMatrix& m) {
+    return m.floats;
+}
+
+template <>
+inline Matrix<std::int64_t>& batchMatrixData<std::int64_t>(BatchMatrix& m) {
+    return m.int64s;
+}
+
+template <>
+inline Matrix<std::int8_t>& batchMatrixData<std::int8_t>(BatchMatrix& m) {
+    return m.int8s;
+}
+
+template <>
+inline Matrix<std::int16_t>& batchMatrixData<std::int16_t>(BatchMatrix& m) {
+    return m.int16s;
+}
+
+template <>
+inline Matrix<BFloat16>& batchMatrixData<BFloat16>(BatchMatrix& m) {
+    return m.bfloat16s;
+}
+
+// Write a square matrix in the text format that MatrixTextLoader reads.
+// Floating point keeps every significant digit so a save/load round trip is
+// exact.
+template <typename T>
+void writeMatrixText(std::ostream& out, const Matrix<T>& matrix, int dataType) {
+    typedef typename MatrixTextType<T>::type Text;
+    if (!matrix.isSquare()) {
+        throw std::invalid_argument("The text format holds square matrices only; save as .mtxb instead");
+    }
+    const int n = matrix.getSize();
+    std::ostringstream text;
+    text << std::setprecision(std::numeric_limits<Text>::max_digits10);
+    text << n << " " << dataType << "\n";
+    for (int i = 0; i < n; i++) {
+        const T* row = matrix.rowPtr(i);
+        for (int j = 0; j < n; j++) {
+            if (j > 0) {
+                text << ' ';
+            }
+            text << static_cast<Text>(row[j]);
+        }
+        text << '\n';
+    }
+    out << text.str();
+}
+
+// Named matrices plus the commands that work on them
+class BatchSession {
+private:
+    std::map<std::string, BatchMatrix> matrices;
+    std::ostream* out;       // where diag and print write
+    MatrixCluster* cluster;  // runs multiply when set
+
+    // Visitors for visitMatrixType: each runs a member template of the
+    // session with the element type of a type code
+    struct TextLoad {
+        BatchSession& session;
+        MatrixTextLoader& loader;
+        const MatrixFileHeader& header;
+        const BatchCommand& command;
+
+        template <typename T>
+        void apply() {
+            session.loadText<T>(loader, header, command);
+        }
+    };
+
+    struct BinaryLoad {
+        BatchSession& session;
+        const std::string& path;
+        bool swapped;
+        const std::string& name;
+
+        template <typename T>
+        void apply() {
+            session.loadBinary<T>(path, swapped, name);
+        }
+    };
+
+    struct Combine {
+        BatchSession& session;
+        BatchMatrix& a;
+        BatchMatrix& b;
+        bool multiply;
+        BatchMatrix& dest;
+
+        template <typename T>
+        void apply() {
+            session.combine<T>(a, b, multiply, dest);
+        }
+    };
+
+    // Converts a matrix of element type S to the type of a code
+    template <typename S>
+    struct ConvertTo {
+        const Matrix<S>& from;
+        BatchMatrix& to;
+
+        template <typename W>
+        void apply() {
+            Matrix<W> converted(from.getRows(), from.getCols());
+            for (int i = 0; i < from.getRows(); i++) {
+                const S* src = from.rowPtr(i);
+                W* dst = converted.rowPtr(i);
+                for (int j = 0; j < from.getCols(); j++) {
+                    dst[j] = static_cast<W>(src[j]);
+                }
+            }
+            to.dataType = MatrixDtype<W>::code;
+            batchMatrixData<W>(to) = std::move(converted);
+        }
+    };
+
+    struct Convert {
+        BatchMatrix& from;
+        int dataType;
+        BatchMatrix& to;
+
+        template <typename S>
+        void apply() {
+            ConvertTo<S> visitor = {batchMatrixData<S>(from), to};
+            visitMatrixType(dataType, visitor);
+        }
+    };
+
+    struct Stream {
+        const BatchCommand& command;
+        const OutOfCoreOptions& options;
+
+        template <typename T>
+        void apply() {
+            const std::vector<std::string>& args = command.args;
+            if (args[0] == "multiply") {
+                streamingMultiply<T>(args[2], args[3], args[1], options);
+            } else {
+                streamingAdd<T>(args[2], args[3], args[1], options);
+            }
+        }
+    };
+
+    struct SparseLoad {
+        BatchSession& session;
+        SparseTextLoader& loader;
+        const SparseFileHeader& header;
+        const std::string& name;
+
+        template <typename T>
+        void apply() {
+            session.loadSparse<T>(loader, header, name);
+        }
+    };
+
+    struct MatrixCommand {
+        BatchSession& session;
+        const BatchCommand& command;
+        BatchMatrix& m;
+
+        template <typename T>
+        void apply() {
+            session.executeOn<T>(command, m);
+        }
+    };
+
+    static void fail(const BatchCommand& command, const std::string& message) {
+        throw BatchError(command.name + ": " + message, command.line);
+    }
+
+    static void expectArgs(const BatchCommand& command, std::size_t count, const char* usage) {
+        if (command.args.size() != count) {
+            fail(command, std::string("expected ") + usage);
+        }
+    }
+
+    template <typename T>
+    static T parseNumber(const BatchCommand& command, const std::string& token) {
+        try {
+            TextScanner scanner(token.data(), token.size());
+            T value = scanner.parseValue<T>();
+            if (!scanner.atEnd()) {
+                scanner.fail("trailing characters");
+            }
+            return value;
+        } catch (const MatrixParseError&) {
+            fail(command, "invalid number '" + token + "'");
+        }
+        return T();
+    }
+
+    BatchMatrix& find(const BatchCommand& command, const std::string& name) {
+        std::map<std::string, BatchMatrix>::iterator it = matrices.find(name);
+        if (it == matrices.end()) {
+            fail(command, "no matrix named '" + name + "'");
+        }
+        return it->second;
+    }
+
+    template <typename T>
+    void loadText(MatrixTextLoader& loader, const MatrixFileHeader& header, const BatchCommand& command) {
+        for (std::size_t i = 1; i < command.args.size(); i++) {
+            BatchMatrix m;
+            m.dataType = header.dataType;
+            loader.readMatrix(batchMatrixData<T>(m), header.size);
+            matrices[command.args[i]] = std::move(m);
+        }
+    }
+
+    template <typename T>
+    void loadBinary(const std::string& path, bool swapped, const std::string& name) {
+        BatchMatrix m;
+        m.dataType = MatrixDtype<T>::code;
+        batchMatrixData<T>(m) = swapped ? readMatrixBinary<T>(path) : mapMatrixBinary<T>(path, true);
+        matrices[name] = std::move(m);
+    }
+
+    template <typename T>
+    void loadSparse(SparseTextLoader& loader, const SparseFileHeader& header, const std::string& name) {
+        BatchMatrix m;
+        m.dataType = MatrixDtype<T>::code;
+        batchMatrixData<T>(m) = loader.readMatrix<T>(header).toDense();
+        matrices[name] = std::move(m);
+    }
+
+    void load(const BatchCommand& command) {
+        if (command.args.size() < 2) {
+            fail(command, "expected load PATH NAME [NAME...]");
+        }
+        const std::string& path = command.args[0];
+        if (isMatrixBinaryFile(path)) {
+            if (command.args.size() != 2) {
+                fail(command, "a binary file holds one matrix");
+            }
+            int dtype;
+            bool swapped;
+            {
+                MatrixBinaryMapping mapping(path);
+                dtype = static_cast<int>(mapping.info().dtype);
+                swapped = mapping.isByteSwapped();
+            }
+            BinaryLoad visitor = {*this, path, swapped, command.args[1]};
+            if (!visitMatrixType(dtype, visitor)) {
+                fail(command, path + ": unsupported element type");
+            }
+            return;
+        }
+
+        try {
+            if (isSparseTextFile(path)) {
+                if (command.args.size() != 2) {
+                    fail(command, "a coordinate file holds one matrix");
+                }
+                SparseTextLoader loader(path);
+                SparseFileHeader header = loader.readHeader();
+                SparseLoad visitor = {*this, loader, header, command.args[1]};
+                if (!visitMatrixType(header.dataType, visitor)) {
+                    fail(command, path + ": type must be " + matrixTypeList());
+                }
+                return;
+            }
+            MatrixTextLoader loader(path);
+            MatrixFileHeader header = loader.readHeader();
+            TextLoad visitor = {*this, loader, header, command};
+            if (!visitMatrixType(header.dataType, visitor)) {
+                fail(command, path + ": type must be " + matrixTypeList());
+            }
+        } catch (const MatrixParseError& e) {
+            fail(command, path + ": " + e.what());
+        }
+    }
+
+    // Loaded .mtxb matrices are views of their files, so a save replaces
+    // the file whole rather than rewriting it under them
+    template <typename T>
+    void saveAs(BatchMatrix& m, const std::string& path) {
+        const Matrix<T>& matrix = batchMatrixData<T>(m);
+        if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".mtxb") == 0) {
+            writeMatrixBinary(path, matrix);
+            return;
+        }
+        MatrixFileReplacement replacement(path);
+        std::ofstream file(replacement.path().c_str());
+        if (!file) {
+            throw std::runtime_error("Could not open file " + path + " for writing");
+        }
+        writeMatrixText(file, matrix, m.dataType);
+        file.close();
+        if (!file) {
+            throw std::runtime_error("Failed to write " + path);
+        }
+        replacement.commit();
+    }
+
+    template <typename T>
+    void combine(BatchMatrix& a, BatchMatrix& b, bool multiply, BatchMatrix& dest) {
+        const Matrix<T>& lhs = batchMatrixData<T>(a);
+        const Matrix<T>& rhs = batchMatrixData<T>(b);
+        if (multiply) {
+            multiplyAs<T>(lhs, rhs, dest, std::is_integral<T>());
+            return;
+        }
+        dest.dataType = a.dataType;
+        batchMatrixData<T>(dest) = Matrix<T>(lhs + rhs);
+    }
+
+    // Integer products are kept in the accumulator type (int gives int64,
+    // int8 and int16 give int) so they do not wrap; floating point products
+    // keep their type.
+    template <typename T>
+    void multiplyAs(const Matrix<T>& lhs, const Matrix<T>& rhs, BatchMatrix& dest, std::true_type) {
+        typedef typename MatrixAccumulator<T>::type Wide;
+        dest.dataType = MatrixDtype<Wide>::code;
+        batchMatrixData<Wide>(dest) = cluster ? cluster->multiplyWide(lhs, rhs) : multiplyWide(lhs, rhs);
+    }
+
+    template <typename T>
+    void multiplyAs(const Matrix<T>& lhs, const Matrix<T>& rhs, BatchMatrix& dest, std::false_type) {
+        dest.dataType = MatrixDtype<T>::code;
+        batchMatrixData<T>(dest) = cluster ? cluster->multiply(lhs, rhs) : Matrix<T>(lhs * rhs);
+    }
+
+    // Out-of-core multiply or add of binary files; nothing is loaded
+    void stream(const BatchCommand& command) {
+        const char* usage = "stream multiply|add OUT A B [MB]";
+        if (command.args.size() != 5) {
+            expectArgs(command, 4, usage);
+        }
+        if (command.args[0] != "multiply" && command.args[0] != "add") {
+            fail(command, std::string("expected ") + usage);
+        }
+        OutOfCoreOptions options;
+        if (command.args.size() == 5) {
+            const int megabytes = parseNumber<int>(command, command.args[4]);
+            if (megabytes < 1) {
+                fail(command, "memory budget must be at least 1 MB");
+            }
+            options.memoryBudget = static_cast<std::size_t>(megabytes) << 20;
+        }
+        const int dtype = diskMatrixType(command.args[2]);
+        Stream visitor = {command, options};
+        if (!visitMatrixType(dtype, visitor)) {
+            fail(command, command.args[2] + ": unsupported element type");
+        }
+    }
+
+    void binary(const BatchCommand& command, bool multiply) {
+        expectArgs(command, 3, multiply ? "multiply DEST A B" : "add DEST A B");
+        BatchMatrix* a = &find(command, command.args[1]);
+        BatchMatrix* b = &find(command, command.args[2]);
+        // An integer operand narrower than the other is widened to its type,
+        // so that integer products (which widen) combine with their inputs
+        BatchMatrix promoted;
+        if (a->dataType != b->dataType) {
+            const int aBytes = matrixIntegerBytes(a->dataType);
+            const int bBytes = matrixIntegerBytes(b->dataType);
+            if (aBytes == 0 || bBytes == 0) {
+                fail(command, "matrices have different element types");
+            }
+            BatchMatrix*& narrow = aBytes < bBytes ? a : b;
+            const int wideType = aBytes < bBytes ? b->dataType : a->dataType;
+            Convert convert = {*narrow, wideType, promoted};
+            visitMatrixType(narrow->dataType, convert);
+            narrow = &promoted;
+        }
+        // Built aside first, since DEST may also be an operand
+        BatchMatrix dest;
+        Combine visitor = {*this, *a, *b, multiply, dest};
+        visitMatrixType(a->dataType, visitor);
+        matrices[command.args[0]] = std::move(dest);
+    }
+
+    template <typename T>
+    void swapIn(const BatchCommand& command, Matrix<T>& matrix) {
+        const std::string& what = command.args[1];
+        int i = parseNumber<int>(command, command.args[2]);
+        int j = parseNumber<int>(command, command.args[3]);
+        bool ok;
+        if (what == "rows") {
+            ok = matrix.swapRows(i, j);
+        } else if (what == "cols") {
+            ok = matrix.swapColumns(i, j);
+        } else {
+            fail(command, "expected rows or cols, got '" + what + "'");
+            return;
+        }
+        if (!ok) {
+            fail(command, "invalid " + what.substr(0, what.size() - 1) + " indices");
+        }
+    }
+
+    template <typename T>
+    void updateIn(const BatchCommand& command, Matrix<T>& matrix) {
+        int row = parseNumber<int>(command, command.args[1]);
+        int col = parseNumber<int>(command, command.args[2]);
+        T value = parseNumber<T>(command, command.args[3]);
+        if (!matrix.updateElement(row, col, value)) {
+            fail(command, "invalid indices");
+        }
+    }
+
+    template <typename T>
+    void printDiagonals(const std::string& name, const Matrix<T>& matrix) {
+        typedef typename Matrix<T>::Accumulator Sum;
+        std::pair<Sum, Sum> sums = matrix.sumDiagonals();
+        std::ostringstream line;
+        line << std::setprecision(std::numeric_limits<Sum>::max_digits10);
+        line << name << " " << sums.first << " " << sums.second << "\n";
+        *out << line.str();
+    }
+
+    // save, swap, update, diag and print on a matrix of element type T
+    template <typename T>
+    void executeOn(const BatchCommand& command, BatchMatrix& m) {
+        Matrix<T>& matrix = batchMatrixData<T>(m);
+        if (command.name == "save") {
+            saveAs<T>(m, command.args[1]);
+        } else if (command.name == "swap") {
+            swapIn(command, matrix);
+        } else if (command.name == "update") {
+            updateIn(command, matrix);
+        } else if (command.name == "diag") {
+            printDiagonals(command.args[0], matrix);
+        } else if (command.args.size() == 2) {
+            writeMatrixFile(command.args[1], matrix);
+        } else {
+            *out << matrix;
+        }
+    }
+
+    void executeOn(const BatchCommand& command) {
+        MatrixCommand visitor = {*this, command, find(command, command.args[0])};
+        visitMatrixType(visitor.m.dataType, visitor);
+    }
+
+public:
+    explicit BatchSession(std::ostream& output) : out(&output), cluster(nullptr) {}
+
+    // Send the output of later commands to output instead
+    void setOutput(std::ostream& output) {
+        out = &output;
+    }
+
+    // Run multiply on the workers of a cluster (null for this process)
+    void useCluster(MatrixCluster* workers) {
+        cluster = workers;
+    }
+
+    // Run one command, throwing BatchError (or the error of the failing
+    // operation) if it cannot be completed
+    void execute(const BatchCommand& command) {
+        try {
+            if (command.name == "load") {
+                load(command);
+            } else if (command.name == "save") {
+                expectArgs(command, 2, "save NAME PATH");
+                executeOn(command);
+            } else if (command.name == "add") {
+                binary(command, false);
+            } else if (command.name == "multiply") {
+                binary(command, true);
+            } else if (command.name == "stream") {
+                stream(command);
+            } else if (command.name == "swap") {
+                expectArgs(command, 4, "swap NAME rows|cols I J");
+                executeOn(command);
+            } else if (command.name == "update") {
+                expectArgs(command, 4, "update NAME ROW COL VALUE");
+                executeOn(command);
+            } else if (command.name == "diag") {
+                expectArgs(command, 1, "diag NAME");
+                executeOn(command);
+            } else if (command.name == "print") {
+                if (command.args.size() != 2) {
+                    expectArgs(command, 1, "print NAME [PATH]");
+                }
+                executeOn(command);
+            } else {
+                fail(command, "unknown command");
+            }
+        } catch (const BatchError&) {
+            throw;
+        } catch (const std::exception& e) {
+            fail(command, e.what());
+        }
+    }
+
+    // Run commands in order, stopping at the first error
+    void run(const std::vector<BatchCommand>& commands) {
+        for (std::size_t i = 0; i < commands.size(); i++) {
+            execute(commands[i]);
+        }
+    }
+
+    bool has(const std::string& name) const {
+        return matrices.count(name) != 0;
+    }
+
+    // The matrix called name, or null
+    BatchMatrix* lookup(const std::string& name) {
+        std::map<std::string, BatchMatrix>::iterator it = matrices.find(name);
+        return it == matrices.end() ? nullptr : &it->second;
+    }
+
+    void store(const std::string& name, BatchMatrix matrix) {
+        matrices[name] = std::move(matrix);
+    }
+};
+
+#endif // MATRIX_BATCH_H
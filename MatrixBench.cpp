@@ -0,0 +1,502 @@
+// Benchmark suite for the Matrix<T> operations
+// Times operator+, operator*, a * b.transposed(), transpose, sumDiagonals,
+// swapRows, swapColumns, text parsing and printing for int and double (float
+// with --type float|all) over a range of sizes, and updates followed by a
+// query of cached aggregates and of a CachedProduct. Every case
+// runs a few warmup samples and then a fixed number of timed samples; a
+// sample repeats the operation until it takes at least --min-sample seconds,
+// so nanosecond operations such as swapRows are still measured accurately.
+// The batch ops multiply BENCH_BATCH independent small matrices per call:
+// with batchMultiply (BatchedGemm.h), with a loop of Matrix<T> products and
+// with a loop of FixedMatrix<T, N> products (FixedMatrix.h), at N = 2, 4, 8
+// and 16.
+// Reports median, p99 and min time per call, GFLOP/s and GB/s, as a table
+// and optionally as JSON (--json FILE) for tracking regressions.
+//
+// Usage: matrix_bench [--sizes N,N,...] [--type int|double|float|both|all] [--ops op,op,...]
+//                     [--warmup N] [--reps N] [--min-sample SECONDS]
+//                     [--json FILE] [--threads N] [--quick]
+//
+// ops: add, multiply, multiplyt, transpose, diag, diagtrack, swaprows, swapcols, prodtrack, parse, print,
+//      batchmul, batchloop, fixedmul
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "BatchedGemm.h"
+#include "CachedProduct.h"
+#include "FixedMatrix.h"
+#include "Matrix.h"
+#include "MatrixLoader.h"
+
+#ifndef MATRIX_BUILD_PROFILE
+#define MATRIX_BUILD_PROFILE "unknown"
+#endif
+
+// Matrices per call in the batch ops
+const int BENCH_BATCH = 4096;
+
+struct BenchOptions {
+    std::vector<int> sizes;
+    std::vector<std::string> ops;
+    std::string type;
+    int warmup;
+    int reps;
+    double minSample;  // seconds per timed sample
+    std::string jsonPath;
+};
+
+// Timing of one (operation, type, size) case. Times are seconds per call.
+struct BenchResult {
+    std::string op;
+    std::string type;
+    int size;
+    long callsPerSample;
+    int samples;
+    double median;
+    double p99;
+    double min;
+    double mean;
+    double flops;  // floating-point (or integer) operations per call
+    double bytes;  // bytes read and written per call
+};
+
+// Nearest-rank percentile of sorted samples
+double percentile(const std::vector<double>& sorted, double p) {
+    std::size_t rank = static_cast<std::size_t>(p / 100.0 * sorted.size() + 0.999999);
+    rank = std::max<std::size_t>(1, std::min(rank, sorted.size()));
+    return sorted[rank - 1];
+}
+
+// Time fn: pick how many calls make up a sample, run the warmup samples and
+// then the timed ones
+template <typename Fn>
+BenchResult measure(Fn fn, const BenchOptions& options) {
+    typedef std::chrono::steady_clock Clock;
+    long calls = 1;
+    for (;;) {
+        Clock::time_point start = Clock::now();
+        for (long c = 0; c < calls; c++) {
+            fn();
+        }
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (elapsed >= options.minSample || calls >= (1L << 30)) {
+            break;
+        }
+        calls = elapsed > 0 ? std::max(calls * 2, static_cast<long>(calls * options.minSample / elapsed * 1.2))
+                            : calls * 16;
+    }
+
+    std::vector<double> samples;
+    for (int s = 0; s < options.warmup + options.reps; s++) {
+        Clock::time_point start = Clock::now();
+        for (long c = 0; c < calls; c++) {
+            fn();
+        }
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (s >= options.warmup) {
+            samples.push_back(elapsed / calls);
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+
+    BenchResult result;
+    result.callsPerSample = calls;
+    result.samples = static_cast<int>(samples.size());
+    result.median = percentile(samples, 50.0);
+    result.p99 = percentile(samples, 99.0);
+    result.min = samples.front();
+    double total = 0.0;
+    for (std::size_t i = 0; i < samples.size(); i++) {
+        total += samples[i];
+    }
+    result.mean = total / samples.size();
+    result.flops = 0.0;
+    result.bytes = 0.0;
+    return result;
+}
+
+template <typename T>
+void fillMatrix(Matrix<T>& m, int seed) {
+    const int n = m.getRows();
+    for (int i = 0; i < n; i++) {
+        T* row = m.rowPtr(i);
+        for (int j = 0; j < n; j++) {
+            row[j] = static_cast<T>((i * 7 + j * 3 + seed) % 23 - 11);
+        }
+    }
+}
+
+// n x n values in the text format body (what parseMatrixDataFromString reads)
+template <typename T>
+std::string matrixText(int n) {
+    std::ostringstream text;
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            if (std::is_integral<T>::value) {
+                text << (i * 7 + j * 3) % 23 - 11;
+            } else {
+                text << ((i * 7 + j * 3) % 23 - 11) * 0.25;
+            }
+            text << (j + 1 < n ? ' ' : '\n');
+        }
+    }
+    return text.str();
+}
+
+bool wants(const BenchOptions& options, const std::string& op) {
+    return std::find(options.ops.begin(), options.ops.end(), op) != options.ops.end();
+}
+
+// Print a finished case and add it to results
+void record(BenchResult& r, const char* typeName, int n, std::vector<BenchResult>& results) {
+    r.type = typeName;
+    r.size = n;
+    std::cout << std::left << std::setw(10) << r.op << std::setw(8) << r.type << std::right
+              << std::setw(6) << r.size
+              << std::scientific << std::setprecision(3)
+              << std::setw(12) << r.median << std::setw(12) << r.p99 << std::setw(12) << r.min
+              << std::fixed << std::setprecision(2)
+              << std::setw(10) << (r.flops > 0 ? r.flops / r.median * 1e-9 : 0.0)
+              << std::setw(10) << (r.bytes > 0 ? r.bytes / r.median * 1e-9 : 0.0) << std::endl;
+    results.push_back(r);
+}
+
+template <typename T>
+void benchType(const char* typeName, const BenchOptions& options, std::vector<BenchResult>& results) {
+    const double elem = sizeof(T);
+    for (std::size_t s = 0; s < options.sizes.size(); s++) {
+        const int n = options.sizes[s];
+        const double nn = static_cast<double>(n) * n;
+        Matrix<T> a(n), b(n);
+        fillMatrix(a, 0);
+        fillMatrix(b, 5);
+        volatile T sink = T();
+        std::vector<BenchResult> cases;
+
+        if (wants(options, "add")) {
+            BenchResult r = measure([&]() {
+                Matrix<T> c = a + b;
+                sink = c(n - 1, n - 1);
+            }, options);
+            r.op = "add";
+            r.flops = nn;
+            r.bytes = 3 * nn * elem;
+            cases.push_back(r);
+        }
+        if (wants(options, "multiply")) {
+            BenchResult r = measure([&]() {
+                Matrix<T> c = a * b;
+                sink = c(n - 1, n - 1);
+            }, options);
+            r.op = "multiply";
+            r.flops = 2.0 * nn * n;
+            r.bytes = 3 * nn * elem;  // compulsory traffic: read A and B, write C
+            cases.push_back(r);
+        }
+        if (wants(options, "multiplyt")) {
+            Matrix<T> c(n);
+            BenchResult r = measure([&]() {
+                multiplyInto(c, a, b.transposed());
+                sink = c(n - 1, n - 1);
+            }, options);
+            r.op = "multiplyt";
+            r.flops = 2.0 * nn * n;
+            r.bytes = 3 * nn * elem;
+            cases.push_back(r);
+        }
+        if (wants(options, "transpose")) {
+            BenchResult r = measure([&]() {
+                Matrix<T> t = a.transposed();
+                sink = t(n - 1, 0);
+            }, options);
+            r.op = "transpose";
+            r.bytes = 2 * nn * elem;
+            cases.push_back(r);
+        }
+        if (wants(options, "diag")) {
+            BenchResult r = measure([&]() {
+                std::pair<T, T> sums = a.sumDiagonals();
+                sink = sums.first + sums.second;
+            }, options);
+            r.op = "diag";
+            r.flops = 2.0 * n;
+            r.bytes = 2.0 * n * elem;
+            cases.push_back(r);
+        }
+        if (wants(options, "diagtrack")) {
+            Matrix<T> tracked = a;
+            tracked.enableAggregates();
+            const Matrix<T>& view = tracked;
+            long step = 0;
+            BenchResult r = measure([&]() {
+                const int k = static_cast<int>(step % n);
+                tracked.updateElement(k, k, T(step++ % 7));
+                std::pair<T, T> sums = view.sumDiagonals();
+                sink = sums.first + sums.second;
+            }, options);
+            r.op = "diagtrack";
+            cases.push_back(r);
+        }
+        if (wants(options, "swaprows")) {
+            BenchResult r = measure([&]() {
+                a.swapRows(0, n - 1);
+            }, options);
+            r.op = "swaprows";
+            cases.push_back(r);
+        }
+        if (wants(options, "swapcols")) {
+            BenchResult r = measure([&]() {
+                a.swapColumns(0, n - 1);
+            }, options);
+            r.op = "swapcols";
+            r.bytes = 4.0 * n * elem;
+            cases.push_back(r);
+        }
+        if (wants(options, "prodtrack")) {
+            CachedProduct<T> product(a, b);
+            long step = 0;
+            BenchResult r = measure([&]() {
+                const int k = static_cast<int>(step % n);
+                product.updateLeft(k, n - 1 - k, T(step++ % 7));
+                sink = product.product()(k, k);
+            }, options);
+            r.op = "prodtrack";
+            r.flops = 2.0 * n;
+            r.bytes = 3.0 * n * elem;
+            cases.push_back(r);
+        }
+        if (wants(options, "parse")) {
+            const std::string text = matrixText<T>(n);
+            Matrix<T> parsed(n);
+            BenchResult r = measure([&]() {
+                TextScanner scanner(text.data(), text.size());
+                parseMatrixValues(scanner, parsed, n);
+                sink = parsed(n - 1, n - 1);
+            }, options);
+            r.op = "parse";
+            r.bytes = static_cast<double>(text.size()) + nn * elem;
+            cases.push_back(r);
+        }
+        if (wants(options, "print")) {
+            std::ostringstream out;
+            out << a;
+            const double textBytes = static_cast<double>(out.str().size());
+            BenchResult r = measure([&]() {
+                out.str(std::string());
+                out << a;
+            }, options);
+            r.op = "print";
+            r.bytes = textBytes + nn * elem;
+            cases.push_back(r);
+        }
+
+        for (std::size_t c = 0; c < cases.size(); c++) {
+            record(cases[c], typeName, n, results);
+        }
+        (void)sink;
+    }
+}
+
+// Batched and looped multiplies of BENCH_BATCH N x N matrices
+template <typename T, int N>
+void benchBatch(const char* typeName, const BenchOptions& options, std::vector<BenchResult>& results) {
+    const double flops = 2.0 * N * N * N * BENCH_BATCH;
+    const double bytes = 3.0 * N * N * sizeof(T) * BENCH_BATCH;
+    volatile T sink = T();
+
+    if (wants(options, "batchmul")) {
+        SmallMatrixBatch<T, N> a(BENCH_BATCH), b(BENCH_BATCH), c;
+        Matrix<T> m(N);
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            fillMatrix(m, i);
+            a.set(i, m);
+            fillMatrix(m, i + 5);
+            b.set(i, m);
+        }
+        BenchResult r = measure([&]() {
+            batchMultiply(a, b, c);
+            sink = c(BENCH_BATCH - 1, N - 1, N - 1);
+        }, options);
+        r.op = "batchmul";
+        r.flops = flops;
+        r.bytes = bytes;
+        record(r, typeName, N, results);
+    }
+    if (wants(options, "batchloop")) {
+        std::vector<Matrix<T>> a, b, c(BENCH_BATCH);
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            a.push_back(Matrix<T>(N));
+            fillMatrix(a.back(), i);
+            b.push_back(Matrix<T>(N));
+            fillMatrix(b.back(), i + 5);
+        }
+        BenchResult r = measure([&]() {
+            for (int i = 0; i < BENCH_BATCH; i++) {
+                c[i] = a[i] * b[i];
+            }
+            sink = c[BENCH_BATCH - 1](N - 1, N - 1);
+        }, options);
+        r.op = "batchloop";
+        r.flops = flops;
+        r.bytes = bytes;
+        record(r, typeName, N, results);
+    }
+    if (wants(options, "fixedmul")) {
+        std::vector<FixedMatrix<T, N>> a, b, c(BENCH_BATCH);
+        Matrix<T> m(N);
+        for (int i = 0; i < BENCH_BATCH; i++) {
+            fillMatrix(m, i);
+            a.push_back(FixedMatrix<T, N>(m));
+            fillMatrix(m, i + 5);
+            b.push_back(FixedMatrix<T, N>(m));
+        }
+        BenchResult r = measure([&]() {
+            for (int i = 0; i < BENCH_BATCH; i++) {
+                c[i] = a[i] * b[i];
+            }
+            sink = c[BENCH_BATCH - 1](N - 1, N - 1);
+        }, options);
+        r.op = "fixedmul";
+        r.flops = flops;
+        r.bytes = bytes;
+        record(r, typeName, N, results);
+    }
+    (void)sink;
+}
+
+template <typename T>
+void benchBatchSizes(const char* typeName, const BenchOptions& options, std::vector<BenchResult>& results) {
+    benchBatch<T, 2>(typeName, options, results);
+    benchBatch<T, 4>(typeName, options, results);
+    benchBatch<T, 8>(typeName, options, results);
+    benchBatch<T, 16>(typeName, options, results);
+}
+
+void writeJson(std::ostream& out, const BenchOptions& options, const std::vector<BenchResult>& results) {
+    char stamp[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    out << std::setprecision(9);
+    out << "{\n";
+    out << "  \"timestamp\": \"" << stamp << "\",\n";
+    out << "  \"compiler\": \"" << __VERSION__ << "\",\n";
+    out << "  \"profile\": \"" << MATRIX_BUILD_PROFILE << "\",\n";
+    out << "  \"threads\": " << ThreadPool::instance().threadCount() << ",\n";
+    out << "  \"simd\": \"" << simdLevelName(activeSimdLevel()) << "\",\n";
+    out << "  \"warmup\": " << options.warmup << ",\n";
+    out << "  \"reps\": " << options.reps << ",\n";
+    out << "  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "    {\"op\": \"" << r.op << "\", \"type\": \"" << r.type << "\", \"n\": " << r.size
+            << ", \"calls_per_sample\": " << r.callsPerSample << ", \"samples\": " << r.samples
+            << ", \"median_s\": " << r.median << ", \"p99_s\": " << r.p99
+            << ", \"min_s\": " << r.min << ", \"mean_s\": " << r.mean
+            << ", \"gflops\": " << (r.flops > 0 ? r.flops / r.median * 1e-9 : 0.0)
+            << ", \"gbps\": " << (r.bytes > 0 ? r.bytes / r.median * 1e-9 : 0.0) << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+// Split "a,b,c" into its parts
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> parts;
+    std::stringstream in(text);
+    std::string part;
+    while (std::getline(in, part, ',')) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    options.sizes = {16, 64, 256, 1024};
+    options.ops = {"add", "multiply", "multiplyt", "transpose", "diag", "diagtrack", "swaprows", "swapcols", "prodtrack", "parse", "print", "batchmul", "batchloop", "fixedmul"};
+    options.type = "both";
+    options.warmup = 3;
+    options.reps = 30;
+    options.minSample = 0.002;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--sizes" && i + 1 < argc) {
+            std::vector<std::string> parts = splitList(argv[++i]);
+            options.sizes.clear();
+            for (std::size_t p = 0; p < parts.size(); p++) {
+                options.sizes.push_back(std::max(2, std::atoi(parts[p].c_str())));
+            }
+        } else if (arg == "--ops" && i + 1 < argc) {
+            options.ops = splitList(argv[++i]);
+        } else if (arg == "--type" && i + 1 < argc) {
+            options.type = argv[++i];
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            options.warmup = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--reps" && i + 1 < argc) {
+            options.reps = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--min-sample" && i + 1 < argc) {
+            options.minSample = std::atof(argv[++i]);
+        } else if (arg == "--json" && i + 1 < argc) {
+            options.jsonPath = argv[++i];
+        } else if (arg == "--threads" && i + 1 < argc) {
+            ThreadPool::setThreadCount(std::atoi(argv[++i]));
+        } else if (arg == "--quick") {
+            // Short run, used as the PGO training workload
+            options.sizes = {16, 128, 512};
+            options.warmup = 1;
+            options.reps = 5;
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--sizes N,N,...] [--type int|double|float|both|all] [--ops op,op,...]"
+                      << " [--warmup N] [--reps N] [--min-sample SECONDS] [--json FILE] [--threads N] [--quick]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "threads: " << ThreadPool::instance().threadCount()
+              << ", simd: " << simdLevelName(activeSimdLevel())
+              << ", profile: " << MATRIX_BUILD_PROFILE << std::endl;
+    std::cout << std::left << std::setw(10) << "op" << std::setw(8) << "type" << std::right
+              << std::setw(6) << "N" << std::setw(12) << "median s" << std::setw(12) << "p99 s"
+              << std::setw(12) << "min s" << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s"
+              << std::endl;
+
+    std::vector<BenchResult> results;
+    if (options.type == "int" || options.type == "both" || options.type == "all") {
+        benchType<int>("int", options, results);
+        benchBatchSizes<int>("int", options, results);
+    }
+    if (options.type == "double" || options.type == "both" || options.type == "all") {
+        benchType<double>("double", options, results);
+        benchBatchSizes<double>("double", options, results);
+    }
+    if (options.type == "float" || options.type == "all") {
+        benchType<float>("float", options, results);
+        benchBatchSizes<float>("float", options, results);
+    }
+
+    if (!options.jsonPath.empty()) {
+        std::ofstream json(options.jsonPath.c_str());
+        if (!json) {
+            std::cerr << "Error: Could not open file " << options.jsonPath << " for writing" << std::endl;
+            return 1;
+        }
+        writeJson(json, options, results);
+    }
+    return 0;
+}
@@ -0,0 +1,337 @@
+// Versioned binary matrix format with zero-copy memory-mapped loading
+//
+// Layout: a 128-byte header, zero padding up to dataOffset (one page), then
+// rows of `stride` elements each, of which the first `cols` are data and the
+// rest zero padding. Rows use the same padded stride as Matrix<T>, so a
+// mapped file can back a Matrix<T> directly without copying.
+//
+// The header records dims, dtype, element size, a byte-order tag, payload
+// alignment, a payload checksum and a checksum of the header itself.
+
+#ifndef MATRIX_BINARY_H
+#define MATRIX_BINARY_H
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Matrix.h"
+#include "MatrixTypes.h"
+
+const char MATRIX_BINARY_MAGIC[8] = {'M', 'T', 'X', 'B', 'I', 'N', '\r', '\n'};
+const std::uint32_t MATRIX_BINARY_VERSION = 1;
+const std::uint32_t MATRIX_BINARY_ENDIAN_TAG = 0x01020304;
+const std::uint64_t MATRIX_BINARY_DATA_OFFSET = 4096;
+
+struct MatrixBinaryHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t endianTag;      // MATRIX_BINARY_ENDIAN_TAG in the writer's byte order
+    std::uint32_t dtype;          // MatrixDtype<T>::code (MatrixTypes.h)
+    std::uint32_t elementSize;    // sizeof(T)
+    std::uint64_t rows;
+    std::uint64_t cols;
+    std::uint64_t stride;         // elements per stored row
+    std::uint64_t alignment;      // byte alignment of the payload and of each row
+    std::uint64_t dataOffset;     // byte offset of the first row
+    std::uint64_t dataBytes;      // rows * stride * elementSize
+    std::uint64_t checksum;       // matrixChecksum of the payload
+    std::uint64_t headerChecksum; // matrixChecksum of the bytes before this field
+    std::uint8_t reserved[40];
+};
+
+static_assert(sizeof(MatrixBinaryHeader) == 128, "binary matrix header must be 128 bytes");
+
+// FNV-1a style hash over little-endian 64-bit words (and a byte tail), fast
+// enough to run over multi-GB payloads. The value only depends on the bytes,
+// not on the byte order of the machine computing it.
+inline std::uint64_t matrixChecksum(const void* data, std::size_t bytes,
+                                    std::uint64_t hash = 0xcbf29ce484222325ULL) {
+    const std::uint64_t prime = 0x100000001b3ULL;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    std::size_t words = bytes / 8;
+    for (std::size_t i = 0; i < words; i++) {
+        std::uint64_t w;
+        std::memcpy(&w, p + i * 8, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        w = __builtin_bswap64(w);
+#endif
+        hash = (hash ^ w) * prime;
+    }
+    for (std::size_t i = words * 8; i < bytes; i++) {
+        hash = (hash ^ p[i]) * prime;
+    }
+    return hash;
+}
+
+inline std::uint64_t matrixHeaderChecksum(const MatrixBinaryHeader& header) {
+    return matrixChecksum(&header, offsetof(MatrixBinaryHeader, headerChecksum));
+}
+
+// Bring a header written on a machine of the other byte order into ours
+inline void byteSwapHeader(MatrixBinaryHeader& h) {
+    h.version = __builtin_bswap32(h.version);
+    h.endianTag = __builtin_bswap32(h.endianTag);
+    h.dtype = __builtin_bswap32(h.dtype);
+    h.elementSize = __builtin_bswap32(h.elementSize);
+    h.rows = __builtin_bswap64(h.rows);
+    h.cols = __builtin_bswap64(h.cols);
+    h.stride = __builtin_bswap64(h.stride);
+    h.alignment = __builtin_bswap64(h.alignment);
+    h.dataOffset = __builtin_bswap64(h.dataOffset);
+    h.dataBytes = __builtin_bswap64(h.dataBytes);
+    h.checksum = __builtin_bswap64(h.checksum);
+    h.headerChecksum = __builtin_bswap64(h.headerChecksum);
+}
+
+// Header for a rows x cols matrix of T; the checksum fields are left zero
+template <typename T>
+MatrixBinaryHeader makeMatrixBinaryHeader(std::uint64_t rows, std::uint64_t cols, std::uint64_t stride) {
+    MatrixBinaryHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MATRIX_BINARY_MAGIC, sizeof(header.magic));
+    header.version = MATRIX_BINARY_VERSION;
+    header.endianTag = MATRIX_BINARY_ENDIAN_TAG;
+    header.dtype = MatrixDtype<T>::code;
+    header.elementSize = sizeof(T);
+    header.rows = rows;
+    header.cols = cols;
+    header.stride = stride;
+    header.alignment = MATRIX_CACHE_LINE;
+    header.dataOffset = MATRIX_BINARY_DATA_OFFSET;
+    header.dataBytes = rows * stride * sizeof(T);
+    return header;
+}
+
+// Write matrix in the binary format
+template <typename T>
+void writeMatrixBinary(std::ostream& out, const Matrix<T>& matrix) {
+    const int n = matrix.getRows();
+    const std::size_t stride = matrix.getStride();
+    const std::size_t rowBytes = stride * sizeof(T);
+
+    // Rows are written in logical order, so hash them in that order first
+    std::uint64_t checksum = matrixChecksum(nullptr, 0);
+    for (int i = 0; i < n; i++) {
+        checksum = matrixChecksum(matrix.rowPtr(i), rowBytes, checksum);
+    }
+
+    MatrixBinaryHeader header = makeMatrixBinaryHeader<T>(n, matrix.getCols(), stride);
+    header.checksum = checksum;
+    header.headerChecksum = matrixHeaderChecksum(header);
+
+    std::vector<char> padding(MATRIX_BINARY_DATA_OFFSET - sizeof(header), 0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(padding.data(), padding.size());
+    for (int i = 0; i < n; i++) {
+        out.write(reinterpret_cast<const char*>(matrix.rowPtr(i)), rowBytes);
+    }
+    if (!out) {
+        throw std::runtime_error("Failed to write binary matrix");
+    }
+}
+
+// The file is replaced whole (MatrixFileReplacement), never rewritten in
+// place, so a matrix mapped from it (mapMatrixBinary) stays valid
+template <typename T>
+void writeMatrixBinary(const std::string& filename, const Matrix<T>& matrix) {
+    MatrixFileReplacement file(filename);
+    {
+        std::ofstream out(file.path().c_str(), std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) {
+            throw std::runtime_error("Could not open file " + filename + " for writing");
+        }
+        writeMatrixBinary(out, matrix);
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Failed to write " + filename);
+        }
+    }
+    file.commit();
+}
+
+// a * b into product; false if it does not fit in 64 bits
+inline bool matrixCheckedMultiply(std::uint64_t a, std::uint64_t b, std::uint64_t& product) {
+    if (a != 0 && b > UINT64_MAX / a) {
+        return false;
+    }
+    product = a * b;
+    return true;
+}
+
+// Validate the stored header bytes of a file of fileLength bytes and decode
+// them into header. Returns true if the file uses the other byte order.
+inline bool parseMatrixBinaryHeader(const void* stored, std::uint64_t fileLength,
+                                    const std::string& filename, MatrixBinaryHeader& header) {
+    bool swapped = false;
+    std::memcpy(&header, stored, sizeof(header));
+    if (std::memcmp(header.magic, MATRIX_BINARY_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error(filename + ": not a binary matrix file");
+    }
+    if (header.endianTag != MATRIX_BINARY_ENDIAN_TAG) {
+        byteSwapHeader(header);
+        swapped = true;
+        if (header.endianTag != MATRIX_BINARY_ENDIAN_TAG) {
+            throw std::runtime_error(filename + ": unrecognized byte order");
+        }
+    }
+    if (header.version != MATRIX_BINARY_VERSION) {
+        throw std::runtime_error(filename + ": unsupported binary matrix version");
+    }
+    // Checksums are over the bytes as stored in the file
+    if (header.headerChecksum != matrixChecksum(stored, offsetof(MatrixBinaryHeader, headerChecksum))) {
+        throw std::runtime_error(filename + ": header checksum mismatch");
+    }
+    // Dimensions become int and the payload size must not wrap, since the
+    // checksums do not protect against a header written with bad values
+    if (header.rows > static_cast<std::uint64_t>(INT_MAX) || header.cols > static_cast<std::uint64_t>(INT_MAX) ||
+        header.stride > static_cast<std::uint64_t>(INT_MAX)) {
+        throw std::runtime_error(filename + ": matrix dimensions are too large");
+    }
+    std::uint64_t elements = 0;
+    std::uint64_t payload = 0;
+    if (!matrixCheckedMultiply(header.rows, header.stride, elements) ||
+        !matrixCheckedMultiply(elements, header.elementSize, payload)) {
+        throw std::runtime_error(filename + ": matrix dimensions are too large");
+    }
+    if (header.stride < header.cols || header.dataOffset < sizeof(header) || header.dataBytes != payload ||
+        header.dataOffset > fileLength || header.dataBytes > fileLength - header.dataOffset) {
+        throw std::runtime_error(filename + ": truncated or inconsistent binary matrix");
+    }
+    return swapped;
+}
+
+// Private mapping of a binary matrix file, shared by the matrices that view it
+class MatrixBinaryMapping {
+private:
+    void* ptr;
+    std::size_t length;
+    MatrixBinaryHeader header;
+    bool swapped;
+
+public:
+    explicit MatrixBinaryMapping(const std::string& filename)
+        : ptr(nullptr), length(0), swapped(false) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open file " + filename);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(header)) {
+            ::close(fd);
+            throw std::runtime_error(filename + ": not a binary matrix file");
+        }
+        length = static_cast<std::size_t>(info.st_size);
+        // Copy-on-write: the matrix may be modified, the file never is
+        ptr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (ptr == MAP_FAILED) {
+            ptr = nullptr;
+            throw std::runtime_error("Could not map file " + filename);
+        }
+
+        try {
+            swapped = parseMatrixBinaryHeader(ptr, length, filename, header);
+        } catch (...) {
+            ::munmap(ptr, length);
+            throw;
+        }
+    }
+
+    ~MatrixBinaryMapping() {
+        if (ptr) {
+            ::munmap(ptr, length);
+        }
+    }
+
+    MatrixBinaryMapping(const MatrixBinaryMapping&) = delete;
+    MatrixBinaryMapping& operator=(const MatrixBinaryMapping&) = delete;
+
+    const MatrixBinaryHeader& info() const { return header; }
+    bool isByteSwapped() const { return swapped; }
+    char* payload() const { return static_cast<char*>(ptr) + header.dataOffset; }
+
+    bool verifyChecksum() const {
+        return matrixChecksum(payload(), header.dataBytes) == header.checksum;
+    }
+
+    template <typename T>
+    void checkType(const std::string& filename) const {
+        if (header.dtype != MatrixDtype<T>::code || header.elementSize != sizeof(T)) {
+            throw std::runtime_error(filename + ": element type does not match");
+        }
+    }
+};
+
+// Map a binary matrix file as the storage of a Matrix<T> without copying.
+// The mapping is private, so changes to the matrix never reach the file.
+// Files written with the other byte order cannot be viewed in place; use
+// readMatrixBinary for those.
+template <typename T>
+Matrix<T> mapMatrixBinary(const std::string& filename, bool verifyChecksum = false) {
+    std::shared_ptr<MatrixBinaryMapping> mapping = std::make_shared<MatrixBinaryMapping>(filename);
+    const MatrixBinaryHeader& header = mapping->info();
+    mapping->checkType<T>(filename);
+    if (mapping->isByteSwapped()) {
+        throw std::runtime_error(filename + ": byte order differs from this machine, cannot map in place");
+    }
+    if (verifyChecksum && !mapping->verifyChecksum()) {
+        throw std::runtime_error(filename + ": payload checksum mismatch");
+    }
+
+    T* data = reinterpret_cast<T*>(mapping->payload());
+    std::size_t count = header.rows * header.stride;
+    AlignedBuffer<T> storage(data, count, mapping);
+    return Matrix<T>(std::move(storage), static_cast<int>(header.rows), static_cast<int>(header.cols),
+                     static_cast<int>(header.stride));
+}
+
+// Read a binary matrix file into an owned Matrix<T>, converting byte order
+// if needed and always verifying the payload checksum
+template <typename T>
+Matrix<T> readMatrixBinary(const std::string& filename) {
+    MatrixBinaryMapping mapping(filename);
+    const MatrixBinaryHeader& header = mapping.info();
+    mapping.checkType<T>(filename);
+    if (!mapping.verifyChecksum()) {
+        throw std::runtime_error(filename + ": payload checksum mismatch");
+    }
+
+    const int n = static_cast<int>(header.rows);
+    const int m = static_cast<int>(header.cols);
+    Matrix<T> matrix(n, m);
+    for (int i = 0; i < n; i++) {
+        const char* src = mapping.payload() + static_cast<std::size_t>(i) * header.stride * sizeof(T);
+        T* dst = matrix.rowPtr(i);
+        std::memcpy(dst, src, m * sizeof(T));
+        if (mapping.isByteSwapped()) {
+            char* bytes = reinterpret_cast<char*>(dst);
+            for (int j = 0; j < m; j++) {
+                std::reverse(bytes + j * sizeof(T), bytes + (j + 1) * sizeof(T));
+            }
+        }
+    }
+    return matrix;
+}
+
+// True if the file starts with the binary matrix magic
+inline bool isMatrixBinaryFile(const std::string& filename) {
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    char magic[sizeof(MATRIX_BINARY_MAGIC)];
+    return in.read(magic, sizeof(magic)) && std::memcmp(magic, MATRIX_BINARY_MAGIC, sizeof(magic)) == 0;
+}
+
+#endif // MATRIX_BINARY_H
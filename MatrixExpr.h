@@ -0,0 +1,324 @@
+// Lazy matrix expressions
+// operator+ and operator* on matrices return small expression objects instead
+// of matrices. The expression is evaluated when it is converted to a
+// Matrix<T>: every elementwise term is summed in one pass over the result
+// (one allocation, no intermediates), and every product term is added with a
+// GEMM accumulate, so A * B + C costs one multiply and no extra matrix.
+//
+// m.transposed() is a lazy view: as a product operand it is read in
+// transposed order by the GEMM packing, so a * b.transposed() never forms
+// b^T; elsewhere it is added with the cache-oblivious kernel in
+// MatrixTranspose.h. operator+= on a Matrix adds an expression in place, with
+// products accumulating straight into the destination.
+//
+// Expressions refer to their Matrix operands, so they must not outlive them:
+// evaluate them (e.g. Matrix<T> r = a * b + c;) rather than storing them.
+
+#ifndef MATRIX_EXPR_H
+#define MATRIX_EXPR_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Gemm.h"
+#include "MatrixStorage.h"
+#include "MatrixTranspose.h"
+#include "SimdKernels.h"
+#include "Strassen.h"
+
+template <typename T>
+class Matrix;
+
+// Elements of a row evaluated at a time, so the partial result of a long
+// elementwise chain stays in L1
+const int MATRIX_EXPR_CHUNK = 1024;
+
+// A Matrix operand inside an expression
+template <typename T>
+class MatrixLeaf {
+private:
+    const Matrix<T>& matrix;
+
+public:
+    typedef T ValueType;
+    static const bool hasElementwise = true;
+    static const bool hasProduct = false;
+
+    MatrixLeaf(const Matrix<T>& m) : matrix(m) {}
+
+    int getRows() const { return matrix.getRows(); }
+    int getCols() const { return matrix.getCols(); }
+
+    // Bytes of operands read when the expression is evaluated
+    std::uint64_t bytesRead() const {
+        return static_cast<std::uint64_t>(matrix.getRows()) * matrix.getCols() * sizeof(T);
+    }
+
+    // Pointer to the stored elements, when the node has any
+    const T* chunkPtr(int row, int col) const {
+        return matrix.rowPtr(row) + col;
+    }
+
+    void evalChunk(int row, int col, int len, T* out) const {
+        std::copy(chunkPtr(row, col), chunkPtr(row, col) + len, out);
+    }
+
+    void addChunk(int row, int col, int len, T* out) const {
+        simdKernels<T>().add(out, out, chunkPtr(row, col), len);
+    }
+
+    void accumulateProducts(const MatrixBlock<T>&) const {}
+
+    // Whether adding this term into target in place could read elements of
+    // target that have already been overwritten
+    bool conflictsWith(const Matrix<T>&) const { return false; }
+};
+
+// Transposed view of a matrix, added to the result with the cache-oblivious
+// transpose after the elementwise terms (it has no contiguous chunks)
+template <typename T>
+class MatrixTransposed {
+private:
+    const Matrix<T>& matrix;
+
+public:
+    typedef T ValueType;
+    static const bool hasElementwise = false;
+    static const bool hasProduct = false;
+
+    explicit MatrixTransposed(const Matrix<T>& m) : matrix(m) {}
+
+    int getRows() const { return matrix.getCols(); }
+    int getCols() const { return matrix.getRows(); }
+
+    // The matrix that is viewed transposed
+    const Matrix<T>& stored() const { return matrix; }
+
+    std::uint64_t bytesRead() const {
+        return static_cast<std::uint64_t>(matrix.getRows()) * matrix.getCols() * sizeof(T);
+    }
+
+    const T* chunkPtr(int, int) const { return nullptr; }
+    void evalChunk(int, int, int, T*) const {}
+    void addChunk(int, int, int, T*) const {}
+
+    void accumulateProducts(const MatrixBlock<T>& result) const {
+        transposeAdd(matrix.block(), result);
+    }
+
+    bool conflictsWith(const Matrix<T>& target) const { return &matrix == &target; }
+};
+
+// Product of an m x k and a k x n matrix, added to the result by
+// multiplyAccumulate (Strassen.h). Operands that are themselves expressions are evaluated
+// once, up front.
+template <typename T>
+class MatrixProduct {
+private:
+    const Matrix<T>* lhs;
+    const Matrix<T>* rhs;
+    bool lhsTransposed;  // the operand is a transposed view of *lhs
+    bool rhsTransposed;
+    std::shared_ptr<const Matrix<T>> heldLhs;  // set when lhs was evaluated here
+    std::shared_ptr<const Matrix<T>> heldRhs;
+
+    GemmOperand<T> left() const { return GemmOperand<T>(lhs->block(), lhsTransposed); }
+    GemmOperand<T> right() const { return GemmOperand<T>(rhs->block(), rhsTransposed); }
+
+public:
+    typedef T ValueType;
+    static const bool hasElementwise = false;
+    static const bool hasProduct = true;
+
+    MatrixProduct(const Matrix<T>* a, bool aTransposed, std::shared_ptr<const Matrix<T>> heldA,
+                  const Matrix<T>* b, bool bTransposed, std::shared_ptr<const Matrix<T>> heldB)
+        : lhs(a), rhs(b), lhsTransposed(aTransposed), rhsTransposed(bTransposed), heldLhs(heldA), heldRhs(heldB) {
+        if (left().cols() != right().rows()) {
+            throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+        }
+    }
+
+    int getRows() const { return left().rows(); }
+    int getCols() const { return right().cols(); }
+
+    std::uint64_t bytesRead() const {
+        return (static_cast<std::uint64_t>(lhs->getRows()) * lhs->getCols() +
+                static_cast<std::uint64_t>(rhs->getRows()) * rhs->getCols()) * sizeof(T);
+    }
+
+    const T* chunkPtr(int, int) const { return nullptr; }
+    void evalChunk(int, int, int, T*) const {}
+    void addChunk(int, int, int, T*) const {}
+
+    void accumulateProducts(const MatrixBlock<T>& result) const {
+        accumulate(result, T(1));
+    }
+
+    // result += alpha * product
+    void accumulate(const MatrixBlock<T>& result, T alpha) const {
+        multiplyAccumulate(left(), right(), result, alpha);
+    }
+
+    bool conflictsWith(const Matrix<T>& target) const { return lhs == &target || rhs == &target; }
+};
+
+// How an operand is held inside an expression: matrices by reference,
+// expression nodes by value
+template <typename E>
+struct MatrixExprNode {
+    typedef E Type;
+};
+
+template <typename T>
+struct MatrixExprNode<Matrix<T>> {
+    typedef MatrixLeaf<T> Type;
+};
+
+// Sum of two operands
+template <typename L, typename R>
+class MatrixSum {
+private:
+    typedef typename MatrixExprNode<L>::Type Left;
+    typedef typename MatrixExprNode<R>::Type Right;
+
+    Left left;
+    Right right;
+
+public:
+    typedef typename Left::ValueType ValueType;
+    static const bool hasElementwise = Left::hasElementwise || Right::hasElementwise;
+    static const bool hasProduct = Left::hasProduct || Right::hasProduct;
+
+    MatrixSum(const L& l, const R& r) : left(l), right(r) {
+        if (left.getRows() != right.getRows() || left.getCols() != right.getCols()) {
+            throw std::invalid_argument("Matrix dimensions do not match for addition");
+        }
+    }
+
+    int getRows() const { return left.getRows(); }
+    int getCols() const { return left.getCols(); }
+
+    std::uint64_t bytesRead() const {
+        return left.bytesRead() + right.bytesRead();
+    }
+
+    const ValueType* chunkPtr(int, int) const { return nullptr; }
+
+    void evalChunk(int row, int col, int len, ValueType* out) const {
+        const ValueType* l = left.chunkPtr(row, col);
+        const ValueType* r = right.chunkPtr(row, col);
+        if (l && r) {
+            simdKernels<ValueType>().add(out, l, r, len);
+        } else if (Left::hasElementwise) {
+            left.evalChunk(row, col, len, out);
+            right.addChunk(row, col, len, out);
+        } else {
+            right.evalChunk(row, col, len, out);
+        }
+    }
+
+    void addChunk(int row, int col, int len, ValueType* out) const {
+        left.addChunk(row, col, len, out);
+        right.addChunk(row, col, len, out);
+    }
+
+    void accumulateProducts(const MatrixBlock<ValueType>& result) const {
+        left.accumulateProducts(result);
+        right.accumulateProducts(result);
+    }
+
+    bool conflictsWith(const Matrix<ValueType>& target) const {
+        return left.conflictsWith(target) || right.conflictsWith(target);
+    }
+};
+
+// Lazy expression nodes (what a Matrix<T> can be built from)
+template <typename E>
+struct isMatrixExpression : std::false_type {};
+
+template <typename T>
+struct isMatrixExpression<MatrixProduct<T>> : std::true_type {};
+
+template <typename T>
+struct isMatrixExpression<MatrixTransposed<T>> : std::true_type {};
+
+template <typename L, typename R>
+struct isMatrixExpression<MatrixSum<L, R>> : std::true_type {};
+
+// Anything operator+ and operator* accept: matrices and expression nodes
+template <typename E>
+struct isMatrixOperand : isMatrixExpression<E> {};
+
+template <typename T>
+struct isMatrixOperand<Matrix<T>> : std::true_type {};
+
+template <typename E>
+struct MatrixValueType {
+    typedef typename E::ValueType Type;
+};
+
+template <typename T>
+struct MatrixValueType<Matrix<T>> {
+    typedef T Type;
+};
+
+// Result of operator*, defined only when both sides are matrix operands
+template <typename L, typename R, bool = isMatrixOperand<L>::value && isMatrixOperand<R>::value>
+struct MatrixProductType {};
+
+template <typename L, typename R>
+struct MatrixProductType<L, R, true> {
+    typedef MatrixProduct<typename MatrixValueType<L>::Type> Type;
+};
+
+// Matrix operand of a product: matrices and transposed views are used in
+// place, other expressions are evaluated into a held matrix
+template <typename T>
+const Matrix<T>* matrixProductOperand(const Matrix<T>& m, bool& transposed, std::shared_ptr<const Matrix<T>>&) {
+    transposed = false;
+    return &m;
+}
+
+template <typename T>
+const Matrix<T>* matrixProductOperand(const MatrixTransposed<T>& view, bool& transposed,
+                                      std::shared_ptr<const Matrix<T>>&) {
+    transposed = true;
+    return &view.stored();
+}
+
+template <typename E>
+const Matrix<typename E::ValueType>* matrixProductOperand(
+        const E& expr, bool& transposed, std::shared_ptr<const Matrix<typename E::ValueType>>& held) {
+    transposed = false;
+    held = std::make_shared<const Matrix<typename E::ValueType>>(expr);
+    return held.get();
+}
+
+// Matrix addition
+template <typename L, typename R>
+typename std::enable_if<isMatrixOperand<L>::value && isMatrixOperand<R>::value, MatrixSum<L, R>>::type
+operator+(const L& l, const R& r) {
+    static_assert(std::is_same<typename MatrixValueType<L>::Type, typename MatrixValueType<R>::Type>::value,
+                  "Matrix element types must match");
+    return MatrixSum<L, R>(l, r);
+}
+
+// Matrix multiplication
+template <typename L, typename R>
+typename MatrixProductType<L, R>::Type operator*(const L& l, const R& r) {
+    typedef typename MatrixValueType<L>::Type T;
+    static_assert(std::is_same<T, typename MatrixValueType<R>::Type>::value,
+                  "Matrix element types must match");
+    std::shared_ptr<const Matrix<T>> heldL;
+    std::shared_ptr<const Matrix<T>> heldR;
+    bool transposedL;
+    bool transposedR;
+    const Matrix<T>* a = matrixProductOperand(l, transposedL, heldL);
+    const Matrix<T>* b = matrixProductOperand(r, transposedR, heldR);
+    return MatrixProduct<T>(a, transposedL, heldL, b, transposedR, heldR);
+}
+
+#endif // MATRIX_EXPR_H
@@ -0,0 +1,351 @@
+// Bulk loader for the text matrix format (see input.txt)
+// The file is memory-mapped and numbers are parsed in place, straight into
+// the matrix buffers, without building intermediate strings or vectors.
+// Parse errors carry the line and column where they happened.
+
+#ifndef MATRIX_LOADER_H
+#define MATRIX_LOADER_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Matrix.h"
+#include "MatrixProfile.h"
+
+// Error raised for malformed matrix text, with a 1-based position
+class MatrixParseError : public std::runtime_error {
+private:
+    int lineNumber;
+    int columnNumber;
+
+    static std::string format(const std::string& message, int line, int column) {
+        std::ostringstream out;
+        out << "line " << line << ", column " << column << ": " << message;
+        return out.str();
+    }
+
+public:
+    MatrixParseError(const std::string& message, int line, int column)
+        : std::runtime_error(format(message, line, column)), lineNumber(line), columnNumber(column) {}
+
+    int line() const { return lineNumber; }
+    int column() const { return columnNumber; }
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+private:
+    const char* ptr;
+    std::size_t length;
+
+public:
+    explicit MappedFile(const std::string& filename) : ptr(nullptr), length(0) {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open file " + filename);
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Could not stat file " + filename);
+        }
+        length = static_cast<std::size_t>(info.st_size);
+        if (length > 0) {
+            void* p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("Could not map file " + filename);
+            }
+            ::madvise(p, length, MADV_SEQUENTIAL);
+            ptr = static_cast<const char*>(p);
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (ptr) {
+            ::munmap(const_cast<char*>(ptr), length);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return ptr; }
+    std::size_t size() const { return length; }
+};
+
+// Hand-rolled number scanner over a character range
+class TextScanner {
+private:
+    const char* begin;
+    const char* pos;
+    const char* end;
+
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    static bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    // Exact powers of ten representable as doubles
+    static double exactPow10(int e) {
+        static const double table[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        return table[e];
+    }
+
+    void expectSeparator() {
+        if (pos < end && !isSpace(*pos)) {
+            fail(std::string("unexpected character '") + *pos + "'");
+        }
+    }
+
+public:
+    TextScanner(const char* data, std::size_t length)
+        : begin(data), pos(data), end(data + length) {}
+
+    // Throw a MatrixParseError at the current position. The line and column
+    // are only worked out here, so the happy path never counts newlines.
+    void fail(const std::string& message) const {
+        fail(message, pos);
+    }
+
+    void fail(const std::string& message, const char* where) const {
+        int line = 1;
+        const char* lineStart = begin;
+        for (const char* p = begin; p < where; p++) {
+            if (*p == '\n') {
+                line++;
+                lineStart = p + 1;
+            }
+        }
+        throw MatrixParseError(message, line, static_cast<int>(where - lineStart) + 1);
+    }
+
+    void skipWhitespace() {
+        while (pos < end && isSpace(*pos)) {
+            pos++;
+        }
+    }
+
+    // Current position, for reporting errors at the start of a token
+    const char* position() const {
+        return pos;
+    }
+
+    std::size_t remaining() const {
+        return static_cast<std::size_t>(end - pos);
+    }
+
+    bool atEnd() {
+        skipWhitespace();
+        return pos == end;
+    }
+
+    template <typename T>
+    T parseInteger() {
+        skipWhitespace();
+        const char* start = pos;
+        bool negative = false;
+        if (pos < end && (*pos == '-' || *pos == '+')) {
+            negative = *pos == '-';
+            pos++;
+        }
+        if (pos == end || !isDigit(*pos)) {
+            fail(pos == end ? "unexpected end of input, expected an integer" : "expected an integer");
+        }
+        // Largest magnitude allowed for this sign
+        const unsigned long long maxMagnitude = negative
+            ? static_cast<unsigned long long>(-(static_cast<long long>(std::numeric_limits<T>::min()) + 1)) + 1
+            : static_cast<unsigned long long>(std::numeric_limits<T>::max());
+        unsigned long long magnitude = 0;
+        while (pos < end && isDigit(*pos)) {
+            unsigned digit = static_cast<unsigned>(*pos - '0');
+            if (magnitude > (maxMagnitude - digit) / 10) {
+                fail("integer out of range", start);
+            }
+            magnitude = magnitude * 10 + digit;
+            pos++;
+        }
+        expectSeparator();
+        if (negative && magnitude > 0) {
+            return static_cast<T>(-static_cast<long long>(magnitude - 1) - 1);
+        }
+        return static_cast<T>(magnitude);
+    }
+
+    double parseDouble() {
+        skipWhitespace();
+        const char* start = pos;
+        bool negative = false;
+        if (pos < end && (*pos == '-' || *pos == '+')) {
+            negative = *pos == '-';
+            pos++;
+        }
+
+        std::uint64_t mantissa = 0;
+        int digits = 0;        // significant digits kept in mantissa
+        int exponent = 0;      // decimal exponent applied to mantissa
+        bool anyDigits = false;
+        bool truncated = false;
+        while (pos < end && isDigit(*pos)) {
+            anyDigits = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + static_cast<unsigned>(*pos - '0');
+                if (mantissa != 0) {
+                    digits++;
+                }
+            } else {
+                exponent++;
+                truncated = true;
+            }
+            pos++;
+        }
+        if (pos < end && *pos == '.') {
+            pos++;
+            while (pos < end && isDigit(*pos)) {
+                anyDigits = true;
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + static_cast<unsigned>(*pos - '0');
+                    exponent--;
+                    if (mantissa != 0) {
+                        digits++;
+                    }
+                } else {
+                    truncated = true;
+                }
+                pos++;
+            }
+        }
+        if (!anyDigits) {
+            pos = start;
+            fail(pos == end ? "unexpected end of input, expected a number" : "expected a number");
+        }
+        if (pos < end && (*pos == 'e' || *pos == 'E')) {
+            const char* expStart = pos;
+            pos++;
+            bool expNegative = false;
+            if (pos < end && (*pos == '-' || *pos == '+')) {
+                expNegative = *pos == '-';
+                pos++;
+            }
+            if (pos == end || !isDigit(*pos)) {
+                fail("malformed exponent", expStart);
+            }
+            int e = 0;
+            while (pos < end && isDigit(*pos)) {
+                if (e < 100000) {
+                    e = e * 10 + (*pos - '0');
+                }
+                pos++;
+            }
+            exponent += expNegative ? -e : e;
+        }
+        expectSeparator();
+
+        // Fast path: the mantissa and the power of ten are both exact doubles,
+        // so one multiply or divide gives the correctly rounded result
+        double value;
+        if (!truncated && mantissa <= (std::uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+            value = static_cast<double>(mantissa);
+            value = exponent < 0 ? value / exactPow10(-exponent) : value * exactPow10(exponent);
+        } else {
+            std::string token(start, pos);
+            errno = 0;
+            value = std::strtod(token.c_str(), nullptr);
+            if (errno == ERANGE && (value > 1.0 || value < -1.0)) {
+                fail("number out of range", start);
+            }
+            return value;
+        }
+        return negative ? -value : value;
+    }
+
+    template <typename T>
+    T parseValue() {
+        return parseValueImpl<T>(std::is_integral<T>());
+    }
+
+private:
+    template <typename T>
+    T parseValueImpl(std::true_type) {
+        return parseInteger<T>();
+    }
+
+    template <typename T>
+    T parseValueImpl(std::false_type) {
+        return static_cast<T>(parseDouble());
+    }
+};
+
+// First line of the text format: "size type"
+struct MatrixFileHeader {
+    int size;
+    int dataType;
+};
+
+inline MatrixFileHeader parseMatrixHeader(TextScanner& scanner) {
+    MatrixFileHeader header;
+    header.size = scanner.parseInteger<int>();
+    if (header.size <= 0) {
+        scanner.fail("matrix size must be positive");
+    }
+    header.dataType = scanner.parseInteger<int>();
+    return header;
+}
+
+// Parse size x size values straight into the rows of matrix
+template <typename T>
+void parseMatrixValues(TextScanner& scanner, Matrix<T>& matrix, int size) {
+    if (matrix.getRows() != size || matrix.getCols() != size) {
+        matrix = Matrix<T>(size);
+    }
+    for (int i = 0; i < size; i++) {
+        T* row = matrix.rowPtr(i);
+        for (int j = 0; j < size; j++) {
+            row[j] = scanner.parseValue<T>();
+        }
+    }
+}
+
+// Loader for a matrix text file: a header followed by matrices
+class MatrixTextLoader {
+private:
+    MappedFile file;
+    TextScanner scanner;
+
+public:
+    explicit MatrixTextLoader(const std::string& filename)
+        : file(filename), scanner(file.data(), file.size()) {}
+
+    MatrixFileHeader readHeader() {
+        return parseMatrixHeader(scanner);
+    }
+
+    template <typename T>
+    void readMatrix(Matrix<T>& matrix, int size) {
+        MatrixProfileScope profile(PROFILE_PARSE, 0);
+        const std::size_t before = scanner.remaining();
+        parseMatrixValues(scanner, matrix, size);
+        profile.setBytes(before - scanner.remaining() + static_cast<std::uint64_t>(size) * size * sizeof(T));
+    }
+};
+
+#endif // MATRIX_LOADER_H
@@ -0,0 +1,389 @@
+// Opt-in instrumentation of the Matrix<T> operations and matrix I/O
+// Each instrumented call records its count, wall time, bytes moved (read plus
+// written) and the heap allocations made for matrix buffers while it ran
+// (blocks reused from the allocator pool are not counted), and
+// optionally hardware counters (cycles, instructions, last-level cache
+// misses) through perf_event_open. A summary is written to stderr at exit.
+//
+// Enable with MATRIX_PROFILE=1 (timings) or MATRIX_PROFILE=perf (timings and
+// hardware counters), or with --profile / --profile-perf on matrix_operations.
+// When disabled an instrumented call costs one predictable branch; build with
+// -DMATRIX_PROFILING=0 to compile the instrumentation out entirely.
+//
+// Times are inclusive: an operation that runs another instrumented one (such
+// as a product whose operand is an expression) counts the inner time too.
+// Hardware counters cover the calling thread only, not the pool workers.
+
+#ifndef MATRIX_PROFILE_H
+#define MATRIX_PROFILE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <ostream>
+#include <sstream>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define MATRIX_PERF_EVENTS 1
+#else
+#define MATRIX_PERF_EVENTS 0
+#endif
+
+#ifndef MATRIX_PROFILING
+#define MATRIX_PROFILING 1
+#endif
+
+// Instrumented operations
+enum MatrixProfileOp {
+    PROFILE_ADD = 0,         // evaluating a sum of matrices
+    PROFILE_MULTIPLY,        // evaluating a product
+    PROFILE_EXPRESSION,      // evaluating a mixed expression such as a * b + c
+    PROFILE_TRANSPOSE,       // materializing a transposed view, transposeInPlace
+    PROFILE_SCALE,           // operator*= by a scalar
+    PROFILE_SUM_DIAGONALS,
+    PROFILE_SWAP_ROWS,
+    PROFILE_SWAP_COLUMNS,
+    PROFILE_UPDATE_ELEMENT,
+    PROFILE_PARSE,           // parseMatrixDataFromString and the text loader
+    PROFILE_STREAM_IN,       // operator>>
+    PROFILE_STREAM_OUT,      // operator<< and display()
+    PROFILE_OP_COUNT
+};
+
+inline const char* matrixProfileOpName(int op) {
+    static const char* const names[PROFILE_OP_COUNT] = {
+        "add", "multiply", "expression", "transpose", "scale", "sumDiagonals", "swapRows", "swapColumns",
+        "updateElement", "parse", "operator>>", "operator<<"
+    };
+    return names[op];
+}
+
+// Hardware events read per operation
+const int MATRIX_PERF_EVENT_COUNT = 3;
+
+inline const char* matrixPerfEventName(int event) {
+    static const char* const names[MATRIX_PERF_EVENT_COUNT] = {"cycles", "instructions", "llc-misses"};
+    return names[event];
+}
+
+// Per-thread perf_event_open counters, opened on first use
+class MatrixPerfCounters {
+private:
+    int fds[MATRIX_PERF_EVENT_COUNT];
+    bool opened;
+
+public:
+    MatrixPerfCounters() : opened(false) {
+        for (int e = 0; e < MATRIX_PERF_EVENT_COUNT; e++) {
+            fds[e] = -1;
+        }
+    }
+
+    ~MatrixPerfCounters() {
+#if MATRIX_PERF_EVENTS
+        for (int e = 0; e < MATRIX_PERF_EVENT_COUNT; e++) {
+            if (fds[e] >= 0) {
+                ::close(fds[e]);
+            }
+        }
+#endif
+    }
+
+    MatrixPerfCounters(const MatrixPerfCounters&) = delete;
+    MatrixPerfCounters& operator=(const MatrixPerfCounters&) = delete;
+
+    // True if the counters of this thread are available
+    bool open() {
+#if MATRIX_PERF_EVENTS
+        if (!opened) {
+            opened = true;
+            static const std::uint64_t configs[MATRIX_PERF_EVENT_COUNT] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES
+            };
+            for (int e = 0; e < MATRIX_PERF_EVENT_COUNT; e++) {
+                struct perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.size = sizeof(attr);
+                attr.config = configs[e];
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                fds[e] = static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+            }
+        }
+        return fds[0] >= 0;
+#else
+        return false;
+#endif
+    }
+
+    // Current values; events that could not be opened read as zero
+    void read(std::uint64_t* values) const {
+        for (int e = 0; e < MATRIX_PERF_EVENT_COUNT; e++) {
+            values[e] = 0;
+#if MATRIX_PERF_EVENTS
+            if (fds[e] >= 0 && ::read(fds[e], &values[e], sizeof(values[e])) != sizeof(values[e])) {
+                values[e] = 0;
+            }
+#endif
+        }
+    }
+};
+
+// Process-wide totals for each operation
+class MatrixProfiler {
+private:
+    struct OpStats {
+        std::atomic<std::uint64_t> calls;
+        std::atomic<std::uint64_t> nanoseconds;
+        std::atomic<std::uint64_t> bytes;
+        std::atomic<std::uint64_t> allocations;
+        std::atomic<std::uint64_t> allocatedBytes;
+        std::atomic<std::uint64_t> events[MATRIX_PERF_EVENT_COUNT];
+    };
+
+    OpStats stats[PROFILE_OP_COUNT];
+    std::atomic<std::uint64_t> allocations;
+    std::atomic<std::uint64_t> allocatedBytes;
+    bool enabled;
+    bool hardware;
+    bool hardwareFailed;
+
+    MatrixProfiler() : allocations(0), allocatedBytes(0), enabled(false), hardware(false), hardwareFailed(false) {
+        reset();
+        const char* env = std::getenv("MATRIX_PROFILE");
+        if (env && *env && std::strcmp(env, "0") != 0) {
+            enable(std::strcmp(env, "perf") == 0);
+        }
+    }
+
+    static MatrixPerfCounters& threadCounters() {
+        static thread_local MatrixPerfCounters counters;
+        return counters;
+    }
+
+public:
+    ~MatrixProfiler() {
+        if (enabled) {
+            report(std::cerr);
+        }
+    }
+
+    MatrixProfiler(const MatrixProfiler&) = delete;
+    MatrixProfiler& operator=(const MatrixProfiler&) = delete;
+
+    static MatrixProfiler& instance() {
+        static MatrixProfiler profiler;
+        return profiler;
+    }
+
+    // Start recording; call before the work to be measured starts. Does
+    // nothing when the instrumentation is compiled out.
+    void enable(bool withHardwareCounters) {
+        enabled = MATRIX_PROFILING != 0;
+        hardware = withHardwareCounters;
+    }
+
+    bool isEnabled() const {
+        return enabled;
+    }
+
+    void reset() {
+        for (int op = 0; op < PROFILE_OP_COUNT; op++) {
+            stats[op].calls = 0;
+            stats[op].nanoseconds = 0;
+            stats[op].bytes = 0;
+            stats[op].allocations = 0;
+            stats[op].allocatedBytes = 0;
+            for (int e = 0; e < MATRIX_PERF_EVENT_COUNT; e++) {
+                stats[op].events[e] = 0;
+            }
+        }
+    }
+
+    void countAllocation(std::size_t bytes) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    std::uint64_t allocationCount() const {
+        return allocations.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t allocatedByteCount() const {
+        return allocatedBytes.load(std::memory_order_relaxed);
+    }
+
+    // Hardware counters of the calling thread, or null if they are off or
+    // unavailable
+    MatrixPerfCounters* counters() {
+        if (!hardware || hardwareFailed) {
+            return nullptr;
+        }
+        MatrixPerfCounters& c = threadCounters();
+        if (!c.open()) {
+            hardwareFailed = true;
+            return nullptr;
+        }
+        return &c;
+    }
+
+    void record(int op, std::uint64_t nanoseconds, std::uint64_t bytes, std::uint64_t allocs,
+                std::uint64_t allocBytes, const std::uint64_t* events) {
+        OpStats& s = stats[op];
+        s.calls.fetch_add(1, std::memory_order_relaxed);
+        s.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        s.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        s.allocations.fetch_add(allocs, std::memory_order_relaxed);
+        s.allocatedBytes.fetch_add(allocBytes, std::memory_order_relaxed);
+        if (events) {
+            for (int e = 0; e < MATRIX_PERF_EVENT_COUNT; e++) {
+                s.events[e].fetch_add(events[e], std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Table of every operation that was called at least once
+    void report(std::ostream& out) const {
+        std::ostringstream text;
+        text << "\nMatrix operation profile";
+        if (hardware && hardwareFailed) {
+            text << " (hardware counters unavailable)";
+        }
+        text << "\n" << std::left << std::setw(14) << "op" << std::right << std::setw(10) << "calls"
+             << std::setw(12) << "total ms" << std::setw(12) << "mean us" << std::setw(12) << "MB moved"
+             << std::setw(10) << "GB/s" << std::setw(10) << "allocs" << std::setw(12) << "alloc MB";
+        const bool showEvents = hardware && !hardwareFailed;
+        if (showEvents) {
+            for (int e = 0; e < MATRIX_PERF_EVENT_COUNT; e++) {
+                text << std::setw(14) << matrixPerfEventName(e);
+            }
+            text << std::setw(8) << "IPC";
+        }
+        text << "\n" << std::fixed;
+        for (int op = 0; op < PROFILE_OP_COUNT; op++) {
+            const OpStats& s = stats[op];
+            const std::uint64_t calls = s.calls.load();
+            if (calls == 0) {
+                continue;
+            }
+            const double seconds = s.nanoseconds.load() * 1e-9;
+            const double bytes = static_cast<double>(s.bytes.load());
+            text << std::left << std::setw(14) << matrixProfileOpName(op) << std::right
+                 << std::setw(10) << calls << std::setprecision(3)
+                 << std::setw(12) << seconds * 1e3 << std::setw(12) << seconds * 1e6 / calls
+                 << std::setw(12) << bytes / 1e6 << std::setprecision(2)
+                 << std::setw(10) << (seconds > 0 ? bytes / seconds * 1e-9 : 0.0)
+                 << std::setw(10) << s.allocations.load() << std::setprecision(3)
+                 << std::setw(12) << s.allocatedBytes.load() / 1e6;
+            if (showEvents) {
+                for (int e = 0; e < MATRIX_PERF_EVENT_COUNT; e++) {
+                    text << std::setw(14) << s.events[e].load();
+                }
+                const std::uint64_t cycles = s.events[0].load();
+                text << std::setprecision(2) << std::setw(8)
+                     << (cycles > 0 ? static_cast<double>(s.events[1].load()) / cycles : 0.0);
+            }
+            text << "\n";
+        }
+        out << text.str();
+        out.flush();
+    }
+};
+
+inline bool matrixProfileEnabled() {
+#if MATRIX_PROFILING
+    return MatrixProfiler::instance().isEnabled();
+#else
+    return false;
+#endif
+}
+
+// Count a heap allocation of the given size for a matrix buffer
+inline void matrixProfileAllocation(std::size_t bytes) {
+#if MATRIX_PROFILING
+    if (matrixProfileEnabled()) {
+        MatrixProfiler::instance().countAllocation(bytes);
+    }
+#else
+    (void)bytes;
+#endif
+}
+
+// Records one call of op from construction to destruction; bytes is the
+// traffic the call moves
+class MatrixProfileScope {
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    int op;
+    bool active;
+    std::uint64_t bytes;
+    Clock::time_point start;
+    std::uint64_t allocs;
+    std::uint64_t allocBytes;
+    MatrixPerfCounters* counters;
+    std::uint64_t events[MATRIX_PERF_EVENT_COUNT];
+
+public:
+    MatrixProfileScope(int operation, std::uint64_t bytesMoved)
+        : op(operation), active(matrixProfileEnabled()), bytes(bytesMoved), allocs(0), allocBytes(0),
+          counters(nullptr) {
+        if (!active) {
+            return;
+        }
+        MatrixProfiler& profiler = MatrixProfiler::instance();
+        allocs = profiler.allocationCount();
+        allocBytes = profiler.allocatedByteCount();
+        counters = profiler.counters();
+        if (counters) {
+            counters->read(events);
+        }
+        start = Clock::now();
+    }
+
+    ~MatrixProfileScope() {
+        if (!active) {
+            return;
+        }
+        const Clock::time_point end = Clock::now();
+        std::uint64_t delta[MATRIX_PERF_EVENT_COUNT];
+        if (counters) {
+            counters->read(delta);
+            for (int e = 0; e < MATRIX_PERF_EVENT_COUNT; e++) {
+                delta[e] -= events[e];
+            }
+        }
+        MatrixProfiler& profiler = MatrixProfiler::instance();
+        profiler.record(op, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()),
+                        bytes, profiler.allocationCount() - allocs, profiler.allocatedByteCount() - allocBytes,
+                        counters ? delta : nullptr);
+    }
+
+    MatrixProfileScope(const MatrixProfileScope&) = delete;
+    MatrixProfileScope& operator=(const MatrixProfileScope&) = delete;
+
+    // Set the traffic once it is known, e.g. after parsing
+    void setBytes(std::uint64_t bytesMoved) {
+        bytes = bytesMoved;
+    }
+};
+
+#if MATRIX_PROFILING
+#define MATRIX_PROFILE_CONCAT_(a, b) a##b
+#define MATRIX_PROFILE_CONCAT(a, b) MATRIX_PROFILE_CONCAT_(a, b)
+// Profile the rest of the enclosing block as one call of op
+#define MATRIX_PROFILE_SCOPE(op, bytes) \
+    MatrixProfileScope MATRIX_PROFILE_CONCAT(matrixProfileScope, __LINE__)((op), (bytes))
+#else
+#define MATRIX_PROFILE_SCOPE(op, bytes) ((void)0)
+#endif
+
+#endif // MATRIX_PROFILE_H
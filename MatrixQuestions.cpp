@@ -2,182 +2,23 @@
 // Software Engineering Lab 9
 // This lab goes through the matrix operations in the previous lab such as add, multiply, change element, swap row, and swap columns
 
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <vector>
-#include <fstream>
 #include <iomanip>
-#include <string>
+#include <memory>
 #include <sstream>
+#include <string>
 #include <type_traits>
 
-template <typename T>
-class Matrix {
-private:
-    std::vector<std::vector<T>> data;
-    int size;
-
-public:
-    // Constructor
-    Matrix(int n) : size(n) {
-        data.resize(n, std::vector<T>(n));
-    }
-
-    // Default constructor
-    Matrix() : size(0) {}
-
-    // Get size
-    int getSize() const {
-        return size;
-    }
-
-    // Access element (for reading)
-    const T& operator()(int row, int col) const {
-        return data[row][col];
-    }
-
-    // Access element (for writing)
-    T& operator()(int row, int col) {
-        return data[row][col];
-    }
-
-    // Set data from vector
-    void setData(const std::vector<std::vector<T>>& newData) {
-        data = newData;
-        size = newData.size();
-    }
-
-    // Get raw data
-    const std::vector<std::vector<T>>& getData() const {
-        return data;
-    }
-
-    // Matrix addition
-    Matrix<T> operator+(const Matrix<T>& other) const {
-        if (size != other.size) {
-            throw std::invalid_argument("Matrix dimensions do not match for addition");
-        }
-
-        Matrix<T> result(size);
-        for (int i = 0; i < size; i++) {
-            for (int j = 0; j < size; j++) {
-                result(i, j) = data[i][j] + other(i, j);
-            }
-        }
-        return result;
-    }
-
-    // Matrix multiplication
-    Matrix<T> operator*(const Matrix<T>& other) const {
-        if (size != other.size) {
-            throw std::invalid_argument("Matrix dimensions do not match for multiplication");
-        }
-
-        Matrix<T> result(size);
-        for (int i = 0; i < size; i++) {
-            for (int j = 0; j < size; j++) {
-                result(i, j) = 0;
-                for (int k = 0; k < size; k++) {
-                    result(i, j) += data[i][k] * other(k, j);
-                }
-            }
-        }
-        return result;
-    }
-
-    // Calculate sum of diagonals
-    std::pair<T, T> sumDiagonals() const {
-        T mainDiagonal = 0;
-        T secondaryDiagonal = 0;
-
-        for (int i = 0; i < size; i++) {
-            mainDiagonal += data[i][i];
-            secondaryDiagonal += data[i][size - 1 - i];
-        }
-
-        return std::make_pair(mainDiagonal, secondaryDiagonal);
-    }
-
-    // Swap rows
-    bool swapRows(int row1, int row2) {
-        if (row1 < 0 || row1 >= size || row2 < 0 || row2 >= size) {
-            return false;
-        }
-
-        std::swap(data[row1], data[row2]);
-        return true;
-    }
-
-    // Swap columns
-    bool swapColumns(int col1, int col2) {
-        if (col1 < 0 || col1 >= size || col2 < 0 || col2 >= size) {
-            return false;
-        }
-
-        for (int i = 0; i < size; i++) {
-            std::swap(data[i][col1], data[i][col2]);
-        }
-        return true;
-    }
-
-    // Update element
-    bool updateElement(int row, int col, T value) {
-        if (row < 0 || row >= size || col < 0 || col >= size) {
-            return false;
-        }
-
-        data[row][col] = value;
-        return true;
-    }
-
-    // Display the matrix
-    void display() const {
-        for (int i = 0; i < size; i++) {
-            for (int j = 0; j < size; j++) {
-                if (std::is_same<T, int>::value) {
-                    std::cout << std::setw(4) << data[i][j];
-                } else {
-                    std::cout << std::fixed << std::setprecision(2) << std::setw(8) << data[i][j];
-                }
-            }
-            std::cout << std::endl;
-        }
-    }
-};
-
-// Input stream operator for Matrix
-template <typename T>
-std::istream& operator>>(std::istream& in, Matrix<T>& matrix) {
-    int n = matrix.getSize();
-    std::vector<std::vector<T>> tempData(n, std::vector<T>(n));
-    
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < n; j++) {
-            T value;
-            in >> value;
-            tempData[i][j] = value;
-        }
-    }
-    
-    matrix.setData(tempData);
-    return in;
-}
-
-// Output stream operator for Matrix
-template <typename T>
-std::ostream& operator<<(std::ostream& out, const Matrix<T>& matrix) {
-    int n = matrix.getSize();
-    for (int i = 0; i < n; i++) {
-        for (int j = 0; j < n; j++) {
-            if (std::is_same<T, int>::value) {
-                out << std::setw(4) << matrix(i, j);
-            } else {
-                out << std::fixed << std::setprecision(2) << std::setw(8) << matrix(i, j);
-            }
-        }
-        out << std::endl;
-    }
-    return out;
-}
+#include "DistributedGemm.h"
+#include "Matrix.h"
+#include "MatrixBatch.h"
+#include "MatrixLoader.h"
+#include "MatrixProfile.h"
+#include "MatrixServer.h"
+#include "MatrixTypes.h"
 
 // Functions for polymorphism requirement (directly using std::vector)
 // Function to swap rows in a vector-based matrix
@@ -237,23 +78,331 @@ void displayVectorMatrix(const std::vector<std::vector<T>>& matrix) {
 template <typename T>
 bool parseMatrixDataFromString(const std::string& input, int matrixSize, 
                                Matrix<T>& matrix1, Matrix<T>& matrix2) {
-    std::istringstream iss(input);
+    MATRIX_PROFILE_SCOPE(PROFILE_PARSE, input.size() + 2ULL * matrixSize * matrixSize * sizeof(T));
+    TextScanner scanner(input.data(), input.size());
     
-    // Create matrices of appropriate size
-    matrix1 = Matrix<T>(matrixSize);
-    matrix2 = Matrix<T>(matrixSize);
-    
-    // Read data for both matrices
-    iss >> matrix1 >> matrix2;
+    // Read data for both matrices straight into their buffers
+    parseMatrixValues(scanner, matrix1, matrixSize);
+    parseMatrixValues(scanner, matrix2, matrixSize);
     
     return true;
 }
 
-int main() {
+// Function to load both matrices from the open file, or from the default data
+template <typename T>
+bool loadMatrices(MatrixTextLoader* loader, const std::string& source, const std::string& defaultData,
+                  int matrixSize, Matrix<T>& matrix1, Matrix<T>& matrix2) {
+    try {
+        if (loader) {
+            loader->readMatrix(matrix1, matrixSize);
+            loader->readMatrix(matrix2, matrixSize);
+        } else {
+            parseMatrixDataFromString(defaultData, matrixSize, matrix1, matrix2);
+        }
+    } catch (const MatrixParseError& e) {
+        std::cerr << "Error: " << source << ": " << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Integer products are shown in the accumulator type (int as int64) so they
+// do not wrap; floating point products keep their type. With a cluster the
+// product is formed on its workers.
+template <typename T>
+Matrix<typename MatrixAccumulator<T>::type> menuProduct(const Matrix<T>& a, const Matrix<T>& b,
+                                                        MatrixCluster* cluster, std::true_type) {
+    return cluster ? cluster->multiplyWide(a, b) : multiplyWide(a, b);
+}
+
+template <typename T>
+Matrix<T> menuProduct(const Matrix<T>& a, const Matrix<T>& b, MatrixCluster* cluster, std::false_type) {
+    return cluster ? cluster->multiply(a, b) : Matrix<T>(a * b);
+}
+
+// Function to run the interactive menu on two matrices of element type T
+template <typename T>
+int runMenu(MatrixTextLoader* loader, const std::string& source, const std::string& matrixData, int matrixSize,
+            MatrixCluster* cluster) {
+    Matrix<T> matrix1, matrix2;
+    if (!loadMatrices(loader, source, matrixData, matrixSize, matrix1, matrix2)) {
+        return 1;
+    }
+    
+    int choice = 0;
+    while (choice != 8) {
+        std::cout << "\nMatrix Operations Menu:" << std::endl;
+        std::cout << "1. Display matrices" << std::endl;
+        std::cout << "2. Add matrices" << std::endl;
+        std::cout << "3. Multiply matrices" << std::endl;
+        std::cout << "4. Calculate diagonal sums" << std::endl;
+        std::cout << "5. Swap rows" << std::endl;
+        std::cout << "6. Swap columns" << std::endl;
+        std::cout << "7. Update element" << std::endl;
+        std::cout << "8. Exit" << std::endl;
+        std::cout << "Enter your choice: ";
+        std::cin >> choice;
+        
+        switch (choice) {
+            case 1: {
+                std::cout << "\nMatrix 1:" << std::endl;
+                std::cout << matrix1;
+                std::cout << "\nMatrix 2:" << std::endl;
+                std::cout << matrix2;
+                break;
+            }
+            case 2: {
+                try {
+                    Matrix<T> result = matrix1 + matrix2;
+                    std::cout << "\nMatrix 1 + Matrix 2:" << std::endl;
+                    std::cout << result;
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 3: {
+                try {
+                    auto result = menuProduct(matrix1, matrix2, cluster, std::is_integral<T>());
+                    std::cout << "\nMatrix 1 * Matrix 2:" << std::endl;
+                    std::cout << result;
+                } catch (const std::exception& e) {
+                    std::cerr << "Error: " << e.what() << std::endl;
+                }
+                break;
+            }
+            case 4: {
+                auto diagonals1 = matrix1.sumDiagonals();
+                auto diagonals2 = matrix2.sumDiagonals();
+                
+                std::cout << "\nMatrix 1 Diagonals:" << std::endl;
+                std::cout << "Main diagonal sum: " << diagonals1.first << std::endl;
+                std::cout << "Secondary diagonal sum: " << diagonals1.second << std::endl;
+                
+                std::cout << "\nMatrix 2 Diagonals:" << std::endl;
+                std::cout << "Main diagonal sum: " << diagonals2.first << std::endl;
+                std::cout << "Secondary diagonal sum: " << diagonals2.second << std::endl;
+                break;
+            }
+            case 5: {
+                int matrixChoice, row1, row2;
+                std::cout << "Which matrix (1 or 2)? ";
+                std::cin >> matrixChoice;
+                std::cout << "Enter the two row indices to swap (0-based): ";
+                std::cin >> row1 >> row2;
+                
+                if (matrixChoice == 1) {
+                    if (matrix1.swapRows(row1, row2)) {
+                        std::cout << "Rows swapped successfully. New Matrix 1:" << std::endl;
+                        std::cout << matrix1;
+                    } else {
+                        std::cout << "Invalid row indices." << std::endl;
+                    }
+                } else if (matrixChoice == 2) {
+                    if (matrix2.swapRows(row1, row2)) {
+                        std::cout << "Rows swapped successfully. New Matrix 2:" << std::endl;
+                        std::cout << matrix2;
+                    } else {
+                        std::cout << "Invalid row indices." << std::endl;
+                    }
+                } else {
+                    std::cout << "Invalid matrix choice." << std::endl;
+                }
+                break;
+            }
+            case 6: {
+                int matrixChoice, col1, col2;
+                std::cout << "Which matrix (1 or 2)? ";
+                std::cin >> matrixChoice;
+                std::cout << "Enter the two column indices to swap (0-based): ";
+                std::cin >> col1 >> col2;
+                
+                if (matrixChoice == 1) {
+                    if (matrix1.swapColumns(col1, col2)) {
+                        std::cout << "Columns swapped successfully. New Matrix 1:" << std::endl;
+                        std::cout << matrix1;
+                    } else {
+                        std::cout << "Invalid column indices." << std::endl;
+                    }
+                } else if (matrixChoice == 2) {
+                    if (matrix2.swapColumns(col1, col2)) {
+                        std::cout << "Columns swapped successfully. New Matrix 2:" << std::endl;
+                        std::cout << matrix2;
+                    } else {
+                        std::cout << "Invalid column indices." << std::endl;
+                    }
+                } else {
+                    std::cout << "Invalid matrix choice." << std::endl;
+                }
+                break;
+            }
+            case 7: {
+                int matrixChoice, row, col;
+                typename MatrixTextType<T>::type value;
+                std::cout << "Which matrix (1 or 2)? ";
+                std::cin >> matrixChoice;
+                std::cout << "Enter row, column (0-based), and new value: ";
+                std::cin >> row >> col >> value;
+                
+                if (matrixChoice == 1) {
+                    if (matrix1.updateElement(row, col, static_cast<T>(value))) {
+                        std::cout << "Element updated successfully. New Matrix 1:" << std::endl;
+                        std::cout << matrix1;
+                    } else {
+                        std::cout << "Invalid indices." << std::endl;
+                    }
+                } else if (matrixChoice == 2) {
+                    if (matrix2.updateElement(row, col, static_cast<T>(value))) {
+                        std::cout << "Element updated successfully. New Matrix 2:" << std::endl;
+                        std::cout << matrix2;
+                    } else {
+                        std::cout << "Invalid indices." << std::endl;
+                    }
+                } else {
+                    std::cout << "Invalid matrix choice." << std::endl;
+                }
+                break;
+            }
+            case 8:
+                std::cout << "Exiting program." << std::endl;
+                break;
+            default:
+                std::cout << "Invalid choice. Please try again." << std::endl;
+        }
+    }
+    return 0;
+}
+
+// Runs the menu with the element type of a type code
+struct MenuRunner {
+    MatrixTextLoader* loader;
+    const std::string& source;
+    const std::string& matrixData;
+    int matrixSize;
+    MatrixCluster* cluster;
+    int status;
+
+    template <typename T>
+    void apply() {
+        status = runMenu<T>(loader, source, matrixData, matrixSize, cluster);
+    }
+};
+
+// Function to run a batch script (see MatrixBatch.h) instead of the menu
+int runBatch(const std::string& script, const std::string& source, MatrixCluster* cluster) {
+    BatchSession session(std::cout);
+    session.useCluster(cluster);
+    try {
+        session.run(parseBatchScript(script));
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << source << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // Optional command-line flags
+    std::string batchScript;
+    std::string batchSource;
+    bool batchMode = false;
+    std::string workerAddress;
+    std::string serveAddress;
+    std::vector<std::string> workerAddresses;
+    int spawnWorkers = 0;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            ThreadPool::setThreadCount(std::atoi(argv[++i]));
+        } else if (arg == "--multiply" && i + 1 < argc) {
+            // Multiply algorithm for large square products (see Strassen.h)
+            std::string algorithm = argv[++i];
+            if (algorithm != "blocked" && algorithm != "strassen") {
+                std::cerr << "Error: --multiply must be blocked or strassen" << std::endl;
+                return 1;
+            }
+            setMultiplyAlgorithm(algorithm == "strassen" ? MULTIPLY_STRASSEN : MULTIPLY_BLOCKED);
+        } else if (arg == "--strassen-threshold" && i + 1 < argc) {
+            setStrassenThreshold(std::atoi(argv[++i]));
+        } else if (arg == "--profile" || arg == "--profile-perf") {
+            // Per-operation summary on stderr at exit (see MatrixProfile.h)
+            MatrixProfiler::instance().enable(arg == "--profile-perf");
+        } else if (arg == "--batch" && i + 1 < argc) {
+            // Script file, or - for standard input
+            std::string path = argv[++i];
+            std::ostringstream text;
+            if (path == "-") {
+                text << std::cin.rdbuf();
+            } else {
+                std::ifstream file(path.c_str());
+                if (!file) {
+                    std::cerr << "Error: Could not open file " << path << std::endl;
+                    return 1;
+                }
+                text << file.rdbuf();
+            }
+            batchScript += text.str() + "\n";
+            batchSource = path == "-" ? "stdin" : path;
+            batchMode = true;
+        } else if (arg == "--worker" && i + 1 < argc) {
+            // Serve distributed multiplies on this address (see DistributedGemm.h)
+            workerAddress = argv[++i];
+        } else if (arg == "--serve" && i + 1 < argc) {
+            // Run commands sent by clients on this address (see MatrixServer.h)
+            serveAddress = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            // Multiply on the workers at these comma-separated addresses
+            std::stringstream list(argv[++i]);
+            std::string address;
+            while (std::getline(list, address, ',')) {
+                if (!address.empty()) {
+                    workerAddresses.push_back(address);
+                }
+            }
+        } else if (arg == "--spawn-workers" && i + 1 < argc) {
+            // Multiply on this many worker processes started on this machine
+            spawnWorkers = std::atoi(argv[++i]);
+            if (spawnWorkers < 1) {
+                std::cerr << "Error: --spawn-workers must be at least 1" << std::endl;
+                return 1;
+            }
+        } else if ((arg == "-e" || arg == "--exec") && i + 1 < argc) {
+            // Commands on the command line, separated by ';'
+            batchScript += std::string(argv[++i]) + "\n";
+            batchSource = "command line";
+            batchMode = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--threads N] [--multiply blocked|strassen] [--strassen-threshold N]"
+                      << " [--profile|--profile-perf] [--batch FILE|-] [-e COMMANDS]"
+                      << " [--workers ADDR,ADDR,...|--spawn-workers N] [--worker ADDR] [--serve ADDR]" << std::endl;
+            return 1;
+        }
+    }
+    if (!workerAddress.empty()) {
+        return runMatrixWorker(workerAddress);
+    }
+    std::unique_ptr<MatrixCluster> cluster;
+    try {
+        if (spawnWorkers > 0) {
+            cluster = MatrixCluster::spawnLocal(spawnWorkers);
+        } else if (!workerAddresses.empty()) {
+            cluster.reset(new MatrixCluster(workerAddresses));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    if (!serveAddress.empty()) {
+        return runMatrixServer(serveAddress, cluster.get());
+    }
+    if (batchMode) {
+        return runBatch(batchScript, batchSource, cluster.get());
+    }
+
     // For this part I set default values just for testing purposes but the functions asks you for an input file anyways
     // Set default values
     int matrixSize = 4;  // Default size based on sample input
-    int dataType = 0;    // 0 for int, 1 for double
+    int dataType = 0;    // MatrixTypeCode (MatrixTypes.h): 0 for int, 1 for double, ...
     std::string matrixData = 
         "01 02 03 04 "
         "05 06 07 08 "
@@ -266,6 +415,10 @@ int main() {
 
     std::cout << "Matrix Operations Program\n" << std::endl;
     
+    // The matrices are parsed straight from the mapped file when one is given
+    std::unique_ptr<MatrixTextLoader> loader;
+    std::string source = "default data";
+
     // Ask if the user wants to use the default data or load from a file
     char loadChoice;
     std::cout << "Do you want to load matrix data from a file? (y/n): ";
@@ -276,321 +429,30 @@ int main() {
         std::cout << "Enter the filename: ";
         std::cin >> filename;
         
-        std::ifstream inFile(filename);
-        if (!inFile.is_open()) {
-            std::cerr << "Error: Could not open file " << filename << std::endl;
+        try {
+            loader.reset(new MatrixTextLoader(filename));
+            
+            // Read the first line to get matrix size and type
+            MatrixFileHeader header = loader->readHeader();
+            matrixSize = header.size;
+            dataType = header.dataType;
+        } catch (const MatrixParseError& e) {
+            std::cerr << "Error: " << filename << ": " << e.what() << std::endl;
+            return 1;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
             return 1;
         }
-        
-        // Read the first line to get matrix size and type
-        inFile >> matrixSize >> dataType;
-        
-        // Read the rest of the file into a string
-        std::string line;
-        matrixData = "";
-        while (std::getline(inFile, line)) {
-            matrixData += line + " ";
-        }
-        
-        inFile.close();
+        source = filename;
     } else {
         std::cout << "Using default matrix data (4x4 integer matrices)" << std::endl;
     }
     
     // Process matrix data based on data type
-    if (dataType == 0) { // Integer matrices
-        Matrix<int> matrix1, matrix2;
-        parseMatrixDataFromString<int>(matrixData, matrixSize, matrix1, matrix2);
-        
-        int choice = 0;
-        while (choice != 8) {
-            std::cout << "\nMatrix Operations Menu:" << std::endl;
-            std::cout << "1. Display matrices" << std::endl;
-            std::cout << "2. Add matrices" << std::endl;
-            std::cout << "3. Multiply matrices" << std::endl;
-            std::cout << "4. Calculate diagonal sums" << std::endl;
-            std::cout << "5. Swap rows" << std::endl;
-            std::cout << "6. Swap columns" << std::endl;
-            std::cout << "7. Update element" << std::endl;
-            std::cout << "8. Exit" << std::endl;
-            std::cout << "Enter your choice: ";
-            std::cin >> choice;
-            
-            switch (choice) {
-                case 1: {
-                    std::cout << "\nMatrix 1:" << std::endl;
-                    std::cout << matrix1;
-                    std::cout << "\nMatrix 2:" << std::endl;
-                    std::cout << matrix2;
-                    break;
-                }
-                case 2: {
-                    try {
-                        Matrix<int> result = matrix1 + matrix2;
-                        std::cout << "\nMatrix 1 + Matrix 2:" << std::endl;
-                        std::cout << result;
-                    } catch (const std::exception& e) {
-                        std::cerr << "Error: " << e.what() << std::endl;
-                    }
-                    break;
-                }
-                case 3: {
-                    try {
-                        Matrix<int> result = matrix1 * matrix2;
-                        std::cout << "\nMatrix 1 * Matrix 2:" << std::endl;
-                        std::cout << result;
-                    } catch (const std::exception& e) {
-                        std::cerr << "Error: " << e.what() << std::endl;
-                    }
-                    break;
-                }
-                case 4: {
-                    auto diagonals1 = matrix1.sumDiagonals();
-                    auto diagonals2 = matrix2.sumDiagonals();
-                    
-                    std::cout << "\nMatrix 1 Diagonals:" << std::endl;
-                    std::cout << "Main diagonal sum: " << diagonals1.first << std::endl;
-                    std::cout << "Secondary diagonal sum: " << diagonals1.second << std::endl;
-                    
-                    std::cout << "\nMatrix 2 Diagonals:" << std::endl;
-                    std::cout << "Main diagonal sum: " << diagonals2.first << std::endl;
-                    std::cout << "Secondary diagonal sum: " << diagonals2.second << std::endl;
-                    break;
-                }
-                case 5: {
-                    int matrixChoice, row1, row2;
-                    std::cout << "Which matrix (1 or 2)? ";
-                    std::cin >> matrixChoice;
-                    std::cout << "Enter the two row indices to swap (0-based): ";
-                    std::cin >> row1 >> row2;
-                    
-                    if (matrixChoice == 1) {
-                        if (matrix1.swapRows(row1, row2)) {
-                            std::cout << "Rows swapped successfully. New Matrix 1:" << std::endl;
-                            std::cout << matrix1;
-                        } else {
-                            std::cout << "Invalid row indices." << std::endl;
-                        }
-                    } else if (matrixChoice == 2) {
-                        if (matrix2.swapRows(row1, row2)) {
-                            std::cout << "Rows swapped successfully. New Matrix 2:" << std::endl;
-                            std::cout << matrix2;
-                        } else {
-                            std::cout << "Invalid row indices." << std::endl;
-                        }
-                    } else {
-                        std::cout << "Invalid matrix choice." << std::endl;
-                    }
-                    break;
-                }
-                case 6: {
-                    int matrixChoice, col1, col2;
-                    std::cout << "Which matrix (1 or 2)? ";
-                    std::cin >> matrixChoice;
-                    std::cout << "Enter the two column indices to swap (0-based): ";
-                    std::cin >> col1 >> col2;
-                    
-                    if (matrixChoice == 1) {
-                        if (matrix1.swapColumns(col1, col2)) {
-                            std::cout << "Columns swapped successfully. New Matrix 1:" << std::endl;
-                            std::cout << matrix1;
-                        } else {
-                            std::cout << "Invalid column indices." << std::endl;
-                        }
-                    } else if (matrixChoice == 2) {
-                        if (matrix2.swapColumns(col1, col2)) {
-                            std::cout << "Columns swapped successfully. New Matrix 2:" << std::endl;
-                            std::cout << matrix2;
-                        } else {
-                            std::cout << "Invalid column indices." << std::endl;
-                        }
-                    } else {
-                        std::cout << "Invalid matrix choice." << std::endl;
-                    }
-                    break;
-                }
-                case 7: {
-                    int matrixChoice, row, col, value;
-                    std::cout << "Which matrix (1 or 2)? ";
-                    std::cin >> matrixChoice;
-                    std::cout << "Enter row, column (0-based), and new value: ";
-                    std::cin >> row >> col >> value;
-                    
-                    if (matrixChoice == 1) {
-                        if (matrix1.updateElement(row, col, value)) {
-                            std::cout << "Element updated successfully. New Matrix 1:" << std::endl;
-                            std::cout << matrix1;
-                        } else {
-                            std::cout << "Invalid indices." << std::endl;
-                        }
-                    } else if (matrixChoice == 2) {
-                        if (matrix2.updateElement(row, col, value)) {
-                            std::cout << "Element updated successfully. New Matrix 2:" << std::endl;
-                            std::cout << matrix2;
-                        } else {
-                            std::cout << "Invalid indices." << std::endl;
-                        }
-                    } else {
-                        std::cout << "Invalid matrix choice." << std::endl;
-                    }
-                    break;
-                }
-                case 8:
-                    std::cout << "Exiting program." << std::endl;
-                    break;
-                default:
-                    std::cout << "Invalid choice. Please try again." << std::endl;
-            }
-        }
-    } else if (dataType == 1) { // Double matrices
-        Matrix<double> matrix1, matrix2;
-        parseMatrixDataFromString<double>(matrixData, matrixSize, matrix1, matrix2);
-        
-        int choice = 0;
-        while (choice != 8) {
-            std::cout << "\nMatrix Operations Menu:" << std::endl;
-            std::cout << "1. Display matrices" << std::endl;
-            std::cout << "2. Add matrices" << std::endl;
-            std::cout << "3. Multiply matrices" << std::endl;
-            std::cout << "4. Calculate diagonal sums" << std::endl;
-            std::cout << "5. Swap rows" << std::endl;
-            std::cout << "6. Swap columns" << std::endl;
-            std::cout << "7. Update element" << std::endl;
-            std::cout << "8. Exit" << std::endl;
-            std::cout << "Enter your choice: ";
-            std::cin >> choice;
-            
-            switch (choice) {
-                case 1: {
-                    std::cout << "\nMatrix 1:" << std::endl;
-                    std::cout << matrix1;
-                    std::cout << "\nMatrix 2:" << std::endl;
-                    std::cout << matrix2;
-                    break;
-                }
-                case 2: {
-                    try {
-                        Matrix<double> result = matrix1 + matrix2;
-                        std::cout << "\nMatrix 1 + Matrix 2:" << std::endl;
-                        std::cout << result;
-                    } catch (const std::exception& e) {
-                        std::cerr << "Error: " << e.what() << std::endl;
-                    }
-                    break;
-                }
-                case 3: {
-                    try {
-                        Matrix<double> result = matrix1 * matrix2;
-                        std::cout << "\nMatrix 1 * Matrix 2:" << std::endl;
-                        std::cout << result;
-                    } catch (const std::exception& e) {
-                        std::cerr << "Error: " << e.what() << std::endl;
-                    }
-                    break;
-                }
-                case 4: {
-                    auto diagonals1 = matrix1.sumDiagonals();
-                    auto diagonals2 = matrix2.sumDiagonals();
-                    
-                    std::cout << "\nMatrix 1 Diagonals:" << std::endl;
-                    std::cout << "Main diagonal sum: " << diagonals1.first << std::endl;
-                    std::cout << "Secondary diagonal sum: " << diagonals1.second << std::endl;
-                    
-                    std::cout << "\nMatrix 2 Diagonals:" << std::endl;
-                    std::cout << "Main diagonal sum: " << diagonals2.first << std::endl;
-                    std::cout << "Secondary diagonal sum: " << diagonals2.second << std::endl;
-                    break;
-                }
-                case 5: {
-                    int matrixChoice, row1, row2;
-                    std::cout << "Which matrix (1 or 2)? ";
-                    std::cin >> matrixChoice;
-                    std::cout << "Enter the two row indices to swap (0-based): ";
-                    std::cin >> row1 >> row2;
-                    
-                    if (matrixChoice == 1) {
-                        if (matrix1.swapRows(row1, row2)) {
-                            std::cout << "Rows swapped successfully. New Matrix 1:" << std::endl;
-                            std::cout << matrix1;
-                        } else {
-                            std::cout << "Invalid row indices." << std::endl;
-                        }
-                    } else if (matrixChoice == 2) {
-                        if (matrix2.swapRows(row1, row2)) {
-                            std::cout << "Rows swapped successfully. New Matrix 2:" << std::endl;
-                            std::cout << matrix2;
-                        } else {
-                            std::cout << "Invalid row indices." << std::endl;
-                        }
-                    } else {
-                        std::cout << "Invalid matrix choice." << std::endl;
-                    }
-                    break;
-                }
-                case 6: {
-                    int matrixChoice, col1, col2;
-                    std::cout << "Which matrix (1 or 2)? ";
-                    std::cin >> matrixChoice;
-                    std::cout << "Enter the two column indices to swap (0-based): ";
-                    std::cin >> col1 >> col2;
-                    
-                    if (matrixChoice == 1) {
-                        if (matrix1.swapColumns(col1, col2)) {
-                            std::cout << "Columns swapped successfully. New Matrix 1:" << std::endl;
-                            std::cout << matrix1;
-                        } else {
-                            std::cout << "Invalid column indices." << std::endl;
-                        }
-                    } else if (matrixChoice == 2) {
-                        if (matrix2.swapColumns(col1, col2)) {
-                            std::cout << "Columns swapped successfully. New Matrix 2:" << std::endl;
-                            std::cout << matrix2;
-                        } else {
-                            std::cout << "Invalid column indices." << std::endl;
-                        }
-                    } else {
-                        std::cout << "Invalid matrix choice." << std::endl;
-                    }
-                    break;
-                }
-                case 7: {
-                    int matrixChoice, row, col;
-                    double value;
-                    std::cout << "Which matrix (1 or 2)? ";
-                    std::cin >> matrixChoice;
-                    std::cout << "Enter row, column (0-based), and new value: ";
-                    std::cin >> row >> col >> value;
-                    
-                    if (matrixChoice == 1) {
-                        if (matrix1.updateElement(row, col, value)) {
-                            std::cout << "Element updated successfully. New Matrix 1:" << std::endl;
-                            std::cout << matrix1;
-                        } else {
-                            std::cout << "Invalid indices." << std::endl;
-                        }
-                    } else if (matrixChoice == 2) {
-                        if (matrix2.updateElement(row, col, value)) {
-                            std::cout << "Element updated successfully. New Matrix 2:" << std::endl;
-                            std::cout << matrix2;
-                        } else {
-                            std::cout << "Invalid indices." << std::endl;
-                        }
-                    } else {
-                        std::cout << "Invalid matrix choice." << std::endl;
-                    }
-                    break;
-                }
-                case 8:
-                    std::cout << "Exiting program." << std::endl;
-                    break;
-                default:
-                    std::cout << "Invalid choice. Please try again." << std::endl;
-            }
-        }
-    } else {
-        std::cerr << "Error: Invalid matrix type. Type must be 0 (int) or 1 (double)." << std::endl;
+    MenuRunner menu = {loader.get(), source, matrixData, matrixSize, cluster.get(), 0};
+    if (!visitMatrixType(dataType, menu)) {
+        std::cerr << "Error: Invalid matrix type. Type must be " << matrixTypeList() << "." << std::endl;
         return 1;
     }
-    
-    return 0;
+    return menu.status;
 }
\ No newline at end of file
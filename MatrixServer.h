@@ -0,0 +1,496 @@
+// Server mode for matrix_operations
+// `matrix_operations --serve ADDRESS` listens on a Unix-domain ("unix:PATH")
+// or TCP ("HOST:PORT") socket and runs batch commands (see MatrixBatch.h)
+// sent by any number of clients against one set of named matrices, which
+// stay in memory between requests and connections.
+//
+// A request is one line, an id chosen by the client followed by one batch
+// command:
+//
+//     7 multiply c a b
+//
+// Clients may send further requests without waiting. Every request gets one
+// response carrying its id, as soon as it has run:
+//
+//     7 ok BYTES           followed by BYTES of output (diag and print)
+//     7 error MESSAGE
+//
+// Requests run one at a time in the order they arrive, so each sees the
+// effect of everything received before it. A client's responses come back
+// in the order it sent the requests, except that a line that is not a
+// request (no command, or several) is answered as soon as it is read.
+// "quit", with or without an id, closes the connection once its requests are
+// answered (and gets no response); "shutdown" stops the server.
+//
+// Small square multiplies (N = 2, 4, 8 or 16) that arrive together, from one
+// client or several, are coalesced: a run of them on the same element type
+// and size, none reading a matrix that an earlier one in the run writes, is
+// computed with one batchMultiply call (BatchedGemm.h) instead of one
+// Matrix multiply each. When the next request is such a multiply the
+// executor waits SERVER_BATCH_WINDOW_US for others to join it. Floating
+// point results of a coalesced multiply can differ in the last bits from
+// the same multiply run alone, as with batchMultiply itself.
+
+#ifndef MATRIX_SERVER_H
+#define MATRIX_SERVER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "BatchedGemm.h"
+#include "MatrixBatch.h"
+#include "MatrixSocket.h"
+
+// How long the executor waits for more small multiplies to coalesce with
+const int SERVER_BATCH_WINDOW_US = 100;
+
+// Most requests taken from the queue at once
+const std::size_t SERVER_MAX_BATCH = 4096;
+
+// Longest request line accepted
+const std::size_t SERVER_MAX_LINE = std::size_t(1) << 20;
+
+// One client: requests are read on the thread that serves the connection
+// and responses queued here are sent by its writer thread
+class ServerConnection {
+private:
+    MatrixSocket socket;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::string> outbox;
+    std::size_t pending;  // requests not answered yet
+    bool reading;
+
+public:
+    explicit ServerConnection(MatrixSocket&& client) : socket(std::move(client)), pending(0), reading(true) {}
+
+    MatrixSocket& stream() {
+        return socket;
+    }
+
+    // A request was queued; it must be answered with respond
+    void expect() {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending++;
+    }
+
+    void respond(const std::string& id, const std::string& output) {
+        std::ostringstream header;
+        header << id << " ok " << output.size() << '\n';
+        send(header.str() + output);
+    }
+
+    void respondError(const std::string& id, std::string message) {
+        for (std::size_t i = 0; i < message.size(); i++) {
+            if (message[i] == '\n' || message[i] == '\r') {
+                message[i] = ' ';
+            }
+        }
+        send(id + " error " + message + '\n');
+    }
+
+    // No more requests will come
+    void finishReading() {
+        std::lock_guard<std::mutex> lock(mutex);
+        reading = false;
+        changed.notify_all();
+    }
+
+    // Send responses as they are queued until reading has finished and
+    // every request is answered. If the client goes away the rest are
+    // dropped, and its requests still run.
+    void writeResponses() {
+        bool broken = false;
+        for (;;) {
+            std::string next;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this] { return !outbox.empty() || (!reading && pending == 0); });
+                if (outbox.empty()) {
+                    break;
+                }
+                next = std::move(outbox.front());
+                outbox.pop_front();
+            }
+            if (broken) {
+                continue;
+            }
+            try {
+                socket.sendAll(next.data(), next.size());
+            } catch (const MatrixSocketError&) {
+                broken = true;
+                socket.interrupt();  // stop the reader too
+            }
+        }
+        if (!broken) {
+            socket.shutdownWrite();
+        }
+    }
+
+private:
+    void send(std::string text) {
+        std::lock_guard<std::mutex> lock(mutex);
+        outbox.push_back(std::move(text));
+        pending--;
+        changed.notify_all();
+    }
+};
+
+struct ServerRequest {
+    std::shared_ptr<ServerConnection> connection;
+    std::string id;
+    BatchCommand command;
+};
+
+class MatrixServer {
+private:
+    MatrixListener listener;
+    BatchSession session;  // used only by the executor
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<ServerRequest> queue;
+    std::set<ServerConnection*> connections;
+    bool stopping;
+
+    // Rows and columns of a matrix of any element type
+    struct Shape {
+        BatchMatrix& m;
+        int rows;
+        int cols;
+
+        template <typename T>
+        void apply() {
+            rows = batchMatrixData<T>(m).getRows();
+            cols = batchMatrixData<T>(m).getCols();
+        }
+    };
+
+    // Coalesced multiplies requests[begin, end) of N x N matrices
+    struct BatchProduct {
+        MatrixServer& server;
+        std::vector<ServerRequest>& requests;
+        std::size_t begin;
+        std::size_t end;
+        int size;
+
+        template <typename T>
+        void apply() {
+            switch (size) {
+                case 2: server.multiplyBatch<T, 2>(requests, begin, end); break;
+                case 4: server.multiplyBatch<T, 4>(requests, begin, end); break;
+                case 8: server.multiplyBatch<T, 8>(requests, begin, end); break;
+                case 16: server.multiplyBatch<T, 16>(requests, begin, end); break;
+            }
+        }
+    };
+
+    // Element type and size if command is a multiply that can be
+    // coalesced, otherwise false
+    bool smallProduct(const BatchCommand& command, int& dataType, int& size) {
+        if (command.name != "multiply" || command.args.size() != 3) {
+            return false;
+        }
+        BatchMatrix* a = session.lookup(command.args[1]);
+        BatchMatrix* b = session.lookup(command.args[2]);
+        if (!a || !b || a->dataType != b->dataType) {
+            return false;
+        }
+        Shape lhs = {*a, 0, 0};
+        Shape rhs = {*b, 0, 0};
+        if (!visitMatrixType(a->dataType, lhs) || !visitMatrixType(b->dataType, rhs)) {
+            return false;
+        }
+        const int n = lhs.rows;
+        if (lhs.cols != n || rhs.rows != n || rhs.cols != n || (n != 2 && n != 4 && n != 8 && n != 16)) {
+            return false;
+        }
+        dataType = a->dataType;
+        size = n;
+        return true;
+    }
+
+    // As the session's multiply: computed in the accumulator type, integer
+    // products kept there and floating point ones rounded back to T
+    template <typename T, int N>
+    void multiplyBatch(std::vector<ServerRequest>& requests, std::size_t begin, std::size_t end) {
+        typedef typename MatrixAccumulator<T>::type Wide;
+        const std::size_t count = end - begin;
+        SmallMatrixBatch<Wide, N> a(count), b(count), c;
+        for (std::size_t r = 0; r < count; r++) {
+            const BatchCommand& command = requests[begin + r].command;
+            const Matrix<T>& lhs = batchMatrixData<T>(*session.lookup(command.args[1]));
+            const Matrix<T>& rhs = batchMatrixData<T>(*session.lookup(command.args[2]));
+            for (int i = 0; i < N; i++) {
+                const T* lrow = lhs.rowPtr(i);
+                const T* rrow = rhs.rowPtr(i);
+                for (int j = 0; j < N; j++) {
+                    a(r, i, j) = static_cast<Wide>(lrow[j]);
+                    b(r, i, j) = static_cast<Wide>(rrow[j]);
+                }
+            }
+        }
+        batchMultiply(a, b, c);
+        for (std::size_t r = 0; r < count; r++) {
+            const ServerRequest& request = requests[begin + r];
+            BatchMatrix dest;
+            storeProduct<T, N>(c, r, dest, std::is_integral<T>());
+            session.store(request.command.args[0], std::move(dest));
+            request.connection->respond(request.id, std::string());
+        }
+    }
+
+    template <typename T, int N>
+    void storeProduct(const SmallMatrixBatch<typename MatrixAccumulator<T>::type, N>& c, std::size_t r,
+                      BatchMatrix& dest, std::true_type) {
+        typedef typename MatrixAccumulator<T>::type Wide;
+        dest.dataType = MatrixDtype<Wide>::code;
+        batchMatrixData<Wide>(dest) = c.get(r);
+    }
+
+    template <typename T, int N>
+    void storeProduct(const SmallMatrixBatch<typename MatrixAccumulator<T>::type, N>& c, std::size_t r,
+                      BatchMatrix& dest, std::false_type) {
+        Matrix<T> matrix(N);
+        for (int i = 0; i < N; i++) {
+            T* row = matrix.rowPtr(i);
+            for (int j = 0; j < N; j++) {
+                row[j] = static_cast<T>(c(r, i, j));
+            }
+        }
+        dest.dataType = MatrixDtype<T>::code;
+        batchMatrixData<T>(dest) = std::move(matrix);
+    }
+
+    void runOne(const ServerRequest& request) {
+        std::ostringstream output;
+        session.setOutput(output);
+        try {
+            session.execute(request.command);
+        } catch (const BatchError& e) {
+            request.connection->respondError(request.id, e.message());
+            return;
+        } catch (const std::exception& e) {
+            request.connection->respondError(request.id, e.what());
+            return;
+        }
+        request.connection->respond(request.id, output.str());
+    }
+
+    // Run requests in order, coalescing runs of small multiplies; false
+    // once a shutdown request has run
+    bool runRequests(std::vector<ServerRequest>& requests) {
+        std::size_t i = 0;
+        while (i < requests.size()) {
+            const BatchCommand& command = requests[i].command;
+            if (command.name == "shutdown" && command.args.empty()) {
+                requests[i].connection->respond(requests[i].id, std::string());
+                for (std::size_t j = i + 1; j < requests.size(); j++) {
+                    requests[j].connection->respondError(requests[j].id, "server is shutting down");
+                }
+                return false;
+            }
+            int dataType = 0;
+            int size = 0;
+            std::size_t end = i + 1;
+            if (smallProduct(command, dataType, size)) {
+                std::set<std::string> written;
+                written.insert(command.args[0]);
+                int nextType = 0;
+                int nextSize = 0;
+                while (end < requests.size() && smallProduct(requests[end].command, nextType, nextSize) &&
+                       nextType == dataType && nextSize == size && !written.count(requests[end].command.args[1]) &&
+                       !written.count(requests[end].command.args[2])) {
+                    written.insert(requests[end].command.args[0]);
+                    end++;
+                }
+            }
+            if (end - i > 1) {
+                BatchProduct visitor = {*this, requests, i, end, size};
+                visitMatrixType(dataType, visitor);
+            } else {
+                runOne(requests[i]);
+            }
+            i = end;
+        }
+        return true;
+    }
+
+    // Take queued requests and run them until shut down
+    void executeRequests() {
+        std::vector<ServerRequest> taken;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this] { return !queue.empty(); });
+                int dataType = 0;
+                int size = 0;
+                if (queue.size() < SERVER_MAX_BATCH && smallProduct(queue.front().command, dataType, size)) {
+                    changed.wait_for(lock, std::chrono::microseconds(SERVER_BATCH_WINDOW_US),
+                                     [this] { return queue.size() >= SERVER_MAX_BATCH; });
+                }
+                while (!queue.empty() && taken.size() < SERVER_MAX_BATCH) {
+                    taken.push_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+            }
+            const bool more = runRequests(taken);
+            taken.clear();
+            if (!more) {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+                for (std::size_t i = 0; i < queue.size(); i++) {
+                    queue[i].connection->respondError(queue[i].id, "server is shutting down");
+                }
+                queue.clear();
+                return;
+            }
+        }
+    }
+
+    void submit(ServerRequest&& request) {
+        request.connection->expect();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            request.connection->respondError(request.id, "server is shutting down");
+            return;
+        }
+        queue.push_back(std::move(request));
+        changed.notify_all();
+    }
+
+    // Queue the request on line; false if the client asked to quit
+    bool handleLine(const std::shared_ptr<ServerConnection>& connection, std::string line) {
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        std::istringstream in(line);
+        std::string id;
+        if (!(in >> id) || id[0] == '#') {
+            return true;
+        }
+        std::string rest;
+        std::getline(in, rest);
+        std::vector<BatchCommand> commands = parseBatchScript(rest);
+        if (commands.empty() && id == "quit") {
+            return false;
+        }
+        if (commands.size() == 1 && commands[0].name == "quit" && commands[0].args.empty()) {
+            return false;
+        }
+        if (commands.size() != 1) {
+            connection->expect();
+            connection->respondError(id, commands.empty() ? "missing command" : "one command per request");
+            return true;
+        }
+        ServerRequest request = {connection, id, commands[0]};
+        submit(std::move(request));
+        return true;
+    }
+
+    void serveConnection(std::shared_ptr<ServerConnection> connection) {
+        std::thread writer(&ServerConnection::writeResponses, connection.get());
+        std::string buffered;
+        std::vector<char> chunk(1 << 16);
+        try {
+            bool open = true;
+            while (open) {
+                const std::size_t got = connection->stream().receiveSome(chunk.data(), chunk.size());
+                if (got == 0) {
+                    break;
+                }
+                buffered.append(chunk.data(), got);
+                std::size_t start = 0;
+                std::size_t newline;
+                while (open && (newline = buffered.find('\n', start)) != std::string::npos) {
+                    open = handleLine(connection, buffered.substr(start, newline - start));
+                    start = newline + 1;
+                }
+                buffered.erase(0, start);
+                if (buffered.size() > SERVER_MAX_LINE) {
+                    break;
+                }
+            }
+        } catch (const MatrixSocketError&) {
+            // The client went away; answers to its queued requests are dropped
+        }
+        connection->finishReading();
+        writer.join();
+        std::lock_guard<std::mutex> lock(mutex);
+        connections.erase(connection.get());
+        changed.notify_all();
+    }
+
+    void acceptConnections() {
+        for (;;) {
+            MatrixSocket client;
+            try {
+                client = listener.accept();
+            } catch (const MatrixSocketError& e) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (stopping) {
+                    return;
+                }
+                std::cerr << "Error: " << e.what() << std::endl;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            std::shared_ptr<ServerConnection> connection = std::make_shared<ServerConnection>(std::move(client));
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                return;
+            }
+            connections.insert(connection.get());
+            std::thread(&MatrixServer::serveConnection, this, connection).detach();
+        }
+    }
+
+public:
+    explicit MatrixServer(const std::string& address)
+        : listener(address), session(std::cout), stopping(false) {}
+
+    // Run multiply on the workers of a cluster (see BatchSession::useCluster)
+    void useCluster(MatrixCluster* workers) {
+        session.useCluster(workers);
+    }
+
+    // Serve until a client sends shutdown; then stop reading from every
+    // client and return once their answers are sent
+    void run() {
+        std::thread acceptor(&MatrixServer::acceptConnections, this);
+        executeRequests();
+        listener.interrupt();
+        acceptor.join();
+        std::unique_lock<std::mutex> lock(mutex);
+        for (std::set<ServerConnection*>::iterator it = connections.begin(); it != connections.end(); ++it) {
+            (*it)->stream().shutdownRead();
+        }
+        changed.wait(lock, [this] { return connections.empty(); });
+    }
+};
+
+inline int runMatrixServer(const std::string& address, MatrixCluster* cluster) {
+    try {
+        MatrixServer server(address);
+        server.useCluster(cluster);
+        server.run();
+    } catch (const std::exception& e) {
+        std::cerr << "Error: server " << address << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+#endif // MATRIX_SERVER_H
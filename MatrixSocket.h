@@ -0,0 +1,429 @@
+// Stream sockets for the multi-process modes
+// MatrixSocket is a connected Unix-domain or TCP stream socket with blocking
+// whole-message sends and receives; MatrixListener accepts them. Addresses
+// are "unix:PATH" for a Unix-domain socket and "HOST:PORT" for TCP. Both
+// ends are expected to run on machines of the same byte order (the peers
+// compare MATRIX_BINARY_ENDIAN_TAG when they meet). Failures throw
+// MatrixSocketError.
+
+#ifndef MATRIX_SOCKET_H
+#define MATRIX_SOCKET_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "MatrixStorage.h"
+
+class MatrixSocketError : public std::runtime_error {
+public:
+    explicit MatrixSocketError(const std::string& message) : std::runtime_error(message) {}
+};
+
+inline void matrixSocketFail(const std::string& what) {
+    throw MatrixSocketError(what + ": " + std::strerror(errno));
+}
+
+// Bytes staged per send or receive when a block is not contiguous
+const std::size_t MATRIX_SOCKET_CHUNK = std::size_t(1) << 20;
+
+// A parsed "unix:PATH" or "HOST:PORT" address
+struct MatrixAddress {
+    bool unixDomain;
+    std::string path;  // unix
+    std::string host;  // tcp
+    std::string port;
+
+    static MatrixAddress parse(const std::string& text) {
+        MatrixAddress address;
+        if (text.compare(0, 5, "unix:") == 0) {
+            address.unixDomain = true;
+            address.path = text.substr(5);
+            if (address.path.empty() || address.path.size() >= sizeof(sockaddr_un().sun_path)) {
+                throw MatrixSocketError("Invalid socket path in " + text);
+            }
+            return address;
+        }
+        const std::size_t colon = text.rfind(':');
+        if (colon == std::string::npos || colon + 1 == text.size()) {
+            throw MatrixSocketError("Invalid address " + text + " (expected unix:PATH or HOST:PORT)");
+        }
+        address.unixDomain = false;
+        address.host = text.substr(0, colon);
+        address.port = text.substr(colon + 1);
+        return address;
+    }
+};
+
+class MatrixSocket {
+private:
+    int fd;
+
+    static sockaddr_un unixAddress(const MatrixAddress& address) {
+        sockaddr_un un;
+        std::memset(&un, 0, sizeof(un));
+        un.sun_family = AF_UNIX;
+        std::memcpy(un.sun_path, address.path.c_str(), address.path.size());
+        return un;
+    }
+
+    // Connect once; -1 with errno set on failure
+    static int tryConnect(const MatrixAddress& address) {
+        if (address.unixDomain) {
+            int s = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (s < 0) {
+                return -1;
+            }
+            sockaddr_un un = unixAddress(address);
+            if (::connect(s, reinterpret_cast<sockaddr*>(&un), sizeof(un)) != 0) {
+                int saved = errno;
+                ::close(s);
+                errno = saved;
+                return -1;
+            }
+            return s;
+        }
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (::getaddrinfo(address.host.c_str(), address.port.c_str(), &hints, &found) != 0) {
+            errno = EHOSTUNREACH;
+            return -1;
+        }
+        int s = -1;
+        for (addrinfo* ai = found; ai && s < 0; ai = ai->ai_next) {
+            s = ::socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+            if (s >= 0 && ::connect(s, ai->ai_addr, ai->ai_addrlen) != 0) {
+                int saved = errno;
+                ::close(s);
+                errno = saved;
+                s = -1;
+            }
+        }
+        ::freeaddrinfo(found);
+        if (s >= 0) {
+            int one = 1;
+            ::setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        return s;
+    }
+
+public:
+    MatrixSocket() : fd(-1) {}
+
+    explicit MatrixSocket(int handle) : fd(handle) {}
+
+    MatrixSocket(MatrixSocket&& other) noexcept : fd(other.fd) {
+        other.fd = -1;
+    }
+
+    MatrixSocket& operator=(MatrixSocket&& other) noexcept {
+        std::swap(fd, other.fd);
+        return *this;
+    }
+
+    MatrixSocket(const MatrixSocket&) = delete;
+    MatrixSocket& operator=(const MatrixSocket&) = delete;
+
+    ~MatrixSocket() {
+        close();
+    }
+
+    // Connect to address, retrying for up to timeoutMs while nothing is
+    // listening there yet (a worker that is still starting)
+    static MatrixSocket connect(const std::string& text, int timeoutMs = 0) {
+        const MatrixAddress address = MatrixAddress::parse(text);
+        const std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        for (;;) {
+            int s = tryConnect(address);
+            if (s >= 0) {
+                return MatrixSocket(s);
+            }
+            const bool notYet = errno == ENOENT || errno == ECONNREFUSED;
+            if (!notYet || std::chrono::steady_clock::now() >= deadline) {
+                matrixSocketFail("Could not connect to " + text);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    bool isOpen() const {
+        return fd >= 0;
+    }
+
+    void close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    // No more sends; the peer sees end of stream once it has read the rest
+    void shutdownWrite() {
+        ::shutdown(fd, SHUT_WR);
+    }
+
+    // No more receives; a blocked receive returns end of stream
+    void shutdownRead() {
+        ::shutdown(fd, SHUT_RD);
+    }
+
+    // Make blocked and later sends and receives fail, from any thread
+    void interrupt() {
+        if (fd >= 0) {
+            ::shutdown(fd, SHUT_RDWR);
+        }
+    }
+
+    void sendAll(const void* data, std::size_t bytes) {
+        const char* p = static_cast<const char*>(data);
+        while (bytes > 0) {
+            ssize_t put = ::send(fd, p, bytes, MSG_NOSIGNAL);
+            if (put < 0 && errno == EINTR) {
+                continue;
+            }
+            if (put <= 0) {
+                matrixSocketFail("Could not send");
+            }
+            p += put;
+            bytes -= static_cast<std::size_t>(put);
+        }
+    }
+
+    // Receive what is available, up to bytes, waiting for at least one;
+    // 0 at the end of the stream
+    std::size_t receiveSome(void* data, std::size_t bytes) {
+        for (;;) {
+            ssize_t got = ::recv(fd, data, bytes, 0);
+            if (got >= 0) {
+                return static_cast<std::size_t>(got);
+            }
+            if (errno != EINTR) {
+                matrixSocketFail("Could not receive");
+            }
+        }
+    }
+
+    // Receive exactly bytes; false if the stream ends before the first byte
+    bool receiveAll(void* data, std::size_t bytes) {
+        char* p = static_cast<char*>(data);
+        const std::size_t wanted = bytes;
+        while (bytes > 0) {
+            ssize_t got = ::recv(fd, p, bytes, 0);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got < 0) {
+                matrixSocketFail("Could not receive");
+            }
+            if (got == 0) {
+                if (bytes == wanted) {
+                    return false;
+                }
+                throw MatrixSocketError("Connection closed in the middle of a message");
+            }
+            p += got;
+            bytes -= static_cast<std::size_t>(got);
+        }
+        return true;
+    }
+
+    // Like receiveAll, but the stream must not end here
+    void receiveExactly(void* data, std::size_t bytes) {
+        if (!receiveAll(data, bytes)) {
+            throw MatrixSocketError("Connection closed by the peer");
+        }
+    }
+
+    template <typename V>
+    void send(const V& value) {
+        sendAll(&value, sizeof(value));
+    }
+
+    template <typename V>
+    V receive() {
+        V value;
+        receiveExactly(&value, sizeof(value));
+        return value;
+    }
+
+    void sendString(const std::string& text) {
+        send<std::uint32_t>(static_cast<std::uint32_t>(text.size()));
+        sendAll(text.data(), text.size());
+    }
+
+    std::string receiveString() {
+        std::string text(receive<std::uint32_t>(), '\0');
+        if (!text.empty()) {
+            receiveExactly(&text[0], text.size());
+        }
+        return text;
+    }
+
+    // The rows of a block, in order, without padding
+    template <typename T>
+    void sendBlock(const MatrixBlock<const T>& block) {
+        const std::size_t rowBytes = static_cast<std::size_t>(block.cols) * sizeof(T);
+        if (rowBytes == 0) {
+            return;
+        }
+        if (!block.rowIndex && (block.rows == 1 || block.stride == static_cast<std::size_t>(block.cols))) {
+            sendAll(block.base, rowBytes * block.rows);
+            return;
+        }
+        std::vector<char> staging(std::max(rowBytes, MATRIX_SOCKET_CHUNK));
+        std::size_t used = 0;
+        for (int i = 0; i < block.rows; i++) {
+            if (used + rowBytes > staging.size()) {
+                sendAll(staging.data(), used);
+                used = 0;
+            }
+            std::memcpy(staging.data() + used, block.rowPtr(i), rowBytes);
+            used += rowBytes;
+        }
+        sendAll(staging.data(), used);
+    }
+
+    // Fill a block from rows sent by sendBlock
+    template <typename T>
+    void receiveBlock(const MatrixBlock<T>& block) {
+        const std::size_t rowBytes = static_cast<std::size_t>(block.cols) * sizeof(T);
+        if (rowBytes == 0) {
+            return;
+        }
+        if (!block.rowIndex && (block.rows == 1 || block.stride == static_cast<std::size_t>(block.cols))) {
+            receiveExactly(block.base, rowBytes * block.rows);
+            return;
+        }
+        const int rowsPerChunk = static_cast<int>(std::max<std::size_t>(1, MATRIX_SOCKET_CHUNK / rowBytes));
+        std::vector<char> staging(rowBytes * std::min(rowsPerChunk, block.rows));
+        for (int i0 = 0; i0 < block.rows; i0 += rowsPerChunk) {
+            const int count = std::min(rowsPerChunk, block.rows - i0);
+            receiveExactly(staging.data(), rowBytes * count);
+            for (int i = 0; i < count; i++) {
+                std::memcpy(block.rowPtr(i0 + i), staging.data() + rowBytes * i, rowBytes);
+            }
+        }
+    }
+};
+
+// Listening socket; a Unix-domain socket file is removed again on close
+class MatrixListener {
+private:
+    int fd;
+    std::string socketPath;
+
+public:
+    explicit MatrixListener(const std::string& text) : fd(-1) {
+        const MatrixAddress address = MatrixAddress::parse(text);
+        if (address.unixDomain) {
+            fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                matrixSocketFail("Could not create socket");
+            }
+            sockaddr_un un;
+            std::memset(&un, 0, sizeof(un));
+            un.sun_family = AF_UNIX;
+            std::memcpy(un.sun_path, address.path.c_str(), address.path.size());
+            ::unlink(address.path.c_str());
+            if (::bind(fd, reinterpret_cast<sockaddr*>(&un), sizeof(un)) != 0) {
+                int saved = errno;
+                ::close(fd);
+                errno = saved;
+                matrixSocketFail("Could not listen on " + text);
+            }
+            socketPath = address.path;
+        } else {
+            addrinfo hints;
+            std::memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = AI_PASSIVE;
+            addrinfo* found = nullptr;
+            const char* host = address.host.empty() || address.host == "*" ? nullptr : address.host.c_str();
+            if (::getaddrinfo(host, address.port.c_str(), &hints, &found) != 0 || !found) {
+                throw MatrixSocketError("Could not resolve " + text);
+            }
+            fd = ::socket(found->ai_family, found->ai_socktype | SOCK_CLOEXEC, found->ai_protocol);
+            int one = 1;
+            if (fd < 0 || ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+                ::bind(fd, found->ai_addr, found->ai_addrlen) != 0) {
+                int saved = errno;
+                ::freeaddrinfo(found);
+                if (fd >= 0) {
+                    ::close(fd);
+                }
+                errno = saved;
+                matrixSocketFail("Could not listen on " + text);
+            }
+            ::freeaddrinfo(found);
+        }
+        if (::listen(fd, 128) != 0) {
+            int saved = errno;
+            close();
+            errno = saved;
+            matrixSocketFail("Could not listen on " + text);
+        }
+    }
+
+    MatrixListener(const MatrixListener&) = delete;
+    MatrixListener& operator=(const MatrixListener&) = delete;
+
+    ~MatrixListener() {
+        close();
+    }
+
+    void close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+            if (!socketPath.empty()) {
+                ::unlink(socketPath.c_str());
+            }
+        }
+    }
+
+    // Make a blocked accept fail, from any thread
+    void interrupt() {
+        if (fd >= 0) {
+            ::shutdown(fd, SHUT_RDWR);
+        }
+    }
+
+    MatrixSocket accept() {
+        for (;;) {
+            int s = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (s >= 0) {
+                int one = 1;
+                ::setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));  // fails harmlessly on Unix sockets
+                return MatrixSocket(s);
+            }
+            if (errno != EINTR && errno != ECONNABORTED) {
+                matrixSocketFail("Could not accept a connection");
+            }
+        }
+    }
+
+    int handle() const {
+        return fd;
+    }
+};
+
+#endif // MATRIX_SOCKET_H
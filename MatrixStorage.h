@@ -0,0 +1,173 @@
+// Storage building blocks for Matrix<T>: aligned buffers and non-owning views
+
+#ifndef MATRIX_STORAGE_H
+#define MATRIX_STORAGE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "MatrixAllocator.h"
+
+// Row stride (in elements) used for an n-column matrix of T: rows are padded
+// so that each one starts on a cache line
+template <typename T>
+int matrixRowStride(int n) {
+    const int perLine = static_cast<int>(MATRIX_CACHE_LINE / sizeof(T));
+    if (perLine <= 1) {
+        return n;
+    }
+    return (n + perLine - 1) / perLine * perLine;
+}
+
+// Cache-line-aligned array of T. It normally owns its memory, taken from a
+// MatrixAllocator (MatrixAllocator::current() unless one is given); it can
+// also borrow external memory (such as a file mapping) that stays alive for
+// as long as the keepAlive handle does. Copies are always owned.
+template <typename T>
+class AlignedBuffer {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "AlignedBuffer only holds trivially copyable element types");
+
+private:
+    T* ptr;
+    std::size_t count;
+    MatrixAllocator* allocator;      // owner of ptr, null when borrowed or empty
+    std::shared_ptr<void> external;  // set when the memory is borrowed
+
+    static T* allocate(std::size_t n, MatrixAllocator& source) {
+        if (n == 0) {
+            return nullptr;
+        }
+        return static_cast<T*>(source.allocate(byteSize(n)));
+    }
+
+    static std::size_t byteSize(std::size_t n) {
+        std::size_t bytes = n * sizeof(T);
+        return (bytes + MATRIX_CACHE_LINE - 1) / MATRIX_CACHE_LINE * MATRIX_CACHE_LINE;
+    }
+
+public:
+    AlignedBuffer() : ptr(nullptr), count(0), allocator(nullptr) {}
+
+    explicit AlignedBuffer(std::size_t n, MatrixAllocator& source = MatrixAllocator::current())
+        : ptr(allocate(n, source)), count(n), allocator(n ? &source : nullptr) {
+        std::fill_n(ptr, n, T());
+    }
+
+    // Borrow n elements at data, kept valid by keepAlive
+    AlignedBuffer(T* data, std::size_t n, std::shared_ptr<void> keepAlive)
+        : ptr(data), count(n), allocator(nullptr), external(std::move(keepAlive)) {}
+
+    AlignedBuffer(const AlignedBuffer& other)
+        : ptr(allocate(other.count, MatrixAllocator::current())), count(other.count),
+          allocator(count ? &MatrixAllocator::current() : nullptr) {
+        std::copy(other.ptr, other.ptr + count, ptr);
+    }
+
+    AlignedBuffer(AlignedBuffer&& other) noexcept
+        : ptr(other.ptr), count(other.count), allocator(other.allocator), external(std::move(other.external)) {
+        other.ptr = nullptr;
+        other.count = 0;
+        other.allocator = nullptr;
+    }
+
+    AlignedBuffer& operator=(AlignedBuffer other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~AlignedBuffer() {
+        if (allocator) {
+            allocator->deallocate(ptr, byteSize(count));
+        }
+    }
+
+    void swap(AlignedBuffer& other) noexcept {
+        std::swap(ptr, other.ptr);
+        std::swap(count, other.count);
+        std::swap(allocator, other.allocator);
+        external.swap(other.external);
+    }
+
+    // True when the memory is borrowed rather than owned
+    bool isBorrowed() const { return static_cast<bool>(external); }
+
+    T* data() { return ptr; }
+    const T* data() const { return ptr; }
+    std::size_t size() const { return count; }
+};
+
+// Non-owning view of one matrix row; the row is contiguous in memory.
+// Use MatrixRowView<const T> for read-only access.
+template <typename T>
+class MatrixRowView {
+private:
+    T* ptr;
+    int length;
+
+public:
+    MatrixRowView(T* rowData, int n) : ptr(rowData), length(n) {}
+
+    T& operator[](int col) const { return ptr[col]; }
+    int size() const { return length; }
+    T* data() const { return ptr; }
+    T* begin() const { return ptr; }
+    T* end() const { return ptr + length; }
+};
+
+// Non-owning view of one matrix column; elements are a stride apart and
+// follow the matrix's row-permutation index (null for consecutive rows).
+template <typename T>
+class MatrixColumnView {
+private:
+    T* base;
+    const int* rowIndex;
+    std::size_t stride;
+    int col;
+    int length;
+
+public:
+    MatrixColumnView(T* data, const int* rows, std::size_t rowStride, int column, int n)
+        : base(data), rowIndex(rows), stride(rowStride), col(column), length(n) {}
+
+    T& operator[](int row) const { return base[(rowIndex ? rowIndex[row] : row) * stride + col]; }
+    int size() const { return length; }
+};
+
+// Non-owning strided block of matrix storage, used by the compute kernels.
+// rowIndex maps block rows to physical rows; null means rows are consecutive.
+template <typename T>
+struct MatrixBlock {
+    T* base;
+    const int* rowIndex;
+    std::size_t stride;
+    int rows;
+    int cols;
+
+    MatrixBlock(T* data, const int* rowOrder, std::size_t rowStride, int nRows, int nCols)
+        : base(data), rowIndex(rowOrder), stride(rowStride), rows(nRows), cols(nCols) {}
+
+    // A mutable block converts to a read-only one
+    template <typename U>
+    MatrixBlock(const MatrixBlock<U>& other)
+        : base(other.base), rowIndex(other.rowIndex), stride(other.stride),
+          rows(other.rows), cols(other.cols) {}
+
+    T* rowPtr(int r) const {
+        return base + static_cast<std::size_t>(rowIndex ? rowIndex[r] : r) * stride;
+    }
+
+    // Sub-block starting at (r0, c0)
+    MatrixBlock sub(int r0, int c0, int nRows, int nCols) const {
+        if (rowIndex) {
+            return MatrixBlock(base + c0, rowIndex + r0, stride, nRows, nCols);
+        }
+        return MatrixBlock(base + static_cast<std::size_t>(r0) * stride + c0, nullptr,
+                           stride, nRows, nCols);
+    }
+};
+
+#endif // MATRIX_STORAGE_H
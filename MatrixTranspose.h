@@ -0,0 +1,113 @@
+// Cache-oblivious transpose kernels
+// A block is split in half along its longer side until the pieces are at
+// most MATRIX_TRANSPOSE_TILE on a side. Some level of the recursion fits
+// each level of the cache hierarchy, so both the rows read and the columns
+// written stay cached without tuning for a particular cache size.
+
+#ifndef MATRIX_TRANSPOSE_H
+#define MATRIX_TRANSPOSE_H
+
+#include <algorithm>
+#include <utility>
+
+#include "MatrixStorage.h"
+#include "ThreadPool.h"
+
+// Side of the tiles at the bottom of the recursion
+const int MATRIX_TRANSPOSE_TILE = 32;
+
+// Elements below which a transpose runs on the calling thread only
+const long MATRIX_TRANSPOSE_PARALLEL = 1L << 18;
+
+// dst += src^T, where src is dst.cols x dst.rows
+template <typename T>
+void transposeAddRecursive(const MatrixBlock<const T>& src, const MatrixBlock<T>& dst) {
+    if (dst.rows <= MATRIX_TRANSPOSE_TILE && dst.cols <= MATRIX_TRANSPOSE_TILE) {
+        const T* columns[MATRIX_TRANSPOSE_TILE];
+        for (int j = 0; j < dst.cols; j++) {
+            columns[j] = src.rowPtr(j);
+        }
+        for (int i = 0; i < dst.rows; i++) {
+            T* out = dst.rowPtr(i);
+            for (int j = 0; j < dst.cols; j++) {
+                out[j] += columns[j][i];
+            }
+        }
+        return;
+    }
+    if (dst.rows >= dst.cols) {
+        const int h = dst.rows / 2;
+        transposeAddRecursive(src.sub(0, 0, src.rows, h), dst.sub(0, 0, h, dst.cols));
+        transposeAddRecursive(src.sub(0, h, src.rows, src.cols - h), dst.sub(h, 0, dst.rows - h, dst.cols));
+    } else {
+        const int h = dst.cols / 2;
+        transposeAddRecursive(src.sub(0, 0, h, src.cols), dst.sub(0, 0, dst.rows, h));
+        transposeAddRecursive(src.sub(h, 0, src.rows - h, src.cols), dst.sub(0, h, dst.rows, dst.cols - h));
+    }
+}
+
+// dst += src^T. Large transposes are split into strips of dst rows that run
+// on the thread pool. src and dst must not overlap.
+template <typename T>
+void transposeAdd(const MatrixBlock<const T>& src, const MatrixBlock<T>& dst) {
+    const long elements = static_cast<long>(dst.rows) * dst.cols;
+    const int threads = ThreadPool::instance().threadCount();
+    if (elements < MATRIX_TRANSPOSE_PARALLEL || threads == 1) {
+        transposeAddRecursive(src, dst);
+        return;
+    }
+    const int tasks = threads * 4;
+    int strip = (dst.rows + tasks - 1) / tasks;
+    strip = (strip + MATRIX_TRANSPOSE_TILE - 1) / MATRIX_TRANSPOSE_TILE * MATRIX_TRANSPOSE_TILE;
+    const int strips = (dst.rows + strip - 1) / strip;
+    ThreadPool::instance().parallelFor(strips, [&](int s) {
+        const int r0 = s * strip;
+        const int rows = std::min(strip, dst.rows - r0);
+        transposeAddRecursive(src.sub(0, r0, src.rows, rows), dst.sub(r0, 0, rows, dst.cols));
+    });
+}
+
+// Swap a with b^T, where a is r x c and b is c x r
+template <typename T>
+void transposeSwap(const MatrixBlock<T>& a, const MatrixBlock<T>& b) {
+    if (a.rows <= MATRIX_TRANSPOSE_TILE && a.cols <= MATRIX_TRANSPOSE_TILE) {
+        for (int i = 0; i < a.rows; i++) {
+            T* row = a.rowPtr(i);
+            for (int j = 0; j < a.cols; j++) {
+                std::swap(row[j], b.rowPtr(j)[i]);
+            }
+        }
+        return;
+    }
+    if (a.rows >= a.cols) {
+        const int h = a.rows / 2;
+        transposeSwap(a.sub(0, 0, h, a.cols), b.sub(0, 0, b.rows, h));
+        transposeSwap(a.sub(h, 0, a.rows - h, a.cols), b.sub(0, h, b.rows, b.cols - h));
+    } else {
+        const int h = a.cols / 2;
+        transposeSwap(a.sub(0, 0, a.rows, h), b.sub(0, 0, h, b.cols));
+        transposeSwap(a.sub(0, h, a.rows, a.cols - h), b.sub(h, 0, b.rows - h, b.cols));
+    }
+}
+
+// Transpose a square block in place: transpose the diagonal quadrants and
+// swap the off-diagonal ones with each other's transpose
+template <typename T>
+void transposeInPlace(const MatrixBlock<T>& m) {
+    const int n = m.rows;
+    if (n <= MATRIX_TRANSPOSE_TILE) {
+        for (int i = 0; i < n; i++) {
+            T* row = m.rowPtr(i);
+            for (int j = i + 1; j < n; j++) {
+                std::swap(row[j], m.rowPtr(j)[i]);
+            }
+        }
+        return;
+    }
+    const int h = n / 2;
+    transposeInPlace(m.sub(0, 0, h, h));
+    transposeInPlace(m.sub(h, h, n - h, n - h));
+    transposeSwap(m.sub(0, h, h, n - h), m.sub(h, 0, n - h, h));
+}
+
+#endif // MATRIX_TRANSPOSE_H
@@ -0,0 +1,214 @@
+// Element types and their accumulators
+// A matrix file names its element type by a code in its header (the second
+// number of the text format, the dtype field of .mtxb). MatrixDtype maps
+// types to codes and visitMatrixType calls back with the type of a code.
+//
+// Sums and products of narrow types are accumulated in a wider type,
+// MatrixAccumulator<T>: sumDiagonals returns it and multiplyWide produces
+// it, so int8 and int16 sum in int, int in int64 and bfloat16 in float.
+// Other types accumulate in themselves.
+
+#ifndef MATRIX_TYPES_H
+#define MATRIX_TYPES_H
+
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+
+// bfloat16: the upper half of an IEEE float (8 exponent bits, 7 mantissa
+// bits). It is a storage format: arithmetic converts to float, so
+// expressions of BFloat16 values are computed in float and rounded (to
+// nearest even) only when stored back.
+class BFloat16 {
+private:
+    std::uint16_t bits;
+
+public:
+    BFloat16() : bits(0) {}
+
+    BFloat16(float value) {
+        std::uint32_t word;
+        std::memcpy(&word, &value, sizeof(word));
+        if ((word & 0x7fffffffu) > 0x7f800000u) {
+            bits = static_cast<std::uint16_t>((word >> 16) | 0x40);  // keep NaN quiet
+        } else {
+            bits = static_cast<std::uint16_t>((word + 0x7fffu + ((word >> 16) & 1)) >> 16);
+        }
+    }
+
+    operator float() const {
+        std::uint32_t word = static_cast<std::uint32_t>(bits) << 16;
+        float value;
+        std::memcpy(&value, &word, sizeof(value));
+        return value;
+    }
+
+    BFloat16& operator+=(float value) {
+        return *this = float(*this) + value;
+    }
+
+    BFloat16& operator-=(float value) {
+        return *this = float(*this) - value;
+    }
+
+    BFloat16& operator*=(float value) {
+        return *this = float(*this) * value;
+    }
+};
+
+inline std::istream& operator>>(std::istream& in, BFloat16& value) {
+    float f;
+    if (in >> f) {
+        value = f;
+    }
+    return in;
+}
+
+inline std::ostream& operator<<(std::ostream& out, BFloat16 value) {
+    return out << float(value);
+}
+
+// Element type codes, shared by the text header and the binary format
+enum MatrixTypeCode {
+    MATRIX_TYPE_INT = 0,
+    MATRIX_TYPE_DOUBLE = 1,
+    MATRIX_TYPE_FLOAT = 2,
+    MATRIX_TYPE_INT64 = 3,
+    MATRIX_TYPE_INT8 = 4,
+    MATRIX_TYPE_INT16 = 5,
+    MATRIX_TYPE_BFLOAT16 = 6
+};
+
+inline const char* matrixTypeName(int code) {
+    switch (code) {
+        case MATRIX_TYPE_INT: return "int";
+        case MATRIX_TYPE_DOUBLE: return "double";
+        case MATRIX_TYPE_FLOAT: return "float";
+        case MATRIX_TYPE_INT64: return "int64";
+        case MATRIX_TYPE_INT8: return "int8";
+        case MATRIX_TYPE_INT16: return "int16";
+        case MATRIX_TYPE_BFLOAT16: return "bfloat16";
+        default: return "unknown";
+    }
+}
+
+// "0 (int), 1 (double), ..." for error messages
+inline const char* matrixTypeList() {
+    return "0 (int), 1 (double), 2 (float), 3 (int64), 4 (int8), 5 (int16) or 6 (bfloat16)";
+}
+
+template <typename T>
+struct MatrixDtype;
+
+template <>
+struct MatrixDtype<int> {
+    static const std::uint32_t code = MATRIX_TYPE_INT;
+};
+
+template <>
+struct MatrixDtype<double> {
+    static const std::uint32_t code = MATRIX_TYPE_DOUBLE;
+};
+
+template <>
+struct MatrixDtype<float> {
+    static const std::uint32_t code = MATRIX_TYPE_FLOAT;
+};
+
+template <>
+struct MatrixDtype<std::int64_t> {
+    static const std::uint32_t code = MATRIX_TYPE_INT64;
+};
+
+template <>
+struct MatrixDtype<std::int8_t> {
+    static const std::uint32_t code = MATRIX_TYPE_INT8;
+};
+
+template <>
+struct MatrixDtype<std::int16_t> {
+    static const std::uint32_t code = MATRIX_TYPE_INT16;
+};
+
+template <>
+struct MatrixDtype<BFloat16> {
+    static const std::uint32_t code = MATRIX_TYPE_BFLOAT16;
+};
+
+// Call fn.template apply<T>() with the element type of code; false if the
+// code is unknown
+template <typename Fn>
+bool visitMatrixType(int code, Fn& fn) {
+    switch (code) {
+        case MATRIX_TYPE_INT: fn.template apply<int>(); return true;
+        case MATRIX_TYPE_DOUBLE: fn.template apply<double>(); return true;
+        case MATRIX_TYPE_FLOAT: fn.template apply<float>(); return true;
+        case MATRIX_TYPE_INT64: fn.template apply<std::int64_t>(); return true;
+        case MATRIX_TYPE_INT8: fn.template apply<std::int8_t>(); return true;
+        case MATRIX_TYPE_INT16: fn.template apply<std::int16_t>(); return true;
+        case MATRIX_TYPE_BFLOAT16: fn.template apply<BFloat16>(); return true;
+        default: return false;
+    }
+}
+
+// Bytes per element of an integer type code, 0 for floating point types
+inline int matrixIntegerBytes(int code) {
+    switch (code) {
+        case MATRIX_TYPE_INT8: return 1;
+        case MATRIX_TYPE_INT16: return 2;
+        case MATRIX_TYPE_INT: return 4;
+        case MATRIX_TYPE_INT64: return 8;
+        default: return 0;
+    }
+}
+
+// Type that sums and products of T are accumulated in
+template <typename T>
+struct MatrixAccumulator {
+    typedef T type;
+};
+
+template <>
+struct MatrixAccumulator<std::int8_t> {
+    typedef int type;
+};
+
+template <>
+struct MatrixAccumulator<std::int16_t> {
+    typedef int type;
+};
+
+template <>
+struct MatrixAccumulator<int> {
+    typedef std::int64_t type;
+};
+
+template <>
+struct MatrixAccumulator<BFloat16> {
+    typedef float type;
+};
+
+// Type a value of T is read and written as in text, so that int8 values
+// are numbers rather than characters
+template <typename T>
+struct MatrixTextType {
+    typedef T type;
+};
+
+template <>
+struct MatrixTextType<std::int8_t> {
+    typedef int type;
+};
+
+template <>
+struct MatrixTextType<std::int16_t> {
+    typedef int type;
+};
+
+template <>
+struct MatrixTextType<BFloat16> {
+    typedef float type;
+};
+
+#endif // MATRIX_TYPES_H
@@ -0,0 +1,341 @@
+// Buffered text output for matrices
+// MatrixWriter formats elements straight into a large buffer and hands it to
+// the destination in big writes: an ostream (one write() per buffer instead
+// of a setw/setprecision round trip per element and a flush per row), or a
+// file descriptor, so a large result can go to a file or pipe without
+// passing through iostreams at all.
+//
+// The format is the one operator<< has always produced: integers right-aligned
+// in 4 columns, other types in 8, floating point fixed with 2 decimals, and
+// '\n' after every row. Doubles are formatted exactly, with the same
+// round-half-even on exact ties as printf("%8.2f"), so the output is
+// byte-identical; NaN, infinities and magnitudes of 2^57 and up go through
+// snprintf.
+
+#ifndef MATRIX_WRITER_H
+#define MATRIX_WRITER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <atomic>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "MatrixTypes.h"
+
+// Largest buffer a MatrixWriter grows to before writing it out
+const std::size_t MATRIX_WRITE_BUFFER = std::size_t(1) << 20;
+
+// Room reserved for one formatted element: enough for any double in %.2f
+const std::size_t MATRIX_ELEMENT_MAX = 400;
+
+// Column width of an element, as the stream operator has always used it
+template <typename T>
+struct MatrixElementWidth {
+    static const int value = std::is_integral<T>::value ? 4 : 8;
+};
+
+// "00" to "99", for writing two digits at a time
+const char MATRIX_DIGIT_PAIRS[] =
+    "0001020304050607080910111213141516171819202122232425262728293031323334353637383940414243444546474849"
+    "5051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+inline int matrixDigitCount(unsigned long long value) {
+    int n = 1;
+    for (; value >= 10000; value /= 10000) {
+        n += 4;
+    }
+    return n + (value >= 10) + (value >= 100) + (value >= 1000);
+}
+
+// Write [-]magnitude right-aligned in width columns, followed by suffix
+// (suffixLength characters, e.g. ".25"); returns the end of the text
+inline char* formatMatrixNumber(char* p, unsigned long long magnitude, bool negative, int width,
+                                const char* suffix, int suffixLength) {
+    const int length = matrixDigitCount(magnitude) + negative + suffixLength;
+    for (int pad = width - length; pad > 0; pad--) {
+        *p++ = ' ';
+    }
+    char* end = p + length;
+    char* q = end - suffixLength;
+    std::memcpy(q, suffix, suffixLength);
+    while (magnitude >= 100) {
+        q -= 2;
+        std::memcpy(q, MATRIX_DIGIT_PAIRS + 2 * (magnitude % 100), 2);
+        magnitude /= 100;
+    }
+    if (magnitude >= 10) {
+        q -= 2;
+        std::memcpy(q, MATRIX_DIGIT_PAIRS + 2 * magnitude, 2);
+    } else {
+        *--q = static_cast<char>('0' + magnitude);
+    }
+    if (negative) {
+        *--q = '-';
+    }
+    return end;
+}
+
+// Write value as printf("%*.2f", width, value) would
+inline char* formatMatrixDouble(char* p, double value, int width) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const bool negative = (bits >> 63) != 0;
+    int exponent = static_cast<int>((bits >> 52) & 0x7ff);
+    std::uint64_t mantissa = bits & ((std::uint64_t(1) << 52) - 1);
+    if (exponent == 0x7ff) {
+        return p + std::snprintf(p, MATRIX_ELEMENT_MAX, "%*.2f", width, value);
+    }
+    if (exponent == 0) {
+        exponent = 1;  // subnormal
+    } else {
+        mantissa |= std::uint64_t(1) << 52;
+    }
+
+    // value = mantissa * 2^-shift; hundredths = value * 100, rounded to
+    // nearest with ties to even
+    const int shift = 1075 - exponent;
+    std::uint64_t hundredths;
+    if (shift <= 0) {
+        if (shift < -4) {
+            return p + std::snprintf(p, MATRIX_ELEMENT_MAX, "%*.2f", width, value);
+        }
+        hundredths = (mantissa << -shift) * 100;
+    } else if (shift < 64) {
+        const std::uint64_t scaled = mantissa * 100;  // < 2^60
+        hundredths = scaled >> shift;
+        const std::uint64_t remainder = scaled & ((std::uint64_t(1) << shift) - 1);
+        const std::uint64_t half = std::uint64_t(1) << (shift - 1);
+        if (remainder > half || (remainder == half && (hundredths & 1) != 0)) {
+            hundredths++;
+        }
+    } else {
+        hundredths = 0;  // below 2^-11
+    }
+
+    const char fraction[3] = {'.', MATRIX_DIGIT_PAIRS[2 * (hundredths % 100)],
+                              MATRIX_DIGIT_PAIRS[2 * (hundredths % 100) + 1]};
+    return formatMatrixNumber(p, hundredths / 100, negative, width, fraction, 3);
+}
+
+// One element in the operator<< format; p needs MATRIX_ELEMENT_MAX bytes
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value, char*>::type formatMatrixElement(char* p, T value) {
+    const bool negative = value < 0;
+    const unsigned long long magnitude =
+        negative ? 0ULL - static_cast<unsigned long long>(value) : static_cast<unsigned long long>(value);
+    return formatMatrixNumber(p, magnitude, negative, MatrixElementWidth<T>::value, "", 0);
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value && sizeof(T) <= sizeof(double), char*>::type
+formatMatrixElement(char* p, T value) {
+    return formatMatrixDouble(p, value, MatrixElementWidth<T>::value);
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value && (sizeof(T) > sizeof(double)), char*>::type
+formatMatrixElement(char* p, T value) {
+    return p + std::snprintf(p, MATRIX_ELEMENT_MAX, "%*.2Lf", MatrixElementWidth<T>::value,
+                             static_cast<long double>(value));
+}
+
+inline char* formatMatrixElement(char* p, BFloat16 value) {
+    return formatMatrixDouble(p, float(value), MatrixElementWidth<BFloat16>::value);
+}
+
+class MatrixWriter {
+private:
+    std::ostream* stream;  // destination, or null when writing to fd
+    int fd;
+    std::vector<char> buffer;
+    std::size_t used;
+
+    // Make room for bytes more characters, writing out the buffer if it is full
+    char* reserve(std::size_t bytes) {
+        if (used + bytes > buffer.size()) {
+            if (buffer.size() < MATRIX_WRITE_BUFFER) {
+                buffer.resize(std::max(std::min(MATRIX_WRITE_BUFFER, buffer.size() * 2), used + bytes));
+            }
+            if (used + bytes > buffer.size()) {
+                drain();
+            }
+        }
+        return buffer.data() + used;
+    }
+
+    void drain() {
+        if (used == 0) {
+            return;
+        }
+        if (stream) {
+            stream->write(buffer.data(), static_cast<std::streamsize>(used));
+            used = 0;
+            return;
+        }
+        const char* p = buffer.data();
+        std::size_t left = used;
+        used = 0;
+        while (left > 0) {
+            ssize_t written = ::write(fd, p, left);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Failed to write matrix output: ") + std::strerror(errno));
+            }
+            p += written;
+            left -= static_cast<std::size_t>(written);
+        }
+    }
+
+public:
+    // Write through an ostream
+    explicit MatrixWriter(std::ostream& out) : stream(&out), fd(-1), used(0) {}
+
+    // Write to an open file descriptor (a file, pipe or socket); the caller
+    // keeps ownership of it
+    explicit MatrixWriter(int descriptor) : stream(nullptr), fd(descriptor), used(0) {}
+
+    ~MatrixWriter() {
+        try {
+            drain();
+        } catch (const std::exception&) {
+            // flush() reports write errors; a destructor cannot
+        }
+    }
+
+    MatrixWriter(const MatrixWriter&) = delete;
+    MatrixWriter& operator=(const MatrixWriter&) = delete;
+
+    // Append a matrix (anything with getRows, getCols and rowPtr) in the
+    // operator<< format
+    template <typename M>
+    void writeMatrix(const M& matrix) {
+        const int rows = matrix.getRows();
+        const int cols = matrix.getCols();
+        const int chunk = static_cast<int>(MATRIX_WRITE_BUFFER / 2 / MATRIX_ELEMENT_MAX);
+        for (int i = 0; i < rows; i++) {
+            const auto* row = matrix.rowPtr(i);
+            for (int j = 0; j < cols; j += chunk) {
+                const int end = std::min(cols, j + chunk);
+                char* p = reserve(static_cast<std::size_t>(end - j) * MATRIX_ELEMENT_MAX + 1);
+                for (int k = j; k < end; k++) {
+                    p = formatMatrixElement(p, row[k]);
+                }
+                used = p - buffer.data();
+            }
+            *reserve(1) = '\n';
+            used++;
+        }
+    }
+
+    // Write out everything buffered so far
+    void flush() {
+        drain();
+        if (stream) {
+            stream->flush();
+        }
+    }
+};
+
+// A new file that replaces path only once it is complete: it is written as a
+// temporary file in the same directory and renamed over path by commit(),
+// so readers and mappings of the old file keep its contents and a failed
+// write leaves path as it was. Without commit() the temporary is removed.
+class MatrixFileReplacement {
+private:
+    std::string target;
+    std::string temporary;
+    int fd;
+
+public:
+    explicit MatrixFileReplacement(const std::string& path) : target(path), fd(-1) {
+        static std::atomic<unsigned> serial(0);
+        do {
+            temporary = path + ".tmp" + std::to_string(::getpid()) + "-" + std::to_string(serial++);
+            fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        } while (fd < 0 && errno == EEXIST);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open file " + path + " for writing");
+        }
+    }
+
+    MatrixFileReplacement(const MatrixFileReplacement&) = delete;
+    MatrixFileReplacement& operator=(const MatrixFileReplacement&) = delete;
+
+    ~MatrixFileReplacement() {
+        if (fd >= 0) {
+            ::close(fd);
+            ::unlink(temporary.c_str());
+        }
+    }
+
+    int handle() const {
+        return fd;
+    }
+
+    // Name of the temporary file, for writers that open it themselves
+    const std::string& path() const {
+        return temporary;
+    }
+
+    // Flush the file to disk and move it over the target
+    void commit() {
+        if (::fsync(fd) != 0 || ::close(fd) != 0) {
+            fd = -1;
+            ::unlink(temporary.c_str());
+            throw std::runtime_error("Failed to write " + target);
+        }
+        fd = -1;
+        if (::rename(temporary.c_str(), target.c_str()) != 0) {
+            ::unlink(temporary.c_str());
+            throw std::runtime_error("Could not replace " + target);
+        }
+    }
+};
+
+// Stream a matrix in the operator<< format to a file, or to a pipe given by
+// its path, without going through iostreams. A regular file is replaced
+// whole (MatrixFileReplacement); a pipe or device is written in place.
+template <typename M>
+void writeMatrixFile(const std::string& path, const M& matrix) {
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0 || S_ISREG(info.st_mode)) {
+        MatrixFileReplacement replacement(path);
+        MatrixWriter writer(replacement.handle());
+        writer.writeMatrix(matrix);
+        writer.flush();
+        replacement.commit();
+        return;
+    }
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file " + path + " for writing");
+    }
+    try {
+        MatrixWriter writer(fd);
+        writer.writeMatrix(matrix);
+        writer.flush();
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    if (::close(fd) != 0) {
+        throw std::runtime_error("Failed to write " + path);
+    }
+}
+
+#endif // MATRIX_WRITER_H
@@ -0,0 +1,378 @@
+// Out-of-core streaming multiply and add for matrices larger than RAM
+// Operands and results are binary matrix files (see MatrixBinary.h). Tiles
+// are read with pread into a fixed set of buffers sized from a memory
+// budget, combined with the in-memory kernels and written back with pwrite.
+// The next tiles are read on a background thread while the current ones are
+// being computed, so I/O and compute overlap. Batch scripts reach them with
+// the stream command (MatrixBatch.h). The result is built in a temporary
+// file that replaces the output only once it is complete, so the output
+// may be one of the inputs or back a loaded matrix, and a failed stream
+// leaves it as it was.
+
+#ifndef OUT_OF_CORE_H
+#define OUT_OF_CORE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Gemm.h"
+#include "MatrixBinary.h"
+#include "SimdKernels.h"
+
+struct OutOfCoreOptions {
+    std::size_t memoryBudget;  // bytes for all tile buffers together
+    int tileSize;              // square tile edge for multiply; 0 derives it from the budget
+
+    OutOfCoreOptions() : memoryBudget(std::size_t(256) << 20), tileSize(0) {}
+};
+
+inline void outOfCoreIoError(const std::string& what, const std::string& path) {
+    throw std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+// A binary matrix file opened for tile-by-tile reads or writes
+template <typename T>
+class DiskMatrixFile {
+private:
+    int fd;
+    std::string path;
+    MatrixBinaryHeader header;
+    std::unique_ptr<MatrixFileReplacement> replacement;  // owns fd for a created file
+
+    DiskMatrixFile() : fd(-1) {}
+
+    std::uint64_t rowOffset(std::uint64_t row) const {
+        return header.dataOffset + row * header.stride * sizeof(T);
+    }
+
+    void readFully(void* dst, std::size_t bytes, std::uint64_t offset) const {
+        char* p = static_cast<char*>(dst);
+        while (bytes > 0) {
+            ssize_t got = ::pread(fd, p, bytes, static_cast<off_t>(offset));
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                outOfCoreIoError("Could not read", path);
+            }
+            p += got;
+            bytes -= static_cast<std::size_t>(got);
+            offset += static_cast<std::uint64_t>(got);
+        }
+    }
+
+    void writeFully(const void* src, std::size_t bytes, std::uint64_t offset) const {
+        const char* p = static_cast<const char*>(src);
+        while (bytes > 0) {
+            ssize_t put = ::pwrite(fd, p, bytes, static_cast<off_t>(offset));
+            if (put < 0 && errno == EINTR) {
+                continue;
+            }
+            if (put <= 0) {
+                outOfCoreIoError("Could not write", path);
+            }
+            p += put;
+            bytes -= static_cast<std::size_t>(put);
+            offset += static_cast<std::uint64_t>(put);
+        }
+    }
+
+public:
+    // Open an existing file for reading
+    static DiskMatrixFile openForRead(const std::string& filename) {
+        DiskMatrixFile file;
+        file.path = filename;
+        file.fd = ::open(filename.c_str(), O_RDONLY);
+        if (file.fd < 0) {
+            throw std::runtime_error("Could not open file " + filename);
+        }
+        struct stat info;
+        if (::fstat(file.fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(MatrixBinaryHeader)) {
+            throw std::runtime_error(filename + ": not a binary matrix file");
+        }
+        MatrixBinaryHeader stored;
+        file.readFully(&stored, sizeof(stored), 0);
+        if (parseMatrixBinaryHeader(&stored, static_cast<std::uint64_t>(info.st_size), filename, file.header)) {
+            throw std::runtime_error(filename + ": byte order differs from this machine");
+        }
+        if (file.header.dtype != MatrixDtype<T>::code || file.header.elementSize != sizeof(T)) {
+            throw std::runtime_error(filename + ": element type does not match");
+        }
+        return file;
+    }
+
+    // Start a rows x cols result that replaces filename when finalize()
+    // writes the header; until then filename is untouched
+    static DiskMatrixFile create(const std::string& filename, std::uint64_t rows, std::uint64_t cols) {
+        DiskMatrixFile file;
+        file.path = filename;
+        file.replacement.reset(new MatrixFileReplacement(filename));
+        file.fd = file.replacement->handle();
+        file.header = makeMatrixBinaryHeader<T>(rows, cols, matrixRowStride<T>(static_cast<int>(cols)));
+        if (::ftruncate(file.fd, static_cast<off_t>(file.header.dataOffset + file.header.dataBytes)) != 0) {
+            outOfCoreIoError("Could not size", filename);
+        }
+        return file;
+    }
+
+    DiskMatrixFile(DiskMatrixFile&& other)
+        : fd(other.fd), path(other.path), header(other.header), replacement(std::move(other.replacement)) {
+        other.fd = -1;
+    }
+
+    ~DiskMatrixFile() {
+        if (fd >= 0 && !replacement) {
+            ::close(fd);
+        }
+    }
+
+    DiskMatrixFile(const DiskMatrixFile&) = delete;
+    DiskMatrixFile& operator=(const DiskMatrixFile&) = delete;
+
+    int rows() const { return static_cast<int>(header.rows); }
+    int cols() const { return static_cast<int>(header.cols); }
+
+    // Read rows [r0, r0 + dst.rows) and columns [c0, c0 + dst.cols) into dst
+    void readTile(int r0, int c0, const MatrixBlock<T>& dst) const {
+        for (int i = 0; i < dst.rows; i++) {
+            readFully(dst.rowPtr(i), dst.cols * sizeof(T), rowOffset(r0 + i) + c0 * sizeof(T));
+        }
+    }
+
+    // Write src to rows starting at r0 and columns starting at c0
+    void writeTile(int r0, int c0, const MatrixBlock<const T>& src) const {
+        for (int i = 0; i < src.rows; i++) {
+            writeFully(src.rowPtr(i), src.cols * sizeof(T), rowOffset(r0 + i) + c0 * sizeof(T));
+        }
+    }
+
+    // Checksum the payload in chunks of at most chunkBytes, write the
+    // header and move the file into place
+    void finalize(std::size_t chunkBytes) {
+        chunkBytes = std::max<std::size_t>(chunkBytes / 8 * 8, 4096);
+        std::vector<char> chunk(std::min<std::uint64_t>(chunkBytes, header.dataBytes));
+        std::uint64_t checksum = matrixChecksum(nullptr, 0);
+        for (std::uint64_t done = 0; done < header.dataBytes; done += chunk.size()) {
+            std::size_t bytes = static_cast<std::size_t>(std::min<std::uint64_t>(chunk.size(), header.dataBytes - done));
+            readFully(chunk.data(), bytes, header.dataOffset + done);
+            checksum = matrixChecksum(chunk.data(), bytes, checksum);
+        }
+        header.checksum = checksum;
+        header.headerChecksum = matrixHeaderChecksum(header);
+        writeFully(&header, sizeof(header), 0);
+        replacement->commit();
+        fd = -1;
+    }
+};
+
+// Element type code (MatrixTypeCode) of a binary matrix file
+inline int diskMatrixType(const std::string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open file " + filename);
+    }
+    struct stat info;
+    MatrixBinaryHeader stored;
+    const bool complete = ::fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) >= sizeof(stored) &&
+                          ::pread(fd, &stored, sizeof(stored), 0) == static_cast<ssize_t>(sizeof(stored));
+    ::close(fd);
+    if (!complete) {
+        throw std::runtime_error(filename + ": not a binary matrix file");
+    }
+    MatrixBinaryHeader header;
+    parseMatrixBinaryHeader(&stored, static_cast<std::uint64_t>(info.st_size), filename, header);
+    return static_cast<int>(header.dtype);
+}
+
+// Square tile edge for the streaming multiply: five tiles (A and B, current
+// and prefetched, plus the C accumulator) must fit in the budget
+template <typename T>
+int outOfCoreTileSize(const OutOfCoreOptions& options) {
+    if (options.tileSize > 0) {
+        return options.tileSize;
+    }
+    double edge = std::sqrt(static_cast<double>(options.memoryBudget) / (5.0 * sizeof(T)));
+    int tile = static_cast<int>(edge);
+    tile = tile >= 64 ? tile / 64 * 64 : tile / 8 * 8;
+    if (tile < 8) {
+        throw std::invalid_argument("Memory budget is too small for out-of-core tiles");
+    }
+    return tile;
+}
+
+// Tile buffer with a fixed padded stride, viewed as a block of any smaller shape
+template <typename T>
+struct OutOfCoreTile {
+    AlignedBuffer<T> storage;
+    int stride;
+
+    OutOfCoreTile(int rows, int cols)
+        : storage(static_cast<std::size_t>(rows) * matrixRowStride<T>(cols)), stride(matrixRowStride<T>(cols)) {}
+
+    MatrixBlock<T> block(int rows, int cols) {
+        return MatrixBlock<T>(storage.data(), nullptr, stride, rows, cols);
+    }
+};
+
+// The tiled loop of streamingMultiply: C tiles are accumulated over K
+// while the next A and B tiles are read in the background
+template <typename T>
+void streamingMultiplyTiles(const DiskMatrixFile<T>& fileA, const DiskMatrixFile<T>& fileB,
+                            const DiskMatrixFile<T>& fileC, int tile) {
+    const int m = fileA.rows();
+    const int k = fileA.cols();
+    const int n = fileB.cols();
+    const int tilesM = (m + tile - 1) / tile;
+    const int tilesN = (n + tile - 1) / tile;
+    const int tilesK = (k + tile - 1) / tile;
+
+    OutOfCoreTile<T> aTiles[2] = {OutOfCoreTile<T>(tile, tile), OutOfCoreTile<T>(tile, tile)};
+    OutOfCoreTile<T> bTiles[2] = {OutOfCoreTile<T>(tile, tile), OutOfCoreTile<T>(tile, tile)};
+    OutOfCoreTile<T> cTile(tile, tile);
+
+    // Steps run over (I, J, K); step s uses A(I, K) and B(K, J)
+    const long steps = static_cast<long>(tilesM) * tilesN * tilesK;
+    auto load = [&](long step, int slot) {
+        int kt = static_cast<int>(step % tilesK);
+        int jt = static_cast<int>((step / tilesK) % tilesN);
+        int it = static_cast<int>(step / tilesK / tilesN);
+        int rows = std::min(tile, m - it * tile);
+        int depth = std::min(tile, k - kt * tile);
+        int cols = std::min(tile, n - jt * tile);
+        fileA.readTile(it * tile, kt * tile, aTiles[slot].block(rows, depth));
+        fileB.readTile(kt * tile, jt * tile, bTiles[slot].block(depth, cols));
+    };
+
+    if (steps > 0) {
+        load(0, 0);
+    }
+    for (long step = 0; step < steps; step++) {
+        int slot = static_cast<int>(step % 2);
+        std::future<void> prefetch;
+        if (step + 1 < steps) {
+            prefetch = std::async(std::launch::async, load, step + 1, 1 - slot);
+        }
+
+        int kt = static_cast<int>(step % tilesK);
+        int jt = static_cast<int>((step / tilesK) % tilesN);
+        int it = static_cast<int>(step / tilesK / tilesN);
+        int rows = std::min(tile, m - it * tile);
+        int depth = std::min(tile, k - kt * tile);
+        int cols = std::min(tile, n - jt * tile);
+        MatrixBlock<T> c = cTile.block(rows, cols);
+        if (kt == 0) {
+            for (int i = 0; i < rows; i++) {
+                std::fill_n(c.rowPtr(i), cols, T());
+            }
+        }
+        gemmAccumulate(MatrixBlock<const T>(aTiles[slot].block(rows, depth)),
+                       MatrixBlock<const T>(bTiles[slot].block(depth, cols)), c);
+        if (kt == tilesK - 1) {
+            fileC.writeTile(it * tile, jt * tile, MatrixBlock<const T>(c));
+        }
+
+        if (prefetch.valid()) {
+            prefetch.get();
+        }
+    }
+}
+
+// C = A * B streamed from disk. pathA is m x k, pathB is k x n and the
+// m x n result is written to pathOut.
+template <typename T>
+void streamingMultiply(const std::string& pathA, const std::string& pathB, const std::string& pathOut,
+                       const OutOfCoreOptions& options = OutOfCoreOptions()) {
+    DiskMatrixFile<T> fileA = DiskMatrixFile<T>::openForRead(pathA);
+    DiskMatrixFile<T> fileB = DiskMatrixFile<T>::openForRead(pathB);
+    if (fileA.cols() != fileB.rows()) {
+        throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+    }
+    const int m = fileA.rows();
+    const int k = fileA.cols();
+    const int n = fileB.cols();
+    DiskMatrixFile<T> fileC = DiskMatrixFile<T>::create(pathOut, m, n);
+
+    const int tile = std::min(outOfCoreTileSize<T>(options), std::max(std::max(m, n), std::max(k, 1)));
+    streamingMultiplyTiles(fileA, fileB, fileC, tile);
+    // The tile buffers are released by now, so the checksum pass can use the budget
+    fileC.finalize(options.memoryBudget);
+}
+
+// The banded loop of streamingAdd
+template <typename T>
+void streamingAddBands(const DiskMatrixFile<T>& fileA, const DiskMatrixFile<T>& fileB,
+                       const DiskMatrixFile<T>& fileC, std::size_t memoryBudget) {
+    const int m = fileA.rows();
+    const int n = fileA.cols();
+
+    // Four bands (A and B, current and prefetched); the sum goes into A's band
+    const std::size_t rowBytes = static_cast<std::size_t>(matrixRowStride<T>(std::max(n, 1))) * sizeof(T);
+    const int band = static_cast<int>(std::min<std::size_t>(memoryBudget / (4 * rowBytes),
+                                                            static_cast<std::size_t>(std::max(m, 1))));
+    if (band < 1) {
+        throw std::invalid_argument("Memory budget is too small for out-of-core tiles");
+    }
+
+    OutOfCoreTile<T> aBands[2] = {OutOfCoreTile<T>(band, n), OutOfCoreTile<T>(band, n)};
+    OutOfCoreTile<T> bBands[2] = {OutOfCoreTile<T>(band, n), OutOfCoreTile<T>(band, n)};
+    const int bands = (m + band - 1) / band;
+    auto load = [&](int index, int slot) {
+        int rows = std::min(band, m - index * band);
+        fileA.readTile(index * band, 0, aBands[slot].block(rows, n));
+        fileB.readTile(index * band, 0, bBands[slot].block(rows, n));
+    };
+
+    void (*add)(T*, const T*, const T*, std::size_t) = simdKernels<T>().add;
+    if (bands > 0) {
+        load(0, 0);
+    }
+    for (int index = 0; index < bands; index++) {
+        int slot = index % 2;
+        std::future<void> prefetch;
+        if (index + 1 < bands) {
+            prefetch = std::async(std::launch::async, load, index + 1, 1 - slot);
+        }
+
+        int rows = std::min(band, m - index * band);
+        MatrixBlock<T> a = aBands[slot].block(rows, n);
+        MatrixBlock<T> b = bBands[slot].block(rows, n);
+        for (int i = 0; i < rows; i++) {
+            add(a.rowPtr(i), a.rowPtr(i), b.rowPtr(i), n);
+        }
+        fileC.writeTile(index * band, 0, MatrixBlock<const T>(a));
+
+        if (prefetch.valid()) {
+            prefetch.get();
+        }
+    }
+}
+
+// C = A + B streamed from disk in row bands
+template <typename T>
+void streamingAdd(const std::string& pathA, const std::string& pathB, const std::string& pathOut,
+                  const OutOfCoreOptions& options = OutOfCoreOptions()) {
+    DiskMatrixFile<T> fileA = DiskMatrixFile<T>::openForRead(pathA);
+    DiskMatrixFile<T> fileB = DiskMatrixFile<T>::openForRead(pathB);
+    if (fileA.rows() != fileB.rows() || fileA.cols() != fileB.cols()) {
+        throw std::invalid_argument("Matrix dimensions do not match for addition");
+    }
+    const int m = fileA.rows();
+    const int n = fileA.cols();
+    DiskMatrixFile<T> fileC = DiskMatrixFile<T>::create(pathOut, m, n);
+    streamingAddBands(fileA, fileB, fileC, options.memoryBudget);
+    fileC.finalize(options.memoryBudget);
+}
+
+#endif // OUT_OF_CORE_H
@@ -0,0 +1,876 @@
+// Explicit SIMD kernels for the Matrix<T> hot loops, with runtime CPU dispatch
+// Every kernel (add, axpy, dot, diagonal sums and the GEMM microkernel) has
+// AVX2 and AVX-512 versions for int and double, and all but diagonal sums
+// for float. SSE2 versions cover add for int and add, axpy and dot for
+// double; diagonal sums and the microkernel have none. Anything without a
+// version for the active level, and every other element type, uses the
+// scalar kernels. Diagonal sums accumulate in MatrixAccumulator<T>
+// (MatrixTypes.h), so int diagonals are summed in 64 bits.
+// The best version the CPU supports is picked once through CPUID
+// (__builtin_cpu_supports), so one binary runs well on any x86-64 machine.
+// Set MATRIX_SIMD=scalar|sse2|avx2|avx512 to cap the level.
+//
+// Floating-point results can differ in the last bits between levels, since
+// the SIMD kernels reduce in vector lanes and the AVX2/AVX-512 ones use
+// fused multiply-add.
+// Integer results are the same at every level.
+
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "MatrixTypes.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_SIMD_X86 1
+#include <immintrin.h>
+#define MATRIX_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MATRIX_SIMD_X86 0
+#endif
+
+enum SimdLevel {
+    SIMD_SCALAR = 0,
+    SIMD_SSE2 = 1,
+    SIMD_AVX2 = 2,
+    SIMD_AVX512 = 3
+};
+
+inline const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SIMD_SSE2: return "sse2";
+        case SIMD_AVX2: return "avx2";
+        case SIMD_AVX512: return "avx512";
+        default: return "scalar";
+    }
+}
+
+// Highest level supported by this CPU, capped by MATRIX_SIMD if set
+inline SimdLevel detectSimdLevel() {
+    SimdLevel level = SIMD_SCALAR;
+#if MATRIX_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        level = SIMD_SSE2;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        level = SIMD_AVX2;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        level = SIMD_AVX512;
+    }
+#endif
+    const char* env = std::getenv("MATRIX_SIMD");
+    if (env) {
+        SimdLevel cap = level;
+        for (int l = SIMD_SCALAR; l <= SIMD_AVX512; l++) {
+            if (std::strcmp(env, simdLevelName(static_cast<SimdLevel>(l))) == 0) {
+                cap = static_cast<SimdLevel>(l);
+            }
+        }
+        if (cap < level) {
+            level = cap;
+        }
+    }
+    return level;
+}
+
+inline SimdLevel activeSimdLevel() {
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+// Kernel table for one element type
+template <typename T>
+struct SimdKernelTable {
+    typedef typename MatrixAccumulator<T>::type Accumulator;
+
+    // dst[i] = a[i] + b[i]
+    void (*add)(T* dst, const T* a, const T* b, std::size_t n);
+    // dst[i] += alpha * x[i]
+    void (*axpy)(T* dst, T alpha, const T* x, std::size_t n);
+    // sum of a[i] * b[i]
+    T (*dot)(const T* a, const T* b, std::size_t n);
+    // Sums of the main and secondary diagonals over rows [begin, end) of a
+    // matrix with size columns stored at base with the given row stride and
+    // row-permutation index (null for consecutive rows)
+    void (*diagonalSums)(const T* base, const int* rowIndex, std::size_t stride, int size,
+                         int begin, int end, Accumulator* mainSum, Accumulator* secondarySum);
+    // MR x NR GEMM microkernel over packed panels (GemmTraits<T> in Gemm.h),
+    // or null to use the generic template
+    void (*microKernel)(int kc, const T* a, const T* b, T* acc);
+    SimdLevel level;
+};
+
+// Scalar kernels, used for every type without a SIMD table
+
+template <typename T>
+void simdAddScalar(T* dst, const T* a, const T* b, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+template <typename T>
+void simdAxpyScalar(T* dst, T alpha, const T* x, std::size_t n) {
+    for (std::size_t i = 0; i < n; i++) {
+        dst[i] += alpha * x[i];
+    }
+}
+
+template <typename T>
+T simdDotScalar(const T* a, const T* b, std::size_t n) {
+    T sum = 0;
+    for (std::size_t i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+inline std::size_t simdRowOffset(const int* rowIndex, std::size_t stride, int row) {
+    return static_cast<std::size_t>(rowIndex ? rowIndex[row] : row) * stride;
+}
+
+template <typename T>
+void simdDiagonalSumsScalar(const T* base, const int* rowIndex, std::size_t stride, int size, int begin, int end,
+                            typename MatrixAccumulator<T>::type* mainSum,
+                            typename MatrixAccumulator<T>::type* secondarySum) {
+    typename MatrixAccumulator<T>::type mainDiagonal = 0;
+    typename MatrixAccumulator<T>::type secondaryDiagonal = 0;
+    for (int i = begin; i < end; i++) {
+        const T* r = base + simdRowOffset(rowIndex, stride, i);
+        mainDiagonal += r[i];
+        secondaryDiagonal += r[size - 1 - i];
+    }
+    *mainSum = mainDiagonal;
+    *secondarySum = secondaryDiagonal;
+}
+
+#if MATRIX_SIMD_X86
+
+// SSE2 kernels
+
+MATRIX_TARGET("sse2")
+inline void simdAddSse2(double* dst, const double* a, const double* b, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+MATRIX_TARGET("sse2")
+inline void simdAddSse2(int* dst, const int* a, const int* b, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi32(va, vb));
+    }
+    for (; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+MATRIX_TARGET("sse2")
+inline void simdAxpySse2(double* dst, double alpha, const double* x, std::size_t n) {
+    __m128d va = _mm_set1_pd(alpha);
+    std::size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d prod = _mm_mul_pd(va, _mm_loadu_pd(x + i));
+        _mm_storeu_pd(dst + i, _mm_add_pd(_mm_loadu_pd(dst + i), prod));
+    }
+    for (; i < n; i++) {
+        dst[i] += alpha * x[i];
+    }
+}
+
+MATRIX_TARGET("sse2")
+inline double simdDotSse2(const double* a, const double* b, std::size_t n) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    double sum = lanes[0] + lanes[1];
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// AVX2 kernels
+
+MATRIX_TARGET("avx2,fma")
+inline void simdAddAvx2(double* dst, const double* a, const double* b, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+MATRIX_TARGET("avx2,fma")
+inline void simdAddAvx2(int* dst, const int* a, const int* b, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_add_epi32(va, vb));
+    }
+    for (; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+MATRIX_TARGET("avx2,fma")
+inline void simdAxpyAvx2(double* dst, double alpha, const double* x, std::size_t n) {
+    __m256d va = _mm256_set1_pd(alpha);
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i), _mm256_loadu_pd(dst + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] += alpha * x[i];
+    }
+}
+
+MATRIX_TARGET("avx2,fma")
+inline void simdAxpyAvx2(int* dst, int alpha, const int* x, std::size_t n) {
+    __m256i va = _mm256_set1_epi32(alpha);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i vx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x + i));
+        __m256i vd = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                            _mm256_add_epi32(vd, _mm256_mullo_epi32(va, vx)));
+    }
+    for (; i < n; i++) {
+        dst[i] += alpha * x[i];
+    }
+}
+
+// Two independent accumulators hide the FMA latency
+MATRIX_TARGET("avx2,fma")
+inline double simdDotAvx2(const double* a, const double* b, std::size_t n) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), acc1);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+MATRIX_TARGET("avx2,fma")
+inline int simdDotAvx2(const int* a, const int* b, std::size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        acc = _mm256_add_epi32(acc, _mm256_mullo_epi32(va, vb));
+    }
+    int lanes[8];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), acc);
+    int sum = 0;
+    for (int l = 0; l < 8; l++) {
+        sum += lanes[l];
+    }
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Gather four diagonal elements per step, using 64-bit offsets so that
+// matrices larger than 2^31 elements are handled
+MATRIX_TARGET("avx2,fma")
+inline void simdDiagonalSumsAvx2(const double* base, const int* rowIndex, std::size_t stride, int size,
+                                 int begin, int end, double* mainSum, double* secondarySum) {
+    __m256d mainAcc = _mm256_setzero_pd();
+    __m256d secondaryAcc = _mm256_setzero_pd();
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        long long rows[4];
+        for (int l = 0; l < 4; l++) {
+            rows[l] = static_cast<long long>(simdRowOffset(rowIndex, stride, i + l));
+        }
+        __m256i rowOffsets = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows));
+        __m256i cols = _mm256_setr_epi64x(i, i + 1, i + 2, i + 3);
+        __m256i mirrored = _mm256_sub_epi64(_mm256_set1_epi64x(size - 1), cols);
+        mainAcc = _mm256_add_pd(mainAcc, _mm256_i64gather_pd(base, _mm256_add_epi64(rowOffsets, cols), 8));
+        secondaryAcc = _mm256_add_pd(secondaryAcc,
+                                     _mm256_i64gather_pd(base, _mm256_add_epi64(rowOffsets, mirrored), 8));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, mainAcc);
+    double mainDiagonal = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, secondaryAcc);
+    double secondaryDiagonal = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < end; i++) {
+        const double* r = base + simdRowOffset(rowIndex, stride, i);
+        mainDiagonal += r[i];
+        secondaryDiagonal += r[size - 1 - i];
+    }
+    *mainSum = mainDiagonal;
+    *secondarySum = secondaryDiagonal;
+}
+
+// int diagonals: each gathered group of four is widened and summed in 64-bit lanes
+MATRIX_TARGET("avx2,fma")
+inline void simdDiagonalSumsAvx2(const int* base, const int* rowIndex, std::size_t stride, int size,
+                                 int begin, int end, std::int64_t* mainSum, std::int64_t* secondarySum) {
+    __m256i mainAcc = _mm256_setzero_si256();
+    __m256i secondaryAcc = _mm256_setzero_si256();
+    int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        long long rows[4];
+        for (int l = 0; l < 4; l++) {
+            rows[l] = static_cast<long long>(simdRowOffset(rowIndex, stride, i + l));
+        }
+        __m256i rowOffsets = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows));
+        __m256i cols = _mm256_setr_epi64x(i, i + 1, i + 2, i + 3);
+        __m256i mirrored = _mm256_sub_epi64(_mm256_set1_epi64x(size - 1), cols);
+        __m128i mainValues = _mm256_i64gather_epi32(base, _mm256_add_epi64(rowOffsets, cols), 4);
+        __m128i secondaryValues = _mm256_i64gather_epi32(base, _mm256_add_epi64(rowOffsets, mirrored), 4);
+        mainAcc = _mm256_add_epi64(mainAcc, _mm256_cvtepi32_epi64(mainValues));
+        secondaryAcc = _mm256_add_epi64(secondaryAcc, _mm256_cvtepi32_epi64(secondaryValues));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), mainAcc);
+    std::int64_t mainDiagonal = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), secondaryAcc);
+    std::int64_t secondaryDiagonal = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for (; i < end; i++) {
+        const int* r = base + simdRowOffset(rowIndex, stride, i);
+        mainDiagonal += r[i];
+        secondaryDiagonal += r[size - 1 - i];
+    }
+    *mainSum = mainDiagonal;
+    *secondarySum = secondaryDiagonal;
+}
+
+// 4 x 8 microkernel: two ymm accumulators per row of the tile
+MATRIX_TARGET("avx2,fma")
+inline void gemmMicroKernelAvx2(int kc, const double* a, const double* b, double* acc) {
+    __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+    for (int p = 0; p < kc; p++) {
+        __m256d b0 = _mm256_loadu_pd(b);
+        __m256d b1 = _mm256_loadu_pd(b + 4);
+        __m256d a0 = _mm256_broadcast_sd(a);
+        __m256d a1 = _mm256_broadcast_sd(a + 1);
+        c00 = _mm256_fmadd_pd(a0, b0, c00);
+        c01 = _mm256_fmadd_pd(a0, b1, c01);
+        c10 = _mm256_fmadd_pd(a1, b0, c10);
+        c11 = _mm256_fmadd_pd(a1, b1, c11);
+        __m256d a2 = _mm256_broadcast_sd(a + 2);
+        __m256d a3 = _mm256_broadcast_sd(a + 3);
+        c20 = _mm256_fmadd_pd(a2, b0, c20);
+        c21 = _mm256_fmadd_pd(a2, b1, c21);
+        c30 = _mm256_fmadd_pd(a3, b0, c30);
+        c31 = _mm256_fmadd_pd(a3, b1, c31);
+        a += 4;
+        b += 8;
+    }
+    _mm256_storeu_pd(acc, c00);
+    _mm256_storeu_pd(acc + 4, c01);
+    _mm256_storeu_pd(acc + 8, c10);
+    _mm256_storeu_pd(acc + 12, c11);
+    _mm256_storeu_pd(acc + 16, c20);
+    _mm256_storeu_pd(acc + 20, c21);
+    _mm256_storeu_pd(acc + 24, c30);
+    _mm256_storeu_pd(acc + 28, c31);
+}
+
+MATRIX_TARGET("avx2,fma")
+inline void gemmMicroKernelAvx2(int kc, const int* a, const int* b, int* acc) {
+    __m256i c0 = _mm256_setzero_si256(), c1 = _mm256_setzero_si256();
+    __m256i c2 = _mm256_setzero_si256(), c3 = _mm256_setzero_si256();
+    for (int p = 0; p < kc; p++) {
+        __m256i bp = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+        c0 = _mm256_add_epi32(c0, _mm256_mullo_epi32(_mm256_set1_epi32(a[0]), bp));
+        c1 = _mm256_add_epi32(c1, _mm256_mullo_epi32(_mm256_set1_epi32(a[1]), bp));
+        c2 = _mm256_add_epi32(c2, _mm256_mullo_epi32(_mm256_set1_epi32(a[2]), bp));
+        c3 = _mm256_add_epi32(c3, _mm256_mullo_epi32(_mm256_set1_epi32(a[3]), bp));
+        a += 4;
+        b += 8;
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc), c0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + 8), c1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + 16), c2);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc + 24), c3);
+}
+
+// float: 8 lanes per ymm, otherwise as double
+
+MATRIX_TARGET("avx2,fma")
+inline void simdAddAvx2(float* dst, const float* a, const float* b, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+MATRIX_TARGET("avx2,fma")
+inline void simdAxpyAvx2(float* dst, float alpha, const float* x, std::size_t n) {
+    __m256 va = _mm256_set1_ps(alpha);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(dst + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] += alpha * x[i];
+    }
+}
+
+MATRIX_TARGET("avx2,fma")
+inline float simdDotAvx2(const float* a, const float* b, std::size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, _mm256_add_ps(acc0, acc1));
+    float sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// 4 x 16 float microkernel: two ymm accumulators per row of the tile
+MATRIX_TARGET("avx2,fma")
+inline void gemmMicroKernelAvx2(int kc, const float* a, const float* b, float* acc) {
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    for (int p = 0; p < kc; p++) {
+        __m256 b0 = _mm256_loadu_ps(b);
+        __m256 b1 = _mm256_loadu_ps(b + 8);
+        __m256 a0 = _mm256_broadcast_ss(a);
+        __m256 a1 = _mm256_broadcast_ss(a + 1);
+        c00 = _mm256_fmadd_ps(a0, b0, c00);
+        c01 = _mm256_fmadd_ps(a0, b1, c01);
+        c10 = _mm256_fmadd_ps(a1, b0, c10);
+        c11 = _mm256_fmadd_ps(a1, b1, c11);
+        __m256 a2 = _mm256_broadcast_ss(a + 2);
+        __m256 a3 = _mm256_broadcast_ss(a + 3);
+        c20 = _mm256_fmadd_ps(a2, b0, c20);
+        c21 = _mm256_fmadd_ps(a2, b1, c21);
+        c30 = _mm256_fmadd_ps(a3, b0, c30);
+        c31 = _mm256_fmadd_ps(a3, b1, c31);
+        a += 4;
+        b += 16;
+    }
+    _mm256_storeu_ps(acc, c00);
+    _mm256_storeu_ps(acc + 8, c01);
+    _mm256_storeu_ps(acc + 16, c10);
+    _mm256_storeu_ps(acc + 24, c11);
+    _mm256_storeu_ps(acc + 32, c20);
+    _mm256_storeu_ps(acc + 40, c21);
+    _mm256_storeu_ps(acc + 48, c30);
+    _mm256_storeu_ps(acc + 56, c31);
+}
+
+// AVX-512 kernels
+
+MATRIX_TARGET("avx512f")
+inline void simdAddAvx512(double* dst, const double* a, const double* b, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm512_storeu_pd(dst + i, _mm512_add_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+MATRIX_TARGET("avx512f")
+inline void simdAddAvx512(int* dst, const int* a, const int* b, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i va = _mm512_loadu_si512(a + i);
+        __m512i vb = _mm512_loadu_si512(b + i);
+        _mm512_storeu_si512(dst + i, _mm512_add_epi32(va, vb));
+    }
+    for (; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+MATRIX_TARGET("avx512f")
+inline void simdAxpyAvx512(double* dst, double alpha, const double* x, std::size_t n) {
+    __m512d va = _mm512_set1_pd(alpha);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm512_storeu_pd(dst + i, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + i), _mm512_loadu_pd(dst + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] += alpha * x[i];
+    }
+}
+
+MATRIX_TARGET("avx512f")
+inline void simdAxpyAvx512(int* dst, int alpha, const int* x, std::size_t n) {
+    __m512i va = _mm512_set1_epi32(alpha);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i vx = _mm512_loadu_si512(x + i);
+        __m512i vd = _mm512_loadu_si512(dst + i);
+        _mm512_storeu_si512(dst + i, _mm512_add_epi32(vd, _mm512_mullo_epi32(va, vx)));
+    }
+    for (; i < n; i++) {
+        dst[i] += alpha * x[i];
+    }
+}
+
+MATRIX_TARGET("avx512f")
+inline double simdDotAvx512(const double* a, const double* b, std::size_t n) {
+    __m512d acc0 = _mm512_setzero_pd();
+    __m512d acc1 = _mm512_setzero_pd();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc0);
+        acc1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8), _mm512_loadu_pd(b + i + 8), acc1);
+    }
+    double lanes[8];
+    _mm512_storeu_pd(lanes, _mm512_add_pd(acc0, acc1));
+    double sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+                 ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+MATRIX_TARGET("avx512f")
+inline int simdDotAvx512(const int* a, const int* b, std::size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc = _mm512_add_epi32(acc, _mm512_mullo_epi32(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i)));
+    }
+    int lanes[16];
+    _mm512_storeu_si512(lanes, acc);
+    int sum = 0;
+    for (int l = 0; l < 16; l++) {
+        sum += lanes[l];
+    }
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+MATRIX_TARGET("avx512f")
+inline void simdDiagonalSumsAvx512(const double* base, const int* rowIndex, std::size_t stride, int size,
+                                   int begin, int end, double* mainSum, double* secondarySum) {
+    const __m512d zero = _mm512_setzero_pd();
+    __m512d mainAcc = zero;
+    __m512d secondaryAcc = zero;
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        long long rows[8];
+        for (int l = 0; l < 8; l++) {
+            rows[l] = static_cast<long long>(simdRowOffset(rowIndex, stride, i + l));
+        }
+        __m512i rowOffsets = _mm512_loadu_si512(rows);
+        __m512i cols = _mm512_add_epi64(_mm512_set1_epi64(i), _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7));
+        __m512i mirrored = _mm512_sub_epi64(_mm512_set1_epi64(size - 1), cols);
+        mainAcc = _mm512_add_pd(mainAcc, _mm512_mask_i64gather_pd(zero, 0xFF, _mm512_add_epi64(rowOffsets, cols), base, 8));
+        secondaryAcc = _mm512_add_pd(secondaryAcc,
+                                     _mm512_mask_i64gather_pd(zero, 0xFF, _mm512_add_epi64(rowOffsets, mirrored), base, 8));
+    }
+    double lanes[8];
+    _mm512_storeu_pd(lanes, mainAcc);
+    double mainDiagonal = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+                          ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    _mm512_storeu_pd(lanes, secondaryAcc);
+    double secondaryDiagonal = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+                               ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+    for (; i < end; i++) {
+        const double* r = base + simdRowOffset(rowIndex, stride, i);
+        mainDiagonal += r[i];
+        secondaryDiagonal += r[size - 1 - i];
+    }
+    *mainSum = mainDiagonal;
+    *secondarySum = secondaryDiagonal;
+}
+
+MATRIX_TARGET("avx512f")
+inline void simdDiagonalSumsAvx512(const int* base, const int* rowIndex, std::size_t stride, int size,
+                                   int begin, int end, std::int64_t* mainSum, std::int64_t* secondarySum) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m512i mainAcc = _mm512_setzero_si512();
+    __m512i secondaryAcc = _mm512_setzero_si512();
+    int i = begin;
+    for (; i + 8 <= end; i += 8) {
+        long long rows[8];
+        for (int l = 0; l < 8; l++) {
+            rows[l] = static_cast<long long>(simdRowOffset(rowIndex, stride, i + l));
+        }
+        __m512i rowOffsets = _mm512_loadu_si512(rows);
+        __m512i cols = _mm512_add_epi64(_mm512_set1_epi64(i), _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7));
+        __m512i mirrored = _mm512_sub_epi64(_mm512_set1_epi64(size - 1), cols);
+        __m256i mainValues = _mm512_mask_i64gather_epi32(zero, 0xFF, _mm512_add_epi64(rowOffsets, cols), base, 4);
+        __m256i secondaryValues =
+            _mm512_mask_i64gather_epi32(zero, 0xFF, _mm512_add_epi64(rowOffsets, mirrored), base, 4);
+        mainAcc = _mm512_add_epi64(mainAcc, _mm512_maskz_cvtepi32_epi64(0xFF, mainValues));
+        secondaryAcc = _mm512_add_epi64(secondaryAcc, _mm512_maskz_cvtepi32_epi64(0xFF, secondaryValues));
+    }
+    long long lanes[8];
+    _mm512_storeu_si512(lanes, mainAcc);
+    std::int64_t mainDiagonal = 0;
+    for (int l = 0; l < 8; l++) {
+        mainDiagonal += lanes[l];
+    }
+    _mm512_storeu_si512(lanes, secondaryAcc);
+    std::int64_t secondaryDiagonal = 0;
+    for (int l = 0; l < 8; l++) {
+        secondaryDiagonal += lanes[l];
+    }
+    for (; i < end; i++) {
+        const int* r = base + simdRowOffset(rowIndex, stride, i);
+        mainDiagonal += r[i];
+        secondaryDiagonal += r[size - 1 - i];
+    }
+    *mainSum = mainDiagonal;
+    *secondarySum = secondaryDiagonal;
+}
+
+// 4 x 8 microkernel: one zmm accumulator per row of the tile
+MATRIX_TARGET("avx512f")
+inline void gemmMicroKernelAvx512(int kc, const double* a, const double* b, double* acc) {
+    __m512d c0 = _mm512_setzero_pd(), c1 = _mm512_setzero_pd();
+    __m512d c2 = _mm512_setzero_pd(), c3 = _mm512_setzero_pd();
+    for (int p = 0; p < kc; p++) {
+        __m512d bp = _mm512_loadu_pd(b);
+        c0 = _mm512_fmadd_pd(_mm512_set1_pd(a[0]), bp, c0);
+        c1 = _mm512_fmadd_pd(_mm512_set1_pd(a[1]), bp, c1);
+        c2 = _mm512_fmadd_pd(_mm512_set1_pd(a[2]), bp, c2);
+        c3 = _mm512_fmadd_pd(_mm512_set1_pd(a[3]), bp, c3);
+        a += 4;
+        b += 8;
+    }
+    _mm512_storeu_pd(acc, c0);
+    _mm512_storeu_pd(acc + 8, c1);
+    _mm512_storeu_pd(acc + 16, c2);
+    _mm512_storeu_pd(acc + 24, c3);
+}
+
+MATRIX_TARGET("avx512f")
+inline void simdAddAvx512(float* dst, const float* a, const float* b, std::size_t n) {
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(dst + i, _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+MATRIX_TARGET("avx512f")
+inline void simdAxpyAvx512(float* dst, float alpha, const float* x, std::size_t n) {
+    __m512 va = _mm512_set1_ps(alpha);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(dst + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(dst + i)));
+    }
+    for (; i < n; i++) {
+        dst[i] += alpha * x[i];
+    }
+}
+
+MATRIX_TARGET("avx512f")
+inline float simdDotAvx512(const float* a, const float* b, std::size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    float lanes[16];
+    _mm512_storeu_ps(lanes, _mm512_add_ps(acc0, acc1));
+    float sum = 0;
+    for (int l = 0; l < 16; l += 2) {
+        sum += lanes[l] + lanes[l + 1];
+    }
+    for (; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// 4 x 16 float microkernel: one zmm accumulator per row of the tile
+MATRIX_TARGET("avx512f")
+inline void gemmMicroKernelAvx512(int kc, const float* a, const float* b, float* acc) {
+    __m512 c0 = _mm512_setzero_ps(), c1 = _mm512_setzero_ps();
+    __m512 c2 = _mm512_setzero_ps(), c3 = _mm512_setzero_ps();
+    for (int p = 0; p < kc; p++) {
+        __m512 bp = _mm512_loadu_ps(b);
+        c0 = _mm512_fmadd_ps(_mm512_set1_ps(a[0]), bp, c0);
+        c1 = _mm512_fmadd_ps(_mm512_set1_ps(a[1]), bp, c1);
+        c2 = _mm512_fmadd_ps(_mm512_set1_ps(a[2]), bp, c2);
+        c3 = _mm512_fmadd_ps(_mm512_set1_ps(a[3]), bp, c3);
+        a += 4;
+        b += 16;
+    }
+    _mm512_storeu_ps(acc, c0);
+    _mm512_storeu_ps(acc + 16, c1);
+    _mm512_storeu_ps(acc + 32, c2);
+    _mm512_storeu_ps(acc + 48, c3);
+}
+
+#endif // MATRIX_SIMD_X86
+
+// Kernel table for the active SIMD level
+
+template <typename T>
+const SimdKernelTable<T>& simdKernels() {
+    static const SimdKernelTable<T> table = {
+        simdAddScalar<T>, simdAxpyScalar<T>, simdDotScalar<T>, simdDiagonalSumsScalar<T>, nullptr, SIMD_SCALAR
+    };
+    return table;
+}
+
+template <typename T>
+SimdKernelTable<T> simdScalarTable() {
+    SimdKernelTable<T> table = {
+        simdAddScalar<T>, simdAxpyScalar<T>, simdDotScalar<T>, simdDiagonalSumsScalar<T>, nullptr, SIMD_SCALAR
+    };
+    return table;
+}
+
+inline SimdKernelTable<double> simdSelectDouble() {
+    SimdKernelTable<double> table = simdScalarTable<double>();
+#if MATRIX_SIMD_X86
+    SimdLevel level = activeSimdLevel();
+    if (level >= SIMD_SSE2) {
+        table.add = simdAddSse2;
+        table.axpy = simdAxpySse2;
+        table.dot = simdDotSse2;
+        table.level = SIMD_SSE2;
+    }
+    if (level >= SIMD_AVX2) {
+        table.add = simdAddAvx2;
+        table.axpy = simdAxpyAvx2;
+        table.dot = simdDotAvx2;
+        table.diagonalSums = simdDiagonalSumsAvx2;
+        table.microKernel = gemmMicroKernelAvx2;
+        table.level = SIMD_AVX2;
+    }
+    if (level >= SIMD_AVX512) {
+        table.add = simdAddAvx512;
+        table.axpy = simdAxpyAvx512;
+        table.dot = simdDotAvx512;
+        table.diagonalSums = simdDiagonalSumsAvx512;
+        table.microKernel = gemmMicroKernelAvx512;
+        table.level = SIMD_AVX512;
+    }
+#endif
+    return table;
+}
+
+// float has no SSE2 kernels: at that level the compiler already vectorizes
+// the scalar add and axpy
+inline SimdKernelTable<float> simdSelectFloat() {
+    SimdKernelTable<float> table = simdScalarTable<float>();
+#if MATRIX_SIMD_X86
+    SimdLevel level = activeSimdLevel();
+    if (level >= SIMD_AVX2) {
+        table.add = simdAddAvx2;
+        table.axpy = simdAxpyAvx2;
+        table.dot = simdDotAvx2;
+        table.microKernel = gemmMicroKernelAvx2;
+        table.level = SIMD_AVX2;
+    }
+    if (level >= SIMD_AVX512) {
+        table.add = simdAddAvx512;
+        table.axpy = simdAxpyAvx512;
+        table.dot = simdDotAvx512;
+        table.microKernel = gemmMicroKernelAvx512;
+        table.level = SIMD_AVX512;
+    }
+#endif
+    return table;
+}
+
+inline SimdKernelTable<int> simdSelectInt() {
+    SimdKernelTable<int> table = simdScalarTable<int>();
+#if MATRIX_SIMD_X86
+    SimdLevel level = activeSimdLevel();
+    if (level >= SIMD_SSE2) {
+        // SSE2 has no 32-bit multiply, so axpy and dot stay scalar at this level
+        table.add = simdAddSse2;
+        table.level = SIMD_SSE2;
+    }
+    if (level >= SIMD_AVX2) {
+        table.add = simdAddAvx2;
+        table.axpy = simdAxpyAvx2;
+        table.dot = simdDotAvx2;
+        table.diagonalSums = simdDiagonalSumsAvx2;
+        table.microKernel = gemmMicroKernelAvx2;
+        table.level = SIMD_AVX2;
+    }
+    if (level >= SIMD_AVX512) {
+        // An 8-wide int tile fits one ymm register, so the AVX2 microkernel stays
+        table.add = simdAddAvx512;
+        table.axpy = simdAxpyAvx512;
+        table.dot = simdDotAvx512;
+        table.diagonalSums = simdDiagonalSumsAvx512;
+        table.level = SIMD_AVX512;
+    }
+#endif
+    return table;
+}
+
+template <>
+inline const SimdKernelTable<double>& simdKernels<double>() {
+    static const SimdKernelTable<double> table = simdSelectDouble();
+    return table;
+}
+
+template <>
+inline const SimdKernelTable<float>& simdKernels<float>() {
+    static const SimdKernelTable<float> table = simdSelectFloat();
+    return table;
+}
+
+template <>
+inline const SimdKernelTable<int>& simdKernels<int>() {
+    static const SimdKernelTable<int> table = simdSelectInt();
+    return table;
+}
+
+#endif // SIMD_KERNELS_H
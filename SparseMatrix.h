@@ -0,0 +1,498 @@
+// Sparse matrices in compressed row (CSR) or compressed column (CSC) form
+// Only the nonzeros are stored, so products cost time in proportion to the
+// nonzeros touched instead of rows x cols (x inner size). Includes SpMV,
+// sparse x dense, dense x sparse and sparse x sparse products, conversion to
+// and from Matrix<T>, and a loader for the coordinate text format:
+//
+//     rows cols nonzeros type
+//     row col value        (one line per nonzero, 0-based, duplicates summed)
+
+#ifndef SPARSE_MATRIX_H
+#define SPARSE_MATRIX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Matrix.h"
+#include "MatrixLoader.h"
+#include "SimdKernels.h"
+#include "ThreadPool.h"
+
+enum SparseFormat {
+    SPARSE_CSR = 0,  // compressed rows: offsets per row, column indices
+    SPARSE_CSC = 1   // compressed columns: offsets per column, row indices
+};
+
+// One nonzero in coordinate form
+template <typename T>
+struct SparseEntry {
+    int row;
+    int col;
+    T value;
+};
+
+// Nonzeros (times dense columns, for products) handled per task when a
+// sparse kernel runs on the thread pool
+const long SPARSE_PARALLEL_WORK = 1L << 16;
+
+// Split the compressed slices [0, count) into ranges of roughly equal
+// weight, where slice i weighs (offsets[i + 1] - offsets[i]) * scale + 1
+inline std::vector<int> sparseChunks(const std::vector<long>& offsets, int count, long scale) {
+    const long perTask = std::max(1L, SPARSE_PARALLEL_WORK / std::max(scale, 1L));
+    std::vector<int> bounds(1, 0);
+    long weight = 0;
+    for (int i = 0; i < count; i++) {
+        weight += offsets[i + 1] - offsets[i] + 1;
+        if (weight >= perTask) {
+            bounds.push_back(i + 1);
+            weight = 0;
+        }
+    }
+    if (bounds.back() != count) {
+        bounds.push_back(count);
+    }
+    return bounds;
+}
+
+template <typename T>
+class SparseMatrix {
+private:
+    SparseFormat layout;
+    int rows;
+    int cols;
+    std::vector<long> offsets;  // start of each compressed row or column, plus the end
+    std::vector<int> indices;   // column (CSR) or row (CSC) of each value, ascending per slice
+    std::vector<T> values;
+
+    int majorCount() const {
+        return layout == SPARSE_CSR ? rows : cols;
+    }
+
+    int minorCount() const {
+        return layout == SPARSE_CSR ? cols : rows;
+    }
+
+public:
+    // Default constructor
+    SparseMatrix() : layout(SPARSE_CSR), rows(0), cols(0), offsets(1, 0) {}
+
+    // All-zero rows x cols matrix
+    SparseMatrix(int numRows, int numCols, SparseFormat format = SPARSE_CSR)
+        : layout(format), rows(numRows), cols(numCols) {
+        if (numRows < 0 || numCols < 0) {
+            throw std::invalid_argument("Matrix dimensions must not be negative");
+        }
+        offsets.assign(majorCount() + 1, 0);
+    }
+
+    // Adopt compressed arrays, checking that they describe a valid matrix
+    SparseMatrix(int numRows, int numCols, SparseFormat format, std::vector<long>&& newOffsets,
+                 std::vector<int>&& newIndices, std::vector<T>&& newValues)
+        : layout(format), rows(numRows), cols(numCols), offsets(std::move(newOffsets)),
+          indices(std::move(newIndices)), values(std::move(newValues)) {
+        if (numRows < 0 || numCols < 0 || static_cast<int>(offsets.size()) != majorCount() + 1 ||
+            offsets.front() != 0 || offsets.back() != static_cast<long>(indices.size()) ||
+            indices.size() != values.size()) {
+            throw std::invalid_argument("Sparse matrix arrays do not match its dimensions");
+        }
+        for (int i = 0; i < majorCount(); i++) {
+            for (long p = offsets[i]; p < offsets[i + 1]; p++) {
+                if (indices[p] < 0 || indices[p] >= minorCount() ||
+                    (p > offsets[i] && indices[p] <= indices[p - 1])) {
+                    throw std::invalid_argument("Sparse matrix indices must be in range and ascending");
+                }
+            }
+        }
+    }
+
+    // Build from coordinate entries; duplicate positions are summed
+    static SparseMatrix fromEntries(int numRows, int numCols, std::vector<SparseEntry<T>> entries,
+                                    SparseFormat format = SPARSE_CSR) {
+        for (std::size_t e = 0; e < entries.size(); e++) {
+            if (entries[e].row < 0 || entries[e].row >= numRows || entries[e].col < 0 || entries[e].col >= numCols) {
+                throw std::invalid_argument("Sparse entry is outside the matrix");
+            }
+        }
+        const bool byRow = format == SPARSE_CSR;
+        std::sort(entries.begin(), entries.end(), [byRow](const SparseEntry<T>& a, const SparseEntry<T>& b) {
+            return byRow ? (a.row != b.row ? a.row < b.row : a.col < b.col)
+                         : (a.col != b.col ? a.col < b.col : a.row < b.row);
+        });
+
+        SparseMatrix result(numRows, numCols, format);
+        result.indices.reserve(entries.size());
+        result.values.reserve(entries.size());
+        for (std::size_t e = 0; e < entries.size(); e++) {
+            int major = byRow ? entries[e].row : entries[e].col;
+            int minor = byRow ? entries[e].col : entries[e].row;
+            if (e > 0 && entries[e].row == entries[e - 1].row && entries[e].col == entries[e - 1].col) {
+                result.values.back() += entries[e].value;
+                continue;
+            }
+            result.offsets[major + 1]++;
+            result.indices.push_back(minor);
+            result.values.push_back(entries[e].value);
+        }
+        for (int i = 0; i < result.majorCount(); i++) {
+            result.offsets[i + 1] += result.offsets[i];
+        }
+        return result;
+    }
+
+    // Build from the nonzeros of a dense matrix
+    static SparseMatrix fromDense(const Matrix<T>& dense, SparseFormat format = SPARSE_CSR) {
+        SparseMatrix result(dense.getRows(), dense.getCols(), SPARSE_CSR);
+        for (int i = 0; i < dense.getRows(); i++) {
+            const T* row = dense.rowPtr(i);
+            for (int j = 0; j < dense.getCols(); j++) {
+                if (row[j] != T()) {
+                    result.indices.push_back(j);
+                    result.values.push_back(row[j]);
+                }
+            }
+            result.offsets[i + 1] = static_cast<long>(result.indices.size());
+        }
+        return format == SPARSE_CSR ? result : result.toFormat(format);
+    }
+
+    // Dense copy
+    Matrix<T> toDense() const {
+        Matrix<T> dense(rows, cols);
+        for (int i = 0; i < majorCount(); i++) {
+            for (long p = offsets[i]; p < offsets[i + 1]; p++) {
+                if (layout == SPARSE_CSR) {
+                    dense(i, indices[p]) = values[p];
+                } else {
+                    dense(indices[p], i) = values[p];
+                }
+            }
+        }
+        return dense;
+    }
+
+    // The same matrix in the other compressed form (a counting sort, O(nnz))
+    SparseMatrix toFormat(SparseFormat format) const {
+        if (format == layout) {
+            return *this;
+        }
+        SparseMatrix result(rows, cols, format);
+        const int minor = minorCount();
+        for (std::size_t p = 0; p < indices.size(); p++) {
+            result.offsets[indices[p] + 1]++;
+        }
+        for (int i = 0; i < minor; i++) {
+            result.offsets[i + 1] += result.offsets[i];
+        }
+        result.indices.resize(indices.size());
+        result.values.resize(values.size());
+        std::vector<long> next(result.offsets.begin(), result.offsets.end() - 1);
+        for (int i = 0; i < majorCount(); i++) {
+            for (long p = offsets[i]; p < offsets[i + 1]; p++) {
+                long q = next[indices[p]]++;
+                result.indices[q] = i;
+                result.values[q] = values[p];
+            }
+        }
+        return result;
+    }
+
+    int getRows() const { return rows; }
+    int getCols() const { return cols; }
+    SparseFormat format() const { return layout; }
+    long nonZeros() const { return static_cast<long>(values.size()); }
+
+    // Compressed arrays (see the member comments)
+    const std::vector<long>& getOffsets() const { return offsets; }
+    const std::vector<int>& getIndices() const { return indices; }
+    const std::vector<T>& getValues() const { return values; }
+
+    // Element lookup (binary search within the row or column)
+    T operator()(int row, int col) const {
+        int major = layout == SPARSE_CSR ? row : col;
+        int minor = layout == SPARSE_CSR ? col : row;
+        std::vector<int>::const_iterator first = indices.begin() + offsets[major];
+        std::vector<int>::const_iterator last = indices.begin() + offsets[major + 1];
+        std::vector<int>::const_iterator it = std::lower_bound(first, last, minor);
+        return it != last && *it == minor ? values[it - indices.begin()] : T();
+    }
+
+    // Sparse matrix-vector product y = A * x
+    std::vector<T> multiply(const std::vector<T>& x) const {
+        if (static_cast<int>(x.size()) != cols) {
+            throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+        }
+        std::vector<T> y(rows, T());
+        if (layout == SPARSE_CSC) {
+            // Scatter each column; columns write to shared rows, so this stays serial
+            for (int j = 0; j < cols; j++) {
+                for (long p = offsets[j]; p < offsets[j + 1]; p++) {
+                    y[indices[p]] += values[p] * x[j];
+                }
+            }
+            return y;
+        }
+
+        std::vector<int> bounds = sparseChunks(offsets, rows, 1);
+        ThreadPool::instance().parallelFor(static_cast<int>(bounds.size()) - 1, [&](int task) {
+            for (int i = bounds[task]; i < bounds[task + 1]; i++) {
+                T sum = T();
+                for (long p = offsets[i]; p < offsets[i + 1]; p++) {
+                    sum += values[p] * x[indices[p]];
+                }
+                y[i] = sum;
+            }
+        });
+        return y;
+    }
+};
+
+// Sparse x dense: every nonzero A(i, k) adds A(i, k) * B(k, :) to C(i, :)
+template <typename T>
+Matrix<T> operator*(const SparseMatrix<T>& a, const Matrix<T>& b) {
+    if (a.getCols() != b.getRows()) {
+        throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+    }
+    // Rows of C are independent in CSR form, so CSC operands are converted
+    const SparseMatrix<T> csr = a.toFormat(SPARSE_CSR);
+    const std::vector<long>& offsets = csr.getOffsets();
+    const std::vector<int>& indices = csr.getIndices();
+    const std::vector<T>& values = csr.getValues();
+
+    Matrix<T> result(a.getRows(), b.getCols());
+    void (*axpy)(T*, T, const T*, std::size_t) = simdKernels<T>().axpy;
+    std::vector<int> bounds = sparseChunks(offsets, a.getRows(), b.getCols());
+    ThreadPool::instance().parallelFor(static_cast<int>(bounds.size()) - 1, [&](int task) {
+        for (int i = bounds[task]; i < bounds[task + 1]; i++) {
+            T* out = result.rowPtr(i);
+            for (long p = offsets[i]; p < offsets[i + 1]; p++) {
+                axpy(out, values[p], b.rowPtr(indices[p]), b.getCols());
+            }
+        }
+    });
+    return result;
+}
+
+// Dense x sparse: row i of C combines the rows (CSR) or columns (CSC) of B
+// that the nonzeros of A(i, :) select
+template <typename T>
+Matrix<T> operator*(const Matrix<T>& a, const SparseMatrix<T>& b) {
+    if (a.getCols() != b.getRows()) {
+        throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+    }
+    const std::vector<long>& offsets = b.getOffsets();
+    const std::vector<int>& indices = b.getIndices();
+    const std::vector<T>& values = b.getValues();
+    const int n = b.getCols();
+    const int k = a.getCols();
+
+    Matrix<T> result(a.getRows(), n);
+    const long nonZeros = std::max(1L, b.nonZeros());
+    const int rowsPerTask = static_cast<int>(std::max(1L, SPARSE_PARALLEL_WORK / nonZeros));
+    const int tasks = (a.getRows() + rowsPerTask - 1) / rowsPerTask;
+    ThreadPool::instance().parallelFor(tasks, [&](int task) {
+        int end = std::min(a.getRows(), (task + 1) * rowsPerTask);
+        for (int i = task * rowsPerTask; i < end; i++) {
+            const T* aRow = a.rowPtr(i);
+            T* out = result.rowPtr(i);
+            if (b.format() == SPARSE_CSR) {
+                for (int p = 0; p < k; p++) {
+                    if (aRow[p] == T()) {
+                        continue;
+                    }
+                    for (long q = offsets[p]; q < offsets[p + 1]; q++) {
+                        out[indices[q]] += aRow[p] * values[q];
+                    }
+                }
+            } else {
+                for (int j = 0; j < n; j++) {
+                    T sum = T();
+                    for (long q = offsets[j]; q < offsets[j + 1]; q++) {
+                        sum += aRow[indices[q]] * values[q];
+                    }
+                    out[j] = sum;
+                }
+            }
+        }
+    });
+    return result;
+}
+
+// Sparse x sparse (Gustavson's row-by-row algorithm), giving a CSR result.
+// Each row of C is gathered in a dense accumulator indexed by column.
+template <typename T>
+SparseMatrix<T> operator*(const SparseMatrix<T>& a, const SparseMatrix<T>& b) {
+    if (a.getCols() != b.getRows()) {
+        throw std::invalid_argument("Matrix dimensions do not match for multiplication");
+    }
+    const SparseMatrix<T> csrA = a.toFormat(SPARSE_CSR);
+    const SparseMatrix<T> csrB = b.toFormat(SPARSE_CSR);
+    const std::vector<long>& aOffsets = csrA.getOffsets();
+    const std::vector<int>& aIndices = csrA.getIndices();
+    const std::vector<T>& aValues = csrA.getValues();
+    const std::vector<long>& bOffsets = csrB.getOffsets();
+    const std::vector<int>& bIndices = csrB.getIndices();
+    const std::vector<T>& bValues = csrB.getValues();
+    const int m = a.getRows();
+    const int n = b.getCols();
+
+    // Two passes: the first counts the columns of every row of C, so the
+    // second can write values straight into the final arrays
+    std::vector<int> bounds = sparseChunks(aOffsets, m, 1);
+    const int tasks = static_cast<int>(bounds.size()) - 1;
+    std::vector<long> offsets(m + 1, 0);
+    ThreadPool::instance().parallelFor(tasks, [&](int task) {
+        std::vector<int> lastRow(n, -1);
+        for (int i = bounds[task]; i < bounds[task + 1]; i++) {
+            long count = 0;
+            for (long p = aOffsets[i]; p < aOffsets[i + 1]; p++) {
+                const int k = aIndices[p];
+                for (long q = bOffsets[k]; q < bOffsets[k + 1]; q++) {
+                    if (lastRow[bIndices[q]] != i) {
+                        lastRow[bIndices[q]] = i;
+                        count++;
+                    }
+                }
+            }
+            offsets[i + 1] = count;
+        }
+    });
+    for (int i = 0; i < m; i++) {
+        offsets[i + 1] += offsets[i];
+    }
+
+    std::vector<int> indices(offsets[m]);
+    std::vector<T> values(offsets[m]);
+    ThreadPool::instance().parallelFor(tasks, [&](int task) {
+        std::vector<T> accumulator(n, T());
+        std::vector<int> lastRow(n, -1);
+        std::vector<int> touched;
+        for (int i = bounds[task]; i < bounds[task + 1]; i++) {
+            touched.clear();
+            for (long p = aOffsets[i]; p < aOffsets[i + 1]; p++) {
+                const int k = aIndices[p];
+                const T av = aValues[p];
+                for (long q = bOffsets[k]; q < bOffsets[k + 1]; q++) {
+                    const int j = bIndices[q];
+                    if (lastRow[j] != i) {
+                        lastRow[j] = i;
+                        accumulator[j] = av * bValues[q];
+                        touched.push_back(j);
+                    } else {
+                        accumulator[j] += av * bValues[q];
+                    }
+                }
+            }
+            // Emit columns in order: sort them, or scan every column when the
+            // row is dense enough that the scan is cheaper
+            if (touched.size() > static_cast<std::size_t>(n / 16)) {
+                touched.clear();
+                for (int j = 0; j < n; j++) {
+                    if (lastRow[j] == i) {
+                        touched.push_back(j);
+                    }
+                }
+            } else {
+                std::sort(touched.begin(), touched.end());
+            }
+            long out = offsets[i];
+            for (std::size_t t = 0; t < touched.size(); t++, out++) {
+                indices[out] = touched[t];
+                values[out] = accumulator[touched[t]];
+            }
+        }
+    });
+    return SparseMatrix<T>(m, n, SPARSE_CSR, std::move(offsets), std::move(indices), std::move(values));
+}
+
+// First line of the coordinate format: "rows cols nonzeros type"
+struct SparseFileHeader {
+    int rows;
+    int cols;
+    long nonZeros;
+    int dataType;
+};
+
+inline SparseFileHeader parseSparseHeader(TextScanner& scanner) {
+    SparseFileHeader header;
+    header.rows = scanner.parseInteger<int>();
+    header.cols = scanner.parseInteger<int>();
+    if (header.rows <= 0 || header.cols <= 0) {
+        scanner.fail("matrix dimensions must be positive");
+    }
+    header.nonZeros = scanner.parseInteger<long>();
+    if (header.nonZeros < 0) {
+        scanner.fail("nonzero count must not be negative");
+    }
+    header.dataType = scanner.parseInteger<int>();
+    return header;
+}
+
+// Parse the "row col value" lines that follow a header
+template <typename T>
+SparseMatrix<T> parseSparseEntries(TextScanner& scanner, const SparseFileHeader& header,
+                                   SparseFormat format = SPARSE_CSR) {
+    // Each entry takes at least six characters, which bounds a bogus count
+    std::vector<SparseEntry<T>> entries;
+    entries.reserve(static_cast<std::size_t>(std::min(header.nonZeros, static_cast<long>(scanner.remaining() / 6 + 1))));
+    for (long e = 0; e < header.nonZeros; e++) {
+        scanner.skipWhitespace();
+        const char* where = scanner.position();
+        SparseEntry<T> entry;
+        entry.row = scanner.parseInteger<int>();
+        entry.col = scanner.parseInteger<int>();
+        if (entry.row < 0 || entry.row >= header.rows || entry.col < 0 || entry.col >= header.cols) {
+            scanner.fail("entry is outside the matrix", where);
+        }
+        entry.value = scanner.parseValue<T>();
+        entries.push_back(entry);
+    }
+    return SparseMatrix<T>::fromEntries(header.rows, header.cols, std::move(entries), format);
+}
+
+// True if a text file starts with a coordinate header: positive dimensions,
+// a known type code and a nonzero count that fits both the matrix and the
+// rest of the file. Anything else is left to the dense loader.
+inline bool isSparseTextFile(const std::string& filename) {
+    MappedFile file(filename);
+    TextScanner scanner(file.data(), file.size());
+    SparseFileHeader header;
+    try {
+        header = parseSparseHeader(scanner);
+    } catch (const MatrixParseError&) {
+        return false;
+    }
+    if (header.dataType < MATRIX_TYPE_INT || header.dataType > MATRIX_TYPE_BFLOAT16) {
+        return false;
+    }
+    // Each entry takes at least six characters, as in parseSparseEntries
+    const long entrySpace = static_cast<long>(scanner.remaining() / 6);
+    return header.nonZeros <= entrySpace &&
+           static_cast<unsigned long long>(header.nonZeros) <=
+               static_cast<unsigned long long>(header.rows) * static_cast<unsigned long long>(header.cols);
+}
+
+// Loader for a coordinate text file
+class SparseTextLoader {
+private:
+    MappedFile file;
+    TextScanner scanner;
+
+public:
+    explicit SparseTextLoader(const std::string& filename)
+        : file(filename), scanner(file.data(), file.size()) {}
+
+    SparseFileHeader readHeader() {
+        return parseSparseHeader(scanner);
+    }
+
+    template <typename T>
+    SparseMatrix<T> readMatrix(const SparseFileHeader& header, SparseFormat format = SPARSE_CSR) {
+        return parseSparseEntries<T>(scanner, header, format);
+    }
+};
+
+#endif // SPARSE_MATRIX_H
@@ -0,0 +1,269 @@
+// Strassen-Winograd fast multiply for large square products
+// Each level splits the operands into 2 x 2 quadrants and forms the product
+// from 7 half-size products instead of 8, recursing until the size drops
+// below a threshold and the blocked engine (Gemm.h) takes over. Work is
+// O(n^2.81) instead of O(n^3). Odd sizes peel off the last row and column,
+// which are added with the blocked engine.
+//
+// Selection: setMultiplyAlgorithm() (the --multiply flag in main), else the
+// MATRIX_MULTIPLY environment variable (blocked|strassen); blocked is the
+// default. The threshold comes from setStrassenThreshold(), else
+// MATRIX_STRASSEN_THRESHOLD, else STRASSEN_DEFAULT_THRESHOLD.
+//
+// Accuracy:
+// - int: exact. Intermediate sums are formed in unsigned arithmetic, so they
+//   wrap modulo 2^32 and the wraparounds cancel; results match the blocked
+//   engine bit for bit whenever the true product fits in an int.
+// - double: only a normwise bound holds. With unit roundoff u and recursion
+//   stopping at size n0, ||C - C'|| <= c(n) u ||A|| ||B|| + O(u^2) where
+//   c(n) grows like (n / n0)^log2(18) * (n0^2 + 6 n0) (Higham, Accuracy and
+//   Stability of Numerical Algorithms, ch. 23), against n^2 for the blocked
+//   engine. Elements of C much smaller than ||A|| ||B|| can lose relative
+//   accuracy, so keep the blocked engine when that matters.
+
+#ifndef STRASSEN_H
+#define STRASSEN_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <type_traits>
+
+#include "Gemm.h"
+#include "MatrixStorage.h"
+
+enum MultiplyAlgorithm {
+    MULTIPLY_BLOCKED = 0,
+    MULTIPLY_STRASSEN = 1
+};
+
+// Products smaller than this run on the blocked engine. Every level adds
+// about fifteen passes over quadrant-sized blocks, which only pays off when
+// the half-size products are large: on an AVX-512 machine, leaves of 128 or
+// 256 were slower than the blocked engine at every size up to 4096, while
+// leaves of 512 (this threshold) were 15-25% faster from 2048 up.
+const int STRASSEN_DEFAULT_THRESHOLD = 1024;
+
+// Smallest threshold accepted, so the recursion always bottoms out in
+// products the blocked engine handles well
+const int STRASSEN_MIN_THRESHOLD = 32;
+
+struct MultiplySettings {
+    MultiplyAlgorithm algorithm;
+    int threshold;
+
+    static MultiplySettings& instance() {
+        static MultiplySettings settings = fromEnvironment();
+        return settings;
+    }
+
+private:
+    static MultiplySettings fromEnvironment() {
+        MultiplySettings settings;
+        settings.algorithm = MULTIPLY_BLOCKED;
+        settings.threshold = STRASSEN_DEFAULT_THRESHOLD;
+        const char* algorithm = std::getenv("MATRIX_MULTIPLY");
+        if (algorithm && std::strcmp(algorithm, "strassen") == 0) {
+            settings.algorithm = MULTIPLY_STRASSEN;
+        }
+        const char* threshold = std::getenv("MATRIX_STRASSEN_THRESHOLD");
+        if (threshold && std::atoi(threshold) > 0) {
+            settings.threshold = std::max(STRASSEN_MIN_THRESHOLD, std::atoi(threshold));
+        }
+        return settings;
+    }
+};
+
+inline void setMultiplyAlgorithm(MultiplyAlgorithm algorithm) {
+    MultiplySettings::instance().algorithm = algorithm;
+}
+
+inline MultiplyAlgorithm multiplyAlgorithm() {
+    return MultiplySettings::instance().algorithm;
+}
+
+inline void setStrassenThreshold(int threshold) {
+    MultiplySettings::instance().threshold = std::max(STRASSEN_MIN_THRESHOLD, threshold);
+}
+
+inline int strassenThreshold() {
+    return MultiplySettings::instance().threshold;
+}
+
+// Type in which operand sums are formed: unsigned for integers, so that
+// intermediate overflow is well defined and cancels out
+template <typename T, bool = std::is_integral<T>::value>
+struct StrassenWord {
+    typedef T Type;
+};
+
+template <typename T>
+struct StrassenWord<T, true> {
+    typedef typename std::make_unsigned<T>::type Type;
+};
+
+// dst = terms[0] + signs[1] * terms[1] + ... over count equal-shaped blocks
+template <typename T>
+void strassenSum(const MatrixBlock<T>& dst, std::initializer_list<MatrixBlock<const T>> terms,
+                 std::initializer_list<int> signs) {
+    typedef typename StrassenWord<T>::Type W;
+    for (int i = 0; i < dst.rows; i++) {
+        T* out = dst.rowPtr(i);
+        std::copy(terms.begin()->rowPtr(i), terms.begin()->rowPtr(i) + dst.cols, out);
+        const int* sign = signs.begin() + 1;
+        for (const MatrixBlock<const T>* term = terms.begin() + 1; term != terms.end(); ++term, ++sign) {
+            const T* in = term->rowPtr(i);
+            if (*sign > 0) {
+                for (int j = 0; j < dst.cols; j++) {
+                    out[j] = static_cast<T>(static_cast<W>(out[j]) + static_cast<W>(in[j]));
+                }
+            } else {
+                for (int j = 0; j < dst.cols; j++) {
+                    out[j] = static_cast<T>(static_cast<W>(out[j]) - static_cast<W>(in[j]));
+                }
+            }
+        }
+    }
+}
+
+// dst += src
+template <typename T>
+void strassenAddTo(const MatrixBlock<T>& dst, const MatrixBlock<const T>& src) {
+    typedef typename StrassenWord<T>::Type W;
+    for (int i = 0; i < dst.rows; i++) {
+        T* out = dst.rowPtr(i);
+        const T* in = src.rowPtr(i);
+        for (int j = 0; j < dst.cols; j++) {
+            out[j] = static_cast<T>(static_cast<W>(out[j]) + static_cast<W>(in[j]));
+        }
+    }
+}
+
+// Dense h x h scratch block
+template <typename T>
+struct StrassenTemp {
+    AlignedBuffer<T> storage;
+    int stride;
+    int size;
+
+    explicit StrassenTemp(int h)
+        : storage(static_cast<std::size_t>(h) * matrixRowStride<T>(h)), stride(matrixRowStride<T>(h)), size(h) {}
+
+    MatrixBlock<T> block() {
+        return MatrixBlock<T>(storage.data(), nullptr, stride, size, size);
+    }
+
+    void clear() {
+        std::fill_n(storage.data(), storage.size(), T());
+    }
+};
+
+template <typename T>
+void strassenAccumulate(const MatrixBlock<const T>& a, const MatrixBlock<const T>& b, const MatrixBlock<T>& c,
+                        int threshold);
+
+// Multiply the even-sized square product through the 7 Winograd products
+//     P1 = A11 B11   P2 = A12 B21   P3 = S4 B22   P4 = A22 T4
+//     P5 = S1 T1     P6 = S2 T2     P7 = S3 T3
+//     U2 = P1 + P6   U3 = U2 + P7
+//     C11 += P1 + P2        C12 += U2 + P5 + P3
+//     C21 += U3 - P4        C22 += U3 + P5
+// Products with a single destination accumulate straight into their
+// quadrant of C (P4 through -T4); U2 and U3 build up in one scratch block.
+// A level needs three quadrant-sized temporaries.
+template <typename T>
+void strassenLevel(const MatrixBlock<const T>& a, const MatrixBlock<const T>& b, const MatrixBlock<T>& c,
+                   int threshold) {
+    const int h = c.rows / 2;
+    const MatrixBlock<const T> a11 = a.sub(0, 0, h, h), a12 = a.sub(0, h, h, h);
+    const MatrixBlock<const T> a21 = a.sub(h, 0, h, h), a22 = a.sub(h, h, h, h);
+    const MatrixBlock<const T> b11 = b.sub(0, 0, h, h), b12 = b.sub(0, h, h, h);
+    const MatrixBlock<const T> b21 = b.sub(h, 0, h, h), b22 = b.sub(h, h, h, h);
+    const MatrixBlock<T> c11 = c.sub(0, 0, h, h), c12 = c.sub(0, h, h, h);
+    const MatrixBlock<T> c21 = c.sub(h, 0, h, h), c22 = c.sub(h, h, h, h);
+
+    StrassenTemp<T> sumA(h), sumB(h), scratch(h);
+    const MatrixBlock<T> s = sumA.block();
+    const MatrixBlock<T> t = sumB.block();
+    const MatrixBlock<T> u = scratch.block();
+
+    // U = P1; C11 += P1 + P2
+    strassenAccumulate(a11, b11, u, threshold);
+    strassenAddTo(c11, MatrixBlock<const T>(u));
+    strassenAccumulate(a12, b21, c11, threshold);
+
+    // U = U2 = P1 + P6, with S2 = A21 + A22 - A11 and T2 = B22 - B12 + B11
+    strassenSum(s, {a21, a22, a11}, {1, 1, -1});
+    strassenSum(t, {b22, b12, b11}, {1, -1, 1});
+    strassenAccumulate(MatrixBlock<const T>(s), MatrixBlock<const T>(t), u, threshold);
+    strassenAddTo(c12, MatrixBlock<const T>(u));
+
+    // U = U3 = U2 + P7, with S3 = A11 - A21 and T3 = B22 - B12
+    strassenSum(s, {a11, a21}, {1, -1});
+    strassenSum(t, {b22, b12}, {1, -1});
+    strassenAccumulate(MatrixBlock<const T>(s), MatrixBlock<const T>(t), u, threshold);
+    strassenAddTo(c21, MatrixBlock<const T>(u));
+    strassenAddTo(c22, MatrixBlock<const T>(u));
+
+    // C12 += P3, with S4 = A12 - A21 - A22 + A11
+    strassenSum(s, {a12, a21, a22, a11}, {1, -1, -1, 1});
+    strassenAccumulate(MatrixBlock<const T>(s), b22, c12, threshold);
+
+    // C21 -= P4, as C21 += A22 (-T4) with -T4 = B21 - B22 + B12 - B11
+    strassenSum(t, {b21, b22, b12, b11}, {1, -1, 1, -1});
+    strassenAccumulate(a22, MatrixBlock<const T>(t), c21, threshold);
+
+    // C12 += P5 and C22 += P5, with S1 = A21 + A22 and T1 = B12 - B11
+    strassenSum(s, {a21, a22}, {1, 1});
+    strassenSum(t, {b12, b11}, {1, -1});
+    scratch.clear();
+    strassenAccumulate(MatrixBlock<const T>(s), MatrixBlock<const T>(t), u, threshold);
+    strassenAddTo(c12, MatrixBlock<const T>(u));
+    strassenAddTo(c22, MatrixBlock<const T>(u));
+}
+
+// C += A * B for square n x n operands, recursing while n >= threshold
+template <typename T>
+void strassenAccumulate(const MatrixBlock<const T>& a, const MatrixBlock<const T>& b, const MatrixBlock<T>& c,
+                        int threshold) {
+    const int n = c.rows;
+    if (n < threshold || a.rows != n || a.cols != n || b.cols != n) {
+        gemmAccumulate(a, b, c);
+        return;
+    }
+    if (n % 2 == 0) {
+        strassenLevel(a, b, c, threshold);
+        return;
+    }
+
+    // Odd size: recurse on the leading even part, then add the terms that
+    // involve the last row or column with the blocked engine
+    const int e = n - 1;
+    strassenLevel(a.sub(0, 0, e, e), b.sub(0, 0, e, e), c.sub(0, 0, e, e), threshold);
+    gemmAccumulate(a.sub(0, e, e, 1), b.sub(e, 0, 1, e), c.sub(0, 0, e, e));
+    gemmAccumulate(a.sub(0, 0, e, n), b.sub(0, e, n, 1), c.sub(0, e, e, 1));
+    gemmAccumulate(a.sub(e, 0, 1, n), b, c.sub(e, 0, 1, n));
+}
+
+// C += alpha * A * B with the selected algorithm: Strassen-Winograd for
+// square products at or above the threshold when it is enabled, else the
+// blocked engine. Products with a transposed operand or alpha != 1 always
+// take the blocked engine, which handles both while packing, as do types
+// accumulated in a wider type (bfloat16): Strassen's operand sums would be
+// rounded to the narrow type at every level.
+template <typename T>
+void multiplyAccumulate(const GemmOperand<T>& a, const GemmOperand<T>& b, const MatrixBlock<T>& c,
+                        T alpha = T(1)) {
+    const MultiplySettings& settings = MultiplySettings::instance();
+    if (settings.algorithm == MULTIPLY_STRASSEN && !GemmWidens<T>::value && !a.transposed && !b.transposed && alpha == T(1) &&
+        a.rows() == a.cols() && b.rows() == b.cols() && a.cols() == b.rows() && c.rows == a.rows() &&
+        c.cols == b.cols() && c.rows >= settings.threshold) {
+        strassenAccumulate(a.block, b.block, c, settings.threshold);
+        return;
+    }
+    gemmAccumulate(a, b, c, alpha);
+}
+
+#endif // STRASSEN_H
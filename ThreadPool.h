@@ -0,0 +1,238 @@
+// Work-stealing thread pool used to parallelize the Matrix<T> kernels
+// Each worker owns a deque of tasks: it pops its own work from the back and,
+// when idle, steals from the front of the other deques. Threads that wait for
+// a parallelFor to finish run queued tasks until none are left, so nested use
+// cannot deadlock, and then sleep until the last of their tasks completes.
+//
+// The thread count comes from setThreadCount() (the --threads flag in main),
+// else the MATRIX_THREADS environment variable, else the hardware concurrency.
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+private:
+    struct TaskQueue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<TaskQueue>> queues;  // one per thread, caller included
+    std::vector<std::thread> workers;
+    std::atomic<int> pending;
+    std::atomic<bool> stopping;
+    std::atomic<unsigned> nextQueue;
+    std::mutex sleepLock;
+    std::condition_variable wakeUp;
+
+    // Queue index of the calling thread, or -1 if it is not one of ours
+    static int& currentIndex() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    static int& requestedThreads() {
+        static int count = 0;
+        return count;
+    }
+
+    static std::unique_ptr<ThreadPool>& globalPool() {
+        static std::unique_ptr<ThreadPool> pool;
+        return pool;
+    }
+
+    // globalPool() as seen by instance() without taking globalLock()
+    static std::atomic<ThreadPool*>& cachedPool() {
+        static std::atomic<ThreadPool*> pool(nullptr);
+        return pool;
+    }
+
+    static std::mutex& globalLock() {
+        static std::mutex lock;
+        return lock;
+    }
+
+    void push(int queue, std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> guard(queues[queue]->lock);
+            queues[queue]->tasks.push_back(std::move(task));
+        }
+        pending.fetch_add(1);
+    }
+
+    // Pop from our own queue first, then steal from the others
+    bool runOneTask(int self) {
+        std::function<void()> task;
+        int count = static_cast<int>(queues.size());
+        for (int offset = 0; offset < count && !task; offset++) {
+            int victim = (self + offset) % count;
+            std::lock_guard<std::mutex> guard(queues[victim]->lock);
+            std::deque<std::function<void()>>& tasks = queues[victim]->tasks;
+            if (tasks.empty()) {
+                continue;
+            }
+            if (offset == 0) {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+            } else {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+        }
+        if (!task) {
+            return false;
+        }
+        pending.fetch_sub(1);
+        task();
+        return true;
+    }
+
+    void workerLoop(int index) {
+        currentIndex() = index;
+        while (!stopping.load()) {
+            if (runOneTask(index)) {
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleepLock);
+            wakeUp.wait(guard, [this]() { return stopping.load() || pending.load() > 0; });
+        }
+    }
+
+public:
+    explicit ThreadPool(int threads) : pending(0), stopping(false), nextQueue(0) {
+        threads = std::max(1, threads);
+        for (int i = 0; i < threads; i++) {
+            queues.emplace_back(new TaskQueue());
+        }
+        // Queue 0 belongs to outside callers; workers use 1..threads-1
+        for (int i = 1; i < threads; i++) {
+            workers.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            stopping.store(true);
+        }
+        wakeUp.notify_all();
+        for (size_t i = 0; i < workers.size(); i++) {
+            workers[i].join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Total threads taking part in a parallelFor, including the caller
+    int threadCount() const {
+        return static_cast<int>(queues.size());
+    }
+
+    // Run fn(i) for every i in [0, count) and wait for all of them.
+    // The calling thread works on the tasks too. The first exception thrown
+    // by a task is rethrown here once every task has finished.
+    void parallelFor(int count, const std::function<void(int)>& fn) {
+        if (count <= 0) {
+            return;
+        }
+        if (count == 1 || queues.size() == 1) {
+            for (int i = 0; i < count; i++) {
+                fn(i);
+            }
+            return;
+        }
+
+        std::atomic<int> remaining(count);
+        std::exception_ptr error;
+        std::mutex errorLock;
+        // Set by the last task under doneLock, which is held while waking us,
+        // so these locals outlive every access from the tasks
+        bool finished = false;
+        std::mutex doneLock;
+        std::condition_variable done;
+
+        int self = currentIndex() >= 0 ? currentIndex() : 0;
+        int queueCount = static_cast<int>(queues.size());
+        unsigned start = nextQueue.fetch_add(1);
+        for (int i = 0; i < count; i++) {
+            int queue = static_cast<int>((start + i) % queueCount);
+            push(queue, [&fn, &remaining, &error, &errorLock, &finished, &doneLock, &done, i]() {
+                try {
+                    fn(i);
+                } catch (...) {
+                    std::lock_guard<std::mutex> guard(errorLock);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+                if (remaining.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> guard(doneLock);
+                    finished = true;
+                    done.notify_one();
+                }
+            });
+        }
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+        }
+        wakeUp.notify_all();
+
+        // Once the queues are empty the tasks left are running on other threads
+        while (remaining.load() > 0 && runOneTask(self)) {
+        }
+        {
+            std::unique_lock<std::mutex> guard(doneLock);
+            done.wait(guard, [&finished]() { return finished; });
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Thread count to use when the global pool is (re)created; 0 means default
+    static void setThreadCount(int threads) {
+        std::lock_guard<std::mutex> guard(globalLock());
+        requestedThreads() = threads;
+        cachedPool().store(nullptr, std::memory_order_release);
+        globalPool().reset();
+    }
+
+    // Shared pool used by the matrix kernels; globalLock() is only taken to
+    // create it
+    static ThreadPool& instance() {
+        ThreadPool* cached = cachedPool().load(std::memory_order_acquire);
+        if (cached) {
+            return *cached;
+        }
+        std::lock_guard<std::mutex> guard(globalLock());
+        std::unique_ptr<ThreadPool>& pool = globalPool();
+        if (!pool) {
+            int threads = requestedThreads();
+            if (threads <= 0) {
+                const char* env = std::getenv("MATRIX_THREADS");
+                threads = env ? std::atoi(env) : 0;
+            }
+            if (threads <= 0) {
+                threads = static_cast<int>(std::thread::hardware_concurrency());
+            }
+            pool.reset(new ThreadPool(threads));
+            cachedPool().store(pool.get(), std::memory_order_release);
+        }
+        return *pool;
+    }
+};
+
+#endif // THREAD_POOL_H